@@ -4,19 +4,28 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "clock_sync.h"
+#include "conn_table.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "group_control.h"
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
 #include "host/util/util.h"
 #include "light_effects.h"
 #include "nimble/hci_common.h"
+#include "nimble/nimble_npl.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
 #include "pwm_control.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
+#include "state_store.h"
+#include "timeline.h"
+#include "effect_vm.h"
 
 static const char *TAG = "BLE_SERVER";
 
@@ -37,6 +46,29 @@ static int rgbw_brightness_access(uint16_t conn_handle, uint16_t attr_handle,
                                   struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int rgbw_speed_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_chip_info_access(uint16_t conn_handle, uint16_t attr_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_transition_access(uint16_t conn_handle, uint16_t attr_handle,
+                                  struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_layers_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_timeline_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_program_access(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_state_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_diagnostics_access(uint16_t conn_handle, uint16_t attr_handle,
+                                   struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_stream_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rgbw_tempo_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+static uint16_t state_val_handle;
+static uint16_t stream_val_handle;
+
+static void adv_state_update(void);
 
 // GATT service definition
 static const struct ble_gatt_svc_def gatt_svc_def[] = {
@@ -84,6 +116,50 @@ static const struct ble_gatt_svc_def gatt_svc_def[] = {
                 .access_cb = rgbw_chip_info_access,
                 .flags = BLE_GATT_CHR_F_READ, // Read-only
             },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_TRANSITION),
+                .access_cb = rgbw_transition_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_LAYERS),
+                .access_cb = rgbw_layers_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_TIMELINE),
+                .access_cb = rgbw_timeline_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_PROGRAM),
+                .access_cb = rgbw_program_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_STATE),
+                .access_cb = rgbw_state_access,
+                .val_handle = &state_val_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                         BLE_GATT_CHR_F_NOTIFY,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_DIAGNOSTICS),
+                .access_cb = rgbw_diagnostics_access,
+                .flags = BLE_GATT_CHR_F_READ, // Read-only
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_STREAM),
+                .access_cb = rgbw_stream_access,
+                .val_handle = &stream_val_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                         BLE_GATT_CHR_F_NOTIFY,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(RGBW_CHAR_UUID_TEMPO),
+                .access_cb = rgbw_tempo_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
+            },
             {
                 0, /* No more characteristics in this service */
             },
@@ -109,9 +185,232 @@ static uint8_t convert_from_driver_resolution(uint32_t driver_value) {
     return (driver_value * 255) / max_duty;
 }
 
+// Connections. Every central gets a slot in the connection table
+// (conn_table.h) and, at the same index, its own link parameters and idle
+// timer; the effects engine only hears about the first connect and the
+// last disconnect.
+//
+// Link parameters: while a client is writing, ask for a short connection
+// interval so a write reaches the effects task within a frame; after
+// CONFIG_BLE_LINK_IDLE_TIMEOUT_MS without one, ask for a long interval with
+// slave latency. The central has the final say: the negotiated values are
+// tracked from the GAP events and reported by the diagnostics read.
+#define MAX_CONNECTIONS         CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define LINK_PREFERRED_MTU      247   // One 251-byte LL packet with data length extension
+#define LINK_TX_OCTETS          251
+#define LINK_TX_TIME_US         2120  // 251 bytes on the 1M PHY
+
+static const struct ble_gap_upd_params link_params[] = {
+    [BLE_LINK_PROFILE_FAST] = {
+        .itvl_min = 6,                  // 7.5 ms
+        .itvl_max = 12,                 // 15 ms
+        .latency = 0,
+        .supervision_timeout = 400,     // 4 s
+    },
+    [BLE_LINK_PROFILE_IDLE] = {
+        .itvl_min = 80,                 // 100 ms
+        .itvl_max = 100,                // 125 ms
+        .latency = 4,
+        .supervision_timeout = 600,     // 6 s
+    },
+};
+
+typedef struct {
+    ble_link_profile_t profile;         // Last profile requested
+    uint16_t interval;                  // Negotiated, 1.25 ms units
+    uint16_t latency;
+    uint16_t timeout;                   // 10 ms units
+    uint16_t mtu;
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+    uint16_t tx_octets;
+    uint32_t last_write_ms;
+    bool state_notify;                  // Subscribed to state notifications
+    esp_timer_handle_t idle_timer;
+    struct ble_npl_event idle_event;    // Idle check, run on the host task
+} ble_conn_t;
+
+_Static_assert(CONN_TABLE_NONE == BLE_HS_CONN_HANDLE_NONE, "free slot marker");
+_Static_assert(MAX_CONNECTIONS <= CONN_TABLE_MAX_SLOTS, "connection table too small");
+
+// Concurrent writers: with CONFIG_BLE_CONTROL_HOLD_MS at 0 every write is
+// applied in arrival order (last writer wins). Otherwise the client that
+// wrote last keeps control until it has been quiet that long, and writes
+// from the others are refused.
+static conn_table_t conn_table;
+static ble_conn_t conns[MAX_CONNECTIONS];
+
+static ble_conn_t *conn_find(uint16_t conn_handle) {
+    int slot = conn_table_find(&conn_table, conn_handle);
+    return slot < 0 ? NULL : &conns[slot];
+}
+
+// BLE_HS_CONN_HANDLE_NONE once the connection is gone
+static uint16_t conn_handle_of(const ble_conn_t *conn) {
+    return conn_table.handle[conn - conns];
+}
+
+static uint32_t link_now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void link_request_profile(ble_conn_t *conn, ble_link_profile_t profile) {
+    uint16_t conn_handle = conn_handle_of(conn);
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return;
+    }
+
+    conn->profile = profile;
+    int rc = ble_gap_update_params(conn_handle, &link_params[profile]);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Link profile %d request failed on %d; rc=%d", profile, conn_handle, rc);
+    }
+}
+
+// The idle timer fires on the esp_timer task, which must not touch the
+// connection table; it hands the check to the host task, which owns it.
+static void link_idle_tick(void *arg) {
+    ble_conn_t *conn = (ble_conn_t *)arg;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->idle_event);
+}
+
+// Host task. Re-arms the timer for whatever is left of the timeout, so
+// writes only have to store a timestamp.
+static void link_idle_check(struct ble_npl_event *ev) {
+    ble_conn_t *conn = (ble_conn_t *)ble_npl_event_get_arg(ev);
+    uint32_t idle_ms = link_now_ms() - conn->last_write_ms;
+
+    if (conn_handle_of(conn) == BLE_HS_CONN_HANDLE_NONE) {
+        return;
+    }
+    if (idle_ms < CONFIG_BLE_LINK_IDLE_TIMEOUT_MS) {
+        esp_timer_start_once(conn->idle_timer, (uint64_t)(CONFIG_BLE_LINK_IDLE_TIMEOUT_MS - idle_ms) * 1000);
+        return;
+    }
+    ESP_LOGI(TAG, "💤 Link %d idle, requesting power-saving parameters", conn_handle_of(conn));
+    link_request_profile(conn, BLE_LINK_PROFILE_IDLE);
+}
+
+// Every write goes through here first: it keeps the writer's link fast and
+// applies the write policy. Returns 0 or the ATT error for the client.
+static int client_write(uint16_t conn_handle) {
+    ble_conn_t *conn = conn_find(conn_handle);
+    uint32_t now_ms = link_now_ms();
+
+    if (!conn_table_claim_control(&conn_table, conn_handle, now_ms)) {
+        return RGBW_ATT_ERR_CONTROL_HELD;
+    }
+
+    if (conn != NULL) {
+        conn->last_write_ms = now_ms;
+        if (conn->profile == BLE_LINK_PROFILE_IDLE) {
+            link_request_profile(conn, BLE_LINK_PROFILE_FAST);
+            esp_timer_start_once(conn->idle_timer, (uint64_t)CONFIG_BLE_LINK_IDLE_TIMEOUT_MS * 1000);
+        }
+    }
+    return 0;
+}
+
+static void link_negotiate(ble_conn_t *conn) {
+    uint16_t conn_handle = conn_handle_of(conn);
+    int rc;
+
+    // Ask for everything at once; each arrives as its own GAP event, and a
+    // central that refuses just leaves that parameter where it was
+    link_request_profile(conn, BLE_LINK_PROFILE_FAST);
+    rc = ble_gap_set_prefered_le_phy(conn_handle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "2M PHY request failed; rc=%d", rc);
+    }
+    rc = ble_gap_set_data_len(conn_handle, LINK_TX_OCTETS, LINK_TX_TIME_US);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Data length request failed; rc=%d", rc);
+    }
+    rc = ble_gattc_exchange_mtu(conn_handle, NULL, NULL);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "MTU exchange failed; rc=%d", rc);
+    }
+}
+
+static void conn_added(uint16_t conn_handle, const struct ble_gap_conn_desc *desc) {
+    uint32_t count = conn_table.count;
+    int slot = conn_table_add(&conn_table, conn_handle);
+
+    if (slot < 0) {
+        // More links than configured slots; the host should have refused it
+        ESP_LOGW(TAG, "No connection slot for %d", conn_handle);
+        return;
+    }
+    if (conn_table.count == count) {
+        return;  // Already in the table
+    }
+
+    ble_conn_t *conn = &conns[slot];
+    conn->profile = BLE_LINK_PROFILE_NONE;
+    conn->interval = desc->conn_itvl;
+    conn->latency = desc->conn_latency;
+    conn->timeout = desc->supervision_timeout;
+    conn->mtu = ble_att_mtu(conn_handle);
+    conn->tx_octets = 27;  // Until data length extension is negotiated
+    if (ble_gap_read_le_phy(conn_handle, &conn->tx_phy, &conn->rx_phy) != 0) {
+        conn->tx_phy = BLE_GAP_LE_PHY_1M;
+        conn->rx_phy = BLE_GAP_LE_PHY_1M;
+    }
+    conn->last_write_ms = link_now_ms();
+    conn->state_notify = false;
+
+    if (conn_table.count == 1) {
+        light_effects_set_ble_connected(true);
+    }
+    ESP_LOGI(TAG, "Connection %d in use, %lu of %d", conn_handle, (unsigned long)conn_table.count, MAX_CONNECTIONS);
+
+    link_negotiate(conn);
+    esp_timer_start_once(conn->idle_timer, (uint64_t)CONFIG_BLE_LINK_IDLE_TIMEOUT_MS * 1000);
+}
+
+static void conn_removed(uint16_t conn_handle) {
+    ble_conn_t *conn = conn_find(conn_handle);
+    if (conn == NULL) {
+        return;
+    }
+
+    esp_timer_stop(conn->idle_timer);
+    ble_npl_eventq_remove(nimble_port_get_dflt_eventq(), &conn->idle_event);
+    conn->profile = BLE_LINK_PROFILE_NONE;
+    conn->state_notify = false;
+    conn_table_remove(&conn_table, conn_handle);
+
+    // Only the last client leaving hands the light back to the default effect
+    if (conn_table.count == 0) {
+        light_effects_set_ble_connected(false);
+    }
+    ESP_LOGI(TAG, "Connection %d closed, %lu of %d in use", conn_handle, (unsigned long)conn_table.count, MAX_CONNECTIONS);
+}
+
+// Access callbacks run on the NimBLE host task: they only validate and
+// queue, and the effects task applies the command on its next frame
+static int post_command(uint16_t conn_handle, const light_command_t *cmd) {
+    int rc = client_write(conn_handle);
+    if (rc != 0) {
+        return rc;
+    }
+    return light_effects_post(cmd) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+// Manual channel write: the effects task switches to the static effect
+static int post_channel(uint16_t conn_handle, pwm_channel_t channel, uint8_t ble_value) {
+    light_command_t cmd = {
+        .type = LIGHT_CMD_CHANNEL,
+        .channel = { .channel = channel, .duty = convert_to_driver_resolution(ble_value) },
+    };
+    return post_command(conn_handle, &cmd);
+}
+
 static int rgbw_red_access(uint16_t conn_handle, uint16_t attr_handle,
                            struct ble_gatt_access_ctxt *ctxt, void *arg) {
     int rc;
+    uint8_t value;
 
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
@@ -120,19 +419,15 @@ static int rgbw_red_access(uint16_t conn_handle, uint16_t attr_handle,
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
         case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = ble_hs_mbuf_to_flat(ctxt->om, &current_rgbw[0], sizeof(uint8_t), NULL);
+            rc = ble_hs_mbuf_to_flat(ctxt->om, &value, sizeof(value), NULL);
             if (rc != 0) {
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
-            // Enable manual mode when individual colors are set
-            light_effects_enable_manual_mode();
-            light_effects_set_effect(EFFECT_STATIC);
-
-            // Convert 8-bit BLE value to driver resolution
-            uint32_t driver_value = convert_to_driver_resolution(current_rgbw[0]);
-            pwm_set_duty(PWM_CHANNEL_RED, driver_value);
-            ESP_LOGI(TAG, "🔴 Red set to: %d (driver: %lu)", current_rgbw[0], (unsigned long)driver_value);
-            return 0;
+            rc = post_channel(conn_handle, PWM_CHANNEL_RED, value);
+            if (rc == 0) {
+                current_rgbw[0] = value;
+            }
+            return rc;
 
         default:
             assert(0);
@@ -143,6 +438,7 @@ static int rgbw_red_access(uint16_t conn_handle, uint16_t attr_handle,
 static int rgbw_green_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
     int rc;
+    uint8_t value;
 
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
@@ -151,19 +447,15 @@ static int rgbw_green_access(uint16_t conn_handle, uint16_t attr_handle,
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
         case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = ble_hs_mbuf_to_flat(ctxt->om, &current_rgbw[1], sizeof(uint8_t), NULL);
+            rc = ble_hs_mbuf_to_flat(ctxt->om, &value, sizeof(value), NULL);
             if (rc != 0) {
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
-            // Enable manual mode when individual colors are set
-            light_effects_enable_manual_mode();
-            light_effects_set_effect(EFFECT_STATIC);
-
-            // Convert 8-bit BLE value to driver resolution
-            uint32_t driver_value = convert_to_driver_resolution(current_rgbw[1]);
-            pwm_set_duty(PWM_CHANNEL_GREEN, driver_value);
-            ESP_LOGI(TAG, "🟢 Green set to: %d (driver: %lu)", current_rgbw[1], (unsigned long)driver_value);
-            return 0;
+            rc = post_channel(conn_handle, PWM_CHANNEL_GREEN, value);
+            if (rc == 0) {
+                current_rgbw[1] = value;
+            }
+            return rc;
 
         default:
             assert(0);
@@ -174,6 +466,7 @@ static int rgbw_green_access(uint16_t conn_handle, uint16_t attr_handle,
 static int rgbw_blue_access(uint16_t conn_handle, uint16_t attr_handle,
                             struct ble_gatt_access_ctxt *ctxt, void *arg) {
     int rc;
+    uint8_t value;
 
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
@@ -182,19 +475,15 @@ static int rgbw_blue_access(uint16_t conn_handle, uint16_t attr_handle,
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
         case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = ble_hs_mbuf_to_flat(ctxt->om, &current_rgbw[2], sizeof(uint8_t), NULL);
+            rc = ble_hs_mbuf_to_flat(ctxt->om, &value, sizeof(value), NULL);
             if (rc != 0) {
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
-            // Enable manual mode when individual colors are set
-            light_effects_enable_manual_mode();
-            light_effects_set_effect(EFFECT_STATIC);
-
-            // Convert 8-bit BLE value to driver resolution
-            uint32_t driver_value = convert_to_driver_resolution(current_rgbw[2]);
-            pwm_set_duty(PWM_CHANNEL_BLUE, driver_value);
-            ESP_LOGI(TAG, "🔵 Blue set to: %d (driver: %lu)", current_rgbw[2], (unsigned long)driver_value);
-            return 0;
+            rc = post_channel(conn_handle, PWM_CHANNEL_BLUE, value);
+            if (rc == 0) {
+                current_rgbw[2] = value;
+            }
+            return rc;
 
         default:
             assert(0);
@@ -205,6 +494,7 @@ static int rgbw_blue_access(uint16_t conn_handle, uint16_t attr_handle,
 static int rgbw_white_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
     int rc;
+    uint8_t value;
 
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
@@ -213,19 +503,15 @@ static int rgbw_white_access(uint16_t conn_handle, uint16_t attr_handle,
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
         case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = ble_hs_mbuf_to_flat(ctxt->om, &current_rgbw[3], sizeof(uint8_t), NULL);
+            rc = ble_hs_mbuf_to_flat(ctxt->om, &value, sizeof(value), NULL);
             if (rc != 0) {
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
-            // Enable manual mode when individual colors are set
-            light_effects_enable_manual_mode();
-            light_effects_set_effect(EFFECT_STATIC);
-
-            // Convert 8-bit BLE value to driver resolution
-            uint32_t driver_value = convert_to_driver_resolution(current_rgbw[3]);
-            pwm_set_duty(PWM_CHANNEL_WARM_WHITE, driver_value);
-            ESP_LOGI(TAG, "⚪ Warm White set to: %d (driver: %lu)", current_rgbw[3], (unsigned long)driver_value);
-            return 0;
+            rc = post_channel(conn_handle, PWM_CHANNEL_WARM_WHITE, value);
+            if (rc == 0) {
+                current_rgbw[3] = value;
+            }
+            return rc;
 
         default:
             assert(0);
@@ -256,18 +542,9 @@ static int rgbw_effect_access(uint16_t conn_handle, uint16_t attr_handle,
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
 
-            // Set the effect
-            light_effects_set_effect((light_effect_t)effect_value);
-
-            // If setting a non-static effect, disable manual mode
-            if (effect_value != EFFECT_STATIC && effect_value != EFFECT_OFF) {
-                light_effects_disable_manual_mode();
-            } else {
-                light_effects_enable_manual_mode();
-            }
-
-            ESP_LOGI(TAG, "✨ Effect set to: %d", effect_value);
-            return 0;
+            // Static and off put the light in manual mode, other effects leave it
+            light_command_t cmd = { .type = LIGHT_CMD_EFFECT, .effect = (light_effect_t)effect_value };
+            return post_command(conn_handle, &cmd);
 
         default:
             assert(0);
@@ -279,11 +556,13 @@ static int rgbw_brightness_access(uint16_t conn_handle, uint16_t attr_handle,
                                   struct ble_gatt_access_ctxt *ctxt, void *arg) {
     int rc;
     uint8_t brightness_value;
+    effect_config_t effect_config;
 
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
             // Convert current brightness from driver resolution to 8-bit for BLE
-            brightness_value = convert_from_driver_resolution(light_effects_get_config()->brightness);
+            light_effects_get_config(&effect_config);
+            brightness_value = convert_from_driver_resolution(effect_config.brightness);
             rc = os_mbuf_append(ctxt->om, &brightness_value, sizeof(uint8_t));
             ESP_LOGI(TAG, "Brightness read: %d", brightness_value);
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
@@ -295,10 +574,11 @@ static int rgbw_brightness_access(uint16_t conn_handle, uint16_t attr_handle,
             }
 
             // Convert 8-bit BLE value to driver resolution
-            uint32_t driver_brightness = convert_to_driver_resolution(brightness_value);
-            light_effects_set_brightness(driver_brightness);
-            ESP_LOGI(TAG, "🔆 Brightness set to: %d (driver: %lu)", brightness_value, (unsigned long)driver_brightness);
-            return 0;
+            light_command_t cmd = {
+                .type = LIGHT_CMD_BRIGHTNESS,
+                .value = convert_to_driver_resolution(brightness_value),
+            };
+            return post_command(conn_handle, &cmd);
 
         default:
             assert(0);
@@ -310,10 +590,12 @@ static int rgbw_speed_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
     int rc;
     uint8_t speed_value;
+    effect_config_t effect_config;
 
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
-            speed_value = light_effects_get_config()->speed;
+            light_effects_get_config(&effect_config);
+            speed_value = effect_config.speed;
             rc = os_mbuf_append(ctxt->om, &speed_value, sizeof(uint8_t));
             ESP_LOGI(TAG, "Speed read: %d", speed_value);
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
@@ -324,8 +606,289 @@ static int rgbw_speed_access(uint16_t conn_handle, uint16_t attr_handle,
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
 
-            light_effects_set_speed(speed_value);
-            ESP_LOGI(TAG, "⚡ Speed set to: %d", speed_value);
+            light_command_t cmd = { .type = LIGHT_CMD_SPEED, .value = speed_value };
+            return post_command(conn_handle, &cmd);
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// Crossfade length in milliseconds, uint16 little-endian
+static int rgbw_transition_access(uint16_t conn_handle, uint16_t attr_handle,
+                                  struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    int rc;
+    uint8_t transition_value[2];
+    uint16_t len = 0;
+    uint32_t transition_ms;
+    effect_config_t effect_config;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            light_effects_get_config(&effect_config);
+            transition_value[0] = effect_config.transition_ms & 0xFF;
+            transition_value[1] = (effect_config.transition_ms >> 8) & 0xFF;
+            rc = os_mbuf_append(ctxt->om, transition_value, sizeof(transition_value));
+            ESP_LOGI(TAG, "Transition read: %lums", (unsigned long)effect_config.transition_ms);
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = ble_hs_mbuf_to_flat(ctxt->om, transition_value, sizeof(transition_value), &len);
+            if (rc != 0 || len != sizeof(transition_value)) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+
+            transition_ms = transition_value[0] | (transition_value[1] << 8);
+            light_command_t cmd = { .type = LIGHT_CMD_TRANSITION, .value = transition_ms };
+            return post_command(conn_handle, &cmd);
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// Overlay layers. Write [index, effect, opacity, blend] to set one layer;
+// read returns [effect, opacity, blend] for every layer, bottom first.
+static int rgbw_layers_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    int rc;
+    uint8_t layer_value[4];
+    uint8_t layers_value[LIGHT_OVERLAY_LAYERS * 3];
+    effect_layer_t layers[LIGHT_OVERLAY_LAYERS];
+    uint16_t len = 0;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            light_effects_get_layers(layers);
+            for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+                layers_value[i * 3] = (uint8_t)layers[i].type;
+                layers_value[i * 3 + 1] = layers[i].opacity;
+                layers_value[i * 3 + 2] = (uint8_t)layers[i].blend;
+            }
+            rc = os_mbuf_append(ctxt->om, layers_value, sizeof(layers_value));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = ble_hs_mbuf_to_flat(ctxt->om, layer_value, sizeof(layer_value), &len);
+            if (rc != 0 || len != sizeof(layer_value)) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+
+            if (layer_value[0] >= LIGHT_OVERLAY_LAYERS || layer_value[1] >= EFFECT_MAX ||
+                layer_value[3] >= LAYER_BLEND_MAX_MODE) {
+                ESP_LOGW(TAG, "Invalid layer write: %d %d %d %d",
+                         layer_value[0], layer_value[1], layer_value[2], layer_value[3]);
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+
+            light_command_t cmd = {
+                .type = LIGHT_CMD_LAYER,
+                .layer = {
+                    .index = layer_value[0],
+                    .layer = {
+                        .type = (light_effect_t)layer_value[1],
+                        .opacity = layer_value[2],
+                        .blend = (layer_blend_t)layer_value[3],
+                    },
+                },
+            };
+            return post_command(conn_handle, &cmd);
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// Timeline upload. Writes carry an opcode (UPLOAD_OP_*); read returns
+// [state, received:u16, length:u16, keyframes:u16] for the app to resume
+// or verify an upload.
+static int rgbw_timeline_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    static uint8_t chunk[512];  // Largest attribute value; host task only
+    int rc;
+    uint16_t len = 0;
+    uint8_t status_value[7];
+    timeline_status_t status;
+    bool ok = false;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            timeline_get_status(&status);
+            status_value[0] = (uint8_t)status.state;
+            status_value[1] = status.received & 0xFF;
+            status_value[2] = status.received >> 8;
+            status_value[3] = status.length & 0xFF;
+            status_value[4] = status.length >> 8;
+            status_value[5] = status.count & 0xFF;
+            status_value[6] = status.count >> 8;
+            rc = os_mbuf_append(ctxt->om, status_value, sizeof(status_value));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = ble_hs_mbuf_to_flat(ctxt->om, chunk, sizeof(chunk), &len);
+            if (rc != 0 || len < 1) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            rc = client_write(conn_handle);
+            if (rc != 0) {
+                return rc;
+            }
+
+            switch (chunk[0]) {
+                case UPLOAD_OP_BEGIN:
+                    ok = (len == 3) && timeline_upload_begin(chunk[1] | (chunk[2] << 8));
+                    break;
+                case UPLOAD_OP_DATA:
+                    ok = (len > 3) && timeline_upload_data(chunk[1] | (chunk[2] << 8), &chunk[3], len - 3);
+                    break;
+                case UPLOAD_OP_COMMIT:
+                    ok = timeline_upload_commit();
+                    if (ok) {
+                        light_command_t cmd = { .type = LIGHT_CMD_EFFECT, .effect = EFFECT_TIMELINE };
+                        return post_command(conn_handle, &cmd);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            return ok ? 0 : BLE_ATT_ERR_UNLIKELY;
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// User effect program upload, same opcodes as the timeline. Read returns
+// [state, received:u16, length:u16, instructions:u16, budget_overruns:u32].
+static int rgbw_program_access(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    static uint8_t chunk[512];  // Largest attribute value; host task only
+    int rc;
+    uint16_t len = 0;
+    uint8_t status_value[11];
+    effect_vm_status_t status;
+    bool ok = false;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            effect_vm_get_status(&status);
+            status_value[0] = (uint8_t)status.state;
+            status_value[1] = status.received & 0xFF;
+            status_value[2] = status.received >> 8;
+            status_value[3] = status.length & 0xFF;
+            status_value[4] = status.length >> 8;
+            status_value[5] = status.instructions & 0xFF;
+            status_value[6] = status.instructions >> 8;
+            for (int i = 0; i < 4; i++) {
+                status_value[7 + i] = (status.budget_overruns >> (8 * i)) & 0xFF;
+            }
+            rc = os_mbuf_append(ctxt->om, status_value, sizeof(status_value));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = ble_hs_mbuf_to_flat(ctxt->om, chunk, sizeof(chunk), &len);
+            if (rc != 0 || len < 1) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            rc = client_write(conn_handle);
+            if (rc != 0) {
+                return rc;
+            }
+
+            switch (chunk[0]) {
+                case UPLOAD_OP_BEGIN:
+                    ok = (len == 3) && effect_vm_upload_begin(chunk[1] | (chunk[2] << 8));
+                    break;
+                case UPLOAD_OP_DATA:
+                    ok = (len > 3) && effect_vm_upload_data(chunk[1] | (chunk[2] << 8), &chunk[3], len - 3);
+                    break;
+                case UPLOAD_OP_COMMIT:
+                    ok = effect_vm_upload_commit();
+                    if (ok) {
+                        light_command_t cmd = { .type = LIGHT_CMD_EFFECT, .effect = EFFECT_USER_PROGRAM };
+                        return post_command(conn_handle, &cmd);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            return ok ? 0 : BLE_ATT_ERR_UNLIKELY;
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+static void put_u16(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Whole light state in one packed write (RGBW_STATE_* in ble_server.h).
+// Meant for write-without-response: one connection event, no intermediate
+// colors, and the per-channel characteristics stay for older apps.
+static int rgbw_state_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    int rc;
+    uint8_t state_value[RGBW_STATE_SIZE];
+    uint16_t len = 0;
+    effect_config_t effect_config;
+    light_command_t cmd = { .type = LIGHT_CMD_STATE };
+    light_state_t *state = &cmd.state;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            light_effects_get_config(&effect_config);
+            state_value[0] = RGBW_STATE_VERSION;
+            state_value[1] = (uint8_t)effect_config.type;
+            put_u16(&state_value[2], effect_config.r);
+            put_u16(&state_value[4], effect_config.g);
+            put_u16(&state_value[6], effect_config.b);
+            put_u16(&state_value[8], effect_config.w);
+            put_u16(&state_value[10], effect_config.brightness);
+            state_value[12] = effect_config.speed;
+            put_u16(&state_value[13], effect_config.transition_ms);
+            rc = os_mbuf_append(ctxt->om, state_value, sizeof(state_value));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = ble_hs_mbuf_to_flat(ctxt->om, state_value, sizeof(state_value), &len);
+            if (rc != 0 || len != RGBW_STATE_SIZE) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            if (state_value[0] != RGBW_STATE_VERSION || state_value[1] >= EFFECT_MAX) {
+                ESP_LOGW(TAG, "Invalid state write: version %d, effect %d", state_value[0], state_value[1]);
+                return BLE_ATT_ERR_UNLIKELY;
+            }
+
+            state->type = (light_effect_t)state_value[1];
+            state->r = get_u16(&state_value[2]);
+            state->g = get_u16(&state_value[4]);
+            state->b = get_u16(&state_value[6]);
+            state->w = get_u16(&state_value[8]);
+            state->brightness = get_u16(&state_value[10]);
+            state->speed = state_value[12];
+            state->transition_ms = get_u16(&state_value[13]);
+
+            rc = post_command(conn_handle, &cmd);
+            if (rc != 0) {
+                return rc;
+            }
+
+            // Keep the per-channel characteristics reading back the same color
+            current_rgbw[0] = convert_from_driver_resolution(state->r > PWM_MAX_DUTY ? PWM_MAX_DUTY : state->r);
+            current_rgbw[1] = convert_from_driver_resolution(state->g > PWM_MAX_DUTY ? PWM_MAX_DUTY : state->g);
+            current_rgbw[2] = convert_from_driver_resolution(state->b > PWM_MAX_DUTY ? PWM_MAX_DUTY : state->b);
+            current_rgbw[3] = convert_from_driver_resolution(state->w > PWM_MAX_DUTY ? PWM_MAX_DUTY : state->w);
             return 0;
 
         default:
@@ -334,8 +897,29 @@ static int rgbw_speed_access(uint16_t conn_handle, uint16_t attr_handle,
     }
 }
 
+// State notifications. The effects task reports a changed state at most
+// once per frame; the report only queues an event for the host task, and a
+// queued event is not queued twice, so a burst of changes collapses into
+// one notification per subscribed connection carrying the latest state.
+// The same event refreshes the state summary scanners see.
+static struct ble_npl_event state_notify_event;
+static void state_notify_send(struct ble_npl_event *ev) {
+    adv_state_update();
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conn_table.handle[i] != BLE_HS_CONN_HANDLE_NONE && conns[i].state_notify) {
+            ble_gatts_chr_updated(state_val_handle);  // Value comes from rgbw_state_access()
+            return;
+        }
+    }
+}
+
+static void state_changed(const light_state_t *state) {
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &state_notify_event);
+}
+
 int ble_gap_event(struct ble_gap_event *event, void *arg) {
     struct ble_gap_conn_desc desc;
+    ble_conn_t *conn;
     int rc;
 
     switch (event->type) {
@@ -351,22 +935,18 @@ int ble_gap_event(struct ble_gap_event *event, void *arg) {
                          desc.peer_id_addr.val[2], desc.peer_id_addr.val[3],
                          desc.peer_id_addr.val[4], desc.peer_id_addr.val[5]);
 
-                // Notify effects system about BLE connection
-                light_effects_set_ble_connected(true);
-            }
-            if (event->connect.status != 0) {
-                /* Connection failed; resume advertising */
-                ble_advertise();
+                conn_added(event->connect.conn_handle, &desc);
             }
+
+            /* Advertising stops on connect; keep it going while slots remain */
+            ble_advertise();
             return 0;
 
         case BLE_GAP_EVENT_DISCONNECT:
             ESP_LOGI(TAG, "🔌 disconnect; reason=%d", event->disconnect.reason);
+            conn_removed(event->disconnect.conn.conn_handle);
 
-            // Notify effects system about BLE disconnection
-            light_effects_set_ble_connected(false);
-
-            /* Connection terminated; resume advertising */
+            /* A slot is free again; resume advertising */
             ble_advertise();
             return 0;
 
@@ -377,6 +957,12 @@ int ble_gap_event(struct ble_gap_event *event, void *arg) {
             assert(rc == 0);
             ESP_LOGI(TAG, "Updated connection params: interval=%d, latency=%d, timeout=%d",
                      desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+            conn = conn_find(event->conn_update.conn_handle);
+            if (conn != NULL) {
+                conn->interval = desc.conn_itvl;
+                conn->latency = desc.conn_latency;
+                conn->timeout = desc.supervision_timeout;
+            }
             return 0;
 
         case BLE_GAP_EVENT_ADV_COMPLETE:
@@ -413,6 +999,12 @@ int ble_gap_event(struct ble_gap_event *event, void *arg) {
                      event->subscribe.cur_notify,
                      event->subscribe.prev_indicate,
                      event->subscribe.cur_indicate);
+            conn = conn_find(event->subscribe.conn_handle);
+            if (conn != NULL && event->subscribe.attr_handle == state_val_handle) {
+                conn->state_notify = event->subscribe.cur_notify;
+                ESP_LOGI(TAG, "🔔 State notifications %s for %d", conn->state_notify ? "on" : "off",
+                         event->subscribe.conn_handle);
+            }
             return 0;
 
         case BLE_GAP_EVENT_MTU:
@@ -420,14 +1012,289 @@ int ble_gap_event(struct ble_gap_event *event, void *arg) {
                      event->mtu.conn_handle,
                      event->mtu.channel_id,
                      event->mtu.value);
+            conn = conn_find(event->mtu.conn_handle);
+            if (conn != NULL) {
+                conn->mtu = event->mtu.value;
+            }
             return 0;
 
+        case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+            ESP_LOGI(TAG, "phy update; status=%d tx=%d rx=%d",
+                     event->phy_updated.status,
+                     event->phy_updated.tx_phy,
+                     event->phy_updated.rx_phy);
+            conn = conn_find(event->phy_updated.conn_handle);
+            if (event->phy_updated.status == 0 && conn != NULL) {
+                conn->tx_phy = event->phy_updated.tx_phy;
+                conn->rx_phy = event->phy_updated.rx_phy;
+            }
+            return 0;
+
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+        case BLE_GAP_EVENT_DATA_LEN_CHG:
+            ESP_LOGI(TAG, "data length changed; tx=%d rx=%d",
+                     event->data_len_chg.max_tx_octets,
+                     event->data_len_chg.max_rx_octets);
+            conn = conn_find(event->data_len_chg.conn_handle);
+            if (conn != NULL) {
+                conn->tx_octets = event->data_len_chg.max_tx_octets;
+            }
+            return 0;
+#endif
+
         default:
             return 0;
     }
 }
 
-void ble_advertise(void) {
+#if defined(CONFIG_LIGHT_GROUP_CONTROL) || defined(CONFIG_LIGHT_SYNC_FOLLOWER)
+#define BLE_OBSERVER 1
+
+// Group commands and sync beacons arrive in other devices' advertising
+// packets, so the scan runs alongside advertising and connections.
+// Passive, a 30% duty window, and no controller duplicate filter: a
+// broadcaster reuses its address for every packet, and the filter would
+// hide all but the first.
+#define OBSERVER_SCAN_INTERVAL  160     // 100 ms in 0.625 ms units
+#define OBSERVER_SCAN_WINDOW    48      // 30 ms
+#endif
+
+#ifdef CONFIG_LIGHT_GROUP_CONTROL
+static group_ctx_t group_ctx;
+static bool group_listening = false;
+
+// The last sequence survives reboots, otherwise a packet recorded before a
+// power cycle would play again afterwards. It lives in group_ctx; the
+// state store task writes it out in the background.
+static void group_seq_load(void) {
+    uint32_t seq;
+
+    if (state_store_load_group_seq(&seq)) {
+        group_ctx.have_seq = true;
+        group_ctx.last_seq = seq;
+        ESP_LOGI(TAG, "Group commands resume after sequence %lu", (unsigned long)seq);
+    }
+}
+
+static void group_apply(const group_packet_t *pkt) {
+    light_command_t cmd = { .type = LIGHT_CMD_STATE };
+
+    if (pkt->effect >= EFFECT_MAX) {
+        ESP_LOGW(TAG, "Group command with invalid effect %d", pkt->effect);
+        return;
+    }
+    cmd.state.type = (light_effect_t)pkt->effect;
+    cmd.state.r = convert_to_driver_resolution(pkt->r);
+    cmd.state.g = convert_to_driver_resolution(pkt->g);
+    cmd.state.b = convert_to_driver_resolution(pkt->b);
+    cmd.state.w = convert_to_driver_resolution(pkt->w);
+    cmd.state.brightness = convert_to_driver_resolution(pkt->brightness);
+    cmd.state.speed = pkt->speed;
+    cmd.state.transition_ms = pkt->transition * 100;
+
+    if (!light_effects_post(&cmd)) {
+        return;
+    }
+    current_rgbw[0] = pkt->r;
+    current_rgbw[1] = pkt->g;
+    current_rgbw[2] = pkt->b;
+    current_rgbw[3] = pkt->w;
+    ESP_LOGI(TAG, "📢 Group %u command %lu: effect %d", pkt->group, (unsigned long)pkt->seq, pkt->effect);
+}
+
+static void group_advert(const struct ble_gap_disc_desc *disc) {
+    group_packet_t pkt;
+
+    if (!group_listening || !group_packet_find(disc->data, disc->length_data, &pkt)) {
+        return;
+    }
+    switch (group_control_check(&group_ctx, &pkt)) {
+        case GROUP_APPLY:
+            // Only sequences we applied go to flash: another group's packet
+            // replayed after a reboot does nothing here anyway
+            group_apply(&pkt);
+            state_store_save_group_seq(pkt.seq);
+            break;
+        case GROUP_REPLAY:
+            ESP_LOGW(TAG, "Group command %lu replayed (last %lu)",
+                     (unsigned long)pkt.seq, (unsigned long)group_ctx.last_seq);
+            break;
+        case GROUP_BAD_MAC:
+            ESP_LOGW(TAG, "Group command with bad signature");
+            break;
+        default:
+            break;
+    }
+}
+
+static void group_control_init(void) {
+    if (!group_key_parse(CONFIG_LIGHT_GROUP_KEY, group_ctx.key)) {
+        ESP_LOGW(TAG, "Group control enabled without a valid 64-digit hex key; not listening");
+        return;
+    }
+    group_ctx.group = CONFIG_LIGHT_GROUP_ID;
+    group_seq_load();
+    group_listening = true;
+    ESP_LOGI(TAG, "📢 Listening for group %u commands", group_ctx.group);
+}
+#endif
+
+#ifdef CONFIG_LIGHT_SYNC_FOLLOWER
+// Follow the first master heard, and move on to another one only after
+// the current one has gone quiet
+#define SYNC_MASTER_TIMEOUT_US  30000000
+
+static clock_sync_t sync_clock;
+static ble_addr_t sync_master;
+static bool sync_have_master = false;
+static int64_t sync_last_beacon_us = 0;
+
+static void sync_advert(const struct ble_gap_disc_desc *disc) {
+    int64_t now = esp_timer_get_time();
+    uint32_t master_us;
+
+    if (!clock_sync_beacon_find(disc->data, disc->length_data, &master_us)) {
+        return;
+    }
+    if (!sync_have_master || now - sync_last_beacon_us > SYNC_MASTER_TIMEOUT_US) {
+        sync_master = disc->addr;
+        sync_have_master = true;
+        clock_sync_reset(&sync_clock);
+        ESP_LOGI(TAG, "🕒 Following sync master %02x:%02x:%02x:%02x:%02x:%02x",
+                 sync_master.val[5], sync_master.val[4], sync_master.val[3],
+                 sync_master.val[2], sync_master.val[1], sync_master.val[0]);
+    } else if (memcmp(&disc->addr, &sync_master, sizeof(sync_master)) != 0) {
+        return;
+    }
+    sync_last_beacon_us = now;
+
+    bool was_locked = sync_clock.model.locked;
+    if (clock_sync_sample(&sync_clock, master_us, now)) {
+        light_effects_set_shared_clock(&sync_clock.model);
+        if (!was_locked) {
+            ESP_LOGI(TAG, "🕒 Effect clock locked, offset %lld us",
+                     (long long)sync_clock.model.offset_us);
+        }
+    }
+}
+#endif
+
+#ifdef BLE_OBSERVER
+static void observer_scan(void);
+
+static int observer_event(struct ble_gap_event *event, void *arg) {
+    switch (event->type) {
+        case BLE_GAP_EVENT_DISC:
+#ifdef CONFIG_LIGHT_GROUP_CONTROL
+            group_advert(&event->disc);
+#endif
+#ifdef CONFIG_LIGHT_SYNC_FOLLOWER
+            sync_advert(&event->disc);
+#endif
+            return 0;
+
+        case BLE_GAP_EVENT_DISC_COMPLETE:
+            // The host stops the scan around some procedures; pick it up again
+            observer_scan();
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+static void observer_scan(void) {
+    struct ble_gap_disc_params disc_params;
+    int rc;
+
+    memset(&disc_params, 0, sizeof disc_params);
+    disc_params.itvl = OBSERVER_SCAN_INTERVAL;
+    disc_params.window = OBSERVER_SCAN_WINDOW;
+    disc_params.passive = 1;
+    disc_params.filter_duplicates = 0;
+
+    rc = ble_gap_disc(own_addr_type, BLE_HS_FOREVER, &disc_params, observer_event, NULL);
+    if (rc != 0 && rc != BLE_HS_EALREADY) {
+        ESP_LOGE(TAG, "error starting scan; rc=%d", rc);
+    }
+}
+#endif
+
+#ifdef CONFIG_LIGHT_SYNC_MASTER
+// The master's clock goes out in its advertising data. Advertising is
+// restarted with a fresh timestamp for each beacon, so the first copy
+// leaves within the advertising delay of being stamped; the random period
+// keeps beacons from lining up with a follower's scan window for long.
+#define SYNC_BEACON_PERIOD_US   80000
+#define SYNC_BEACON_SPREAD_US   40000
+
+static struct ble_npl_event sync_beacon_event;
+static esp_timer_handle_t sync_beacon_timer;
+
+static int adv_start(void);
+
+static void sync_beacon_tick(void *arg) {
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &sync_beacon_event);
+}
+
+static void sync_beacon_send(struct ble_npl_event *ev) {
+    // Nothing to refresh while every slot is taken
+    if (ble_gap_adv_active()) {
+        ble_gap_adv_stop();
+        adv_start();
+    }
+    esp_timer_start_once(sync_beacon_timer, SYNC_BEACON_PERIOD_US + esp_random() % SYNC_BEACON_SPREAD_US);
+}
+#endif
+
+// State summary for scanners (RGBW_ADV_STATE_* in ble_server.h). The
+// advertising packet itself is full, so it goes in the scan response;
+// active scanners get it without connecting. The controller takes new
+// scan response data while advertising, so a change needs no restart, and
+// an unchanged summary is not sent again.
+static uint8_t adv_state_sent[2 + RGBW_ADV_STATE_SIZE];
+static bool adv_state_sent_valid = false;  // Cleared when the controller resets
+
+static void adv_state_update(void) {
+    uint8_t mfg_data[2 + RGBW_ADV_STATE_SIZE];
+    struct ble_hs_adv_fields fields;
+    effect_config_t effect_config;
+    int rc;
+
+    light_effects_get_config(&effect_config);
+    mfg_data[0] = 0xFF;  // Company ID, as in the advertising data
+    mfg_data[1] = 0xFF;
+    mfg_data[2] = RGBW_ADV_STATE_MAGIC;
+    mfg_data[3] = RGBW_ADV_STATE_VERSION;
+    mfg_data[4] = RGBW_FIRMWARE_MAJOR;
+    mfg_data[5] = RGBW_FIRMWARE_MINOR;
+    mfg_data[6] = (uint8_t)effect_config.type;
+    mfg_data[7] = convert_from_driver_resolution(effect_config.brightness);
+    mfg_data[8] = convert_from_driver_resolution(effect_config.r);
+    mfg_data[9] = convert_from_driver_resolution(effect_config.g);
+    mfg_data[10] = convert_from_driver_resolution(effect_config.b);
+    mfg_data[11] = convert_from_driver_resolution(effect_config.w);
+    mfg_data[12] = effect_config.speed;
+    mfg_data[13] = (uint8_t)(MAX_CONNECTIONS - conn_table.count);
+
+    if (adv_state_sent_valid && memcmp(adv_state_sent, mfg_data, sizeof(mfg_data)) == 0) {
+        return;
+    }
+
+    memset(&fields, 0, sizeof fields);
+    fields.mfg_data = mfg_data;
+    fields.mfg_data_len = sizeof(mfg_data);
+    rc = ble_gap_adv_rsp_set_fields(&fields);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "error setting scan response data; rc=%d", rc);
+        return;
+    }
+    memcpy(adv_state_sent, mfg_data, sizeof(mfg_data));
+    adv_state_sent_valid = true;
+}
+
+/* Set the advertising data and start advertising */
+static int adv_start(void) {
     struct ble_gap_adv_params adv_params;
     struct ble_hs_adv_fields fields;
     const char *name;
@@ -459,7 +1326,11 @@ void ble_advertise(void) {
     fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
 
     /* Add manufacturer specific data with chip type information */
+#ifdef CONFIG_LIGHT_SYNC_MASTER
+    uint8_t mfg_data[3 + CLOCK_SYNC_BEACON_SIZE];
+#else
     uint8_t mfg_data[3];
+#endif
     mfg_data[0] = 0xFF;  // Company ID (using 0xFF for custom/test)
     mfg_data[1] = 0xFF;  // Company ID continued
 #ifdef CONFIG_BOARD_ESP32C3_OLED
@@ -469,6 +1340,9 @@ void ble_advertise(void) {
 #else
     mfg_data[2] = 0x00;  // Unknown
 #endif
+#ifdef CONFIG_LIGHT_SYNC_MASTER
+    clock_sync_beacon_encode(&mfg_data[3], (uint32_t)esp_timer_get_time());  // Effect clock
+#endif
 
     fields.mfg_data = mfg_data;
     fields.mfg_data_len = sizeof(mfg_data);
@@ -476,14 +1350,29 @@ void ble_advertise(void) {
     rc = ble_gap_adv_set_fields(&fields);
     if (rc != 0) {
         ESP_LOGE(TAG, "error setting advertisement data; rc=%d", rc);
-        return;
+        return rc;
     }
+    adv_state_update();
 
     /* Begin advertising */
     rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER,
                            &adv_params, ble_gap_event, NULL);
     if (rc != 0) {
         ESP_LOGE(TAG, "error enabling advertisement; rc=%d", rc);
+    }
+    return rc;
+}
+
+void ble_advertise(void) {
+    /* A connect or disconnect changed the free slots in the summary */
+    adv_state_update();
+
+    /* Nothing to offer with every slot taken, or already advertising */
+    if (!conn_table_should_advertise(&conn_table, ble_gap_adv_active())) {
+        return;
+    }
+
+    if (adv_start() != 0) {
         return;
     }
 
@@ -500,6 +1389,7 @@ void ble_advertise(void) {
 
 void ble_on_reset(int reason) {
     ESP_LOGE(TAG, "resetting state; reason=%d", reason);
+    adv_state_sent_valid = false;  // The controller forgot the scan response
 }
 
 void ble_on_sync(void) {
@@ -527,6 +1417,17 @@ void ble_on_sync(void) {
     /* Begin advertising */
     ESP_LOGI(TAG, "BLE sync completed");
     ble_advertise();
+
+#ifdef CONFIG_LIGHT_GROUP_CONTROL
+    group_control_init();
+#endif
+#ifdef BLE_OBSERVER
+    observer_scan();
+#endif
+#ifdef CONFIG_LIGHT_SYNC_MASTER
+    esp_timer_stop(sync_beacon_timer);
+    esp_timer_start_once(sync_beacon_timer, SYNC_BEACON_PERIOD_US);
+#endif
 }
 
 void ble_host_task(void *param) {
@@ -548,6 +1449,24 @@ void ble_server_init(void) {
     rc = ble_svc_gap_device_name_set(DEVICE_NAME);
     assert(rc == 0);
 
+    /* Larger ATT MTU, offered in every exchange */
+    rc = ble_att_set_preferred_mtu(LINK_PREFERRED_MTU);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "error setting preferred MTU; rc=%d", rc);
+    }
+
+    /* Connection slots, each with its own link idle timer */
+    conn_table_init(&conn_table, MAX_CONNECTIONS, CONFIG_BLE_CONTROL_HOLD_MS);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        const esp_timer_create_args_t idle_timer_args = {
+            .callback = link_idle_tick,
+            .arg = &conns[i],
+            .name = "ble_link_idle",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&idle_timer_args, &conns[i].idle_timer));
+        ble_npl_event_init(&conns[i].idle_event, link_idle_check, &conns[i]);
+    }
+
     /* Initialize GATT services */
     rc = ble_gatts_count_cfg(gatt_svc_def);
     if (rc != 0) {
@@ -561,6 +1480,21 @@ void ble_server_init(void) {
         return;
     }
 
+#ifdef CONFIG_LIGHT_SYNC_MASTER
+    /* Effects run on this fixture's own clock, which the beacons share */
+    const esp_timer_create_args_t beacon_timer_args = {
+        .callback = sync_beacon_tick,
+        .name = "sync_beacon",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&beacon_timer_args, &sync_beacon_timer));
+    ble_npl_event_init(&sync_beacon_event, sync_beacon_send, NULL);
+    light_effects_set_shared_clock(&(clock_sync_model_t){ .locked = true });
+#endif
+
+    /* Push state changes to subscribed clients */
+    ble_npl_event_init(&state_notify_event, state_notify_send, NULL);
+    light_effects_add_state_listener(state_changed);
+
     /* Initialize and start the BLE host task */
     nimble_port_freertos_init(ble_host_task);
 
@@ -593,4 +1527,196 @@ static int rgbw_chip_info_access(uint16_t conn_handle, uint16_t attr_handle,
             assert(0);
             return BLE_ATT_ERR_UNLIKELY;
     }
-}
\ No newline at end of file
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    put_u16(p, value & 0xFFFF);
+    put_u16(p + 2, value >> 16);
+}
+
+// Negotiated link parameters and what they cost in write-to-light latency
+// (RGBW_DIAG_* in ble_server.h)
+static int rgbw_diagnostics_access(uint16_t conn_handle, uint16_t attr_handle,
+                                   struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    int rc;
+    uint8_t diag[RGBW_DIAG_SIZE];
+    light_latency_stats_t latency;
+    light_command_stats_t commands;
+    state_store_stats_t store = {0};
+    const ble_conn_t *conn = conn_find(conn_handle);
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            if (conn == NULL) {
+                return BLE_ATT_ERR_UNLIKELY;
+            }
+            light_effects_get_latency_stats(&latency);
+            light_effects_get_command_stats(&commands);
+            diag[0] = RGBW_DIAG_VERSION;
+            diag[1] = (uint8_t)conn->profile;
+            put_u16(&diag[2], conn->interval);
+            put_u16(&diag[4], conn->latency);
+            put_u16(&diag[6], conn->timeout);
+            put_u16(&diag[8], conn->mtu);
+            diag[10] = conn->tx_phy;
+            diag[11] = conn->rx_phy;
+            put_u16(&diag[12], conn->tx_octets);
+            put_u32(&diag[14], latency.samples);
+            put_u32(&diag[18], latency.last_us);
+            put_u32(&diag[22], latency.avg_us);
+            put_u32(&diag[26], latency.max_us);
+            put_u32(&diag[30], commands.received);
+            put_u32(&diag[34], commands.coalesced);
+            put_u32(&diag[38], commands.dropped);
+#ifdef CONFIG_LIGHT_STATE_PERSIST
+            state_store_get_stats(&store);
+#endif
+            put_u32(&diag[42], store.writes);
+            put_u16(&diag[46], store.writes_last_hour > UINT16_MAX ? UINT16_MAX : store.writes_last_hour);
+            rc = os_mbuf_append(ctxt->om, diag, sizeof(diag));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            // Read-only characteristic
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// Streamed frames go straight into the jitter buffer; only the first batch
+// of a stream goes through the command queue, to select the stream effect.
+// Every batch is answered with a notification of the buffer state so the
+// app can pace itself.
+static int rgbw_stream_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    static uint8_t chunk[512];  // Largest attribute value; host task only
+    static light_stream_frame_t frames[(sizeof(chunk) - 1) / STREAM_FRAME_SIZE];
+    int rc;
+    uint16_t len = 0;
+    uint8_t status_value[STREAM_STATUS_SIZE];
+    light_stream_stats_t stats;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            light_effects_get_stream_stats(&stats);
+            status_value[0] = stats.buffered;
+            put_u16(&status_value[1], stats.latency_ms);
+            put_u32(&status_value[3], stats.received);
+            put_u32(&status_value[7], stats.late);
+            put_u32(&status_value[11], stats.dropped);
+            put_u32(&status_value[15], stats.underruns);
+            rc = os_mbuf_append(ctxt->om, status_value, sizeof(status_value));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = ble_hs_mbuf_to_flat(ctxt->om, chunk, sizeof(chunk), &len);
+            if (rc != 0 || len < 1) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            rc = client_write(conn_handle);
+            if (rc != 0) {
+                return rc;
+            }
+
+            switch (chunk[0]) {
+                case STREAM_OP_FRAMES: {
+                    uint32_t count = (len - 1) / STREAM_FRAME_SIZE;
+                    if (count == 0 || (len - 1) % STREAM_FRAME_SIZE != 0) {
+                        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                    }
+                    for (uint32_t i = 0; i < count; i++) {
+                        const uint8_t *p = &chunk[1 + i * STREAM_FRAME_SIZE];
+                        frames[i].ts_ms = get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+                        frames[i].r = get_u16(p + 4) > PWM_MAX_DUTY ? PWM_MAX_DUTY : get_u16(p + 4);
+                        frames[i].g = get_u16(p + 6) > PWM_MAX_DUTY ? PWM_MAX_DUTY : get_u16(p + 6);
+                        frames[i].b = get_u16(p + 8) > PWM_MAX_DUTY ? PWM_MAX_DUTY : get_u16(p + 8);
+                        frames[i].w = get_u16(p + 10) > PWM_MAX_DUTY ? PWM_MAX_DUTY : get_u16(p + 10);
+                    }
+                    light_effects_stream_push(frames, count);
+                    ble_gatts_chr_updated(stream_val_handle);
+
+                    if (light_effects_get_current_effect() != EFFECT_STREAM) {
+                        light_command_t cmd = { .type = LIGHT_CMD_EFFECT, .effect = EFFECT_STREAM };
+                        return post_command(conn_handle, &cmd);
+                    }
+                    return 0;
+                }
+                case STREAM_OP_LATENCY:
+                    if (len != 3) {
+                        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                    }
+                    light_effects_stream_set_latency(get_u16(&chunk[1]));
+                    return 0;
+                default:
+                    return BLE_ATT_ERR_UNLIKELY;
+            }
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// Tempo and beats for beat-locked effects. The arrival time is taken here,
+// before the command waits in the queue, so queueing does not move the beat.
+static int rgbw_tempo_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    uint8_t value[5];
+    uint16_t len = 0;
+    uint8_t status_value[TEMPO_STATUS_SIZE];
+    light_tempo_stats_t stats;
+    light_command_t cmd = { .type = LIGHT_CMD_TEMPO };
+    int rc;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            light_effects_get_tempo_stats(&stats);
+            put_u16(&status_value[0], stats.bpm_x100);
+            put_u32(&status_value[2], stats.beats);
+            put_u16(&status_value[6], (uint16_t)(int16_t)(stats.last_error_us / 1000));
+            put_u16(&status_value[8], (uint16_t)(int16_t)stats.lead_ms);
+            rc = os_mbuf_append(ctxt->om, status_value, sizeof(status_value));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            cmd.tempo.arrival_us = esp_timer_get_time();
+            rc = ble_hs_mbuf_to_flat(ctxt->om, value, sizeof(value), &len);
+            if (rc != 0 || len < 1) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+
+            switch (value[0]) {
+                case TEMPO_OP_BPM:
+                    if (len != 3) {
+                        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                    }
+                    cmd.tempo.op = LIGHT_TEMPO_BPM;
+                    cmd.tempo.value = get_u16(&value[1]);
+                    break;
+                case TEMPO_OP_BEAT:
+                    if (len != 5) {
+                        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                    }
+                    cmd.tempo.op = LIGHT_TEMPO_BEAT;
+                    cmd.tempo.value = get_u16(&value[1]) | ((uint32_t)get_u16(&value[3]) << 16);
+                    break;
+                case TEMPO_OP_LEAD:
+                    if (len != 3) {
+                        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                    }
+                    cmd.tempo.op = LIGHT_TEMPO_LEAD;
+                    cmd.tempo.value = (uint32_t)(int32_t)(int16_t)get_u16(&value[1]);
+                    break;
+                default:
+                    return BLE_ATT_ERR_UNLIKELY;
+            }
+            return post_command(conn_handle, &cmd);
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
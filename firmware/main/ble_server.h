@@ -16,6 +16,74 @@
 #define RGBW_CHAR_UUID_BRIGHTNESS   0xFF06
 #define RGBW_CHAR_UUID_SPEED        0xFF07
 #define RGBW_CHAR_UUID_CHIP_INFO    0xFF08
+#define RGBW_CHAR_UUID_TRANSITION   0xFF09
+#define RGBW_CHAR_UUID_LAYERS       0xFF0A
+#define RGBW_CHAR_UUID_TIMELINE     0xFF0B
+#define RGBW_CHAR_UUID_PROGRAM      0xFF0C
+#define RGBW_CHAR_UUID_STATE        0xFF0D
+#define RGBW_CHAR_UUID_DIAGNOSTICS  0xFF0E
+#define RGBW_CHAR_UUID_STREAM       0xFF0F
+#define RGBW_CHAR_UUID_TEMPO        0xFF10
+
+// Packed state, little-endian, RGBW and brightness at driver resolution:
+//   version effect r:u16 g:u16 b:u16 w:u16 brightness:u16 speed transition_ms:u16
+#define RGBW_STATE_VERSION          1
+#define RGBW_STATE_SIZE             15
+
+// State summary in the scan response, manufacturer data after company ID
+// 0xFFFF, 8-bit values like the per-channel characteristics:
+//   'L' version fw_major fw_minor effect brightness r g b w speed slots_free
+// slots_free is how many more centrals can connect
+#define RGBW_ADV_STATE_MAGIC        'L'
+#define RGBW_ADV_STATE_VERSION      1
+#define RGBW_ADV_STATE_SIZE         12
+#define RGBW_FIRMWARE_MAJOR         2
+#define RGBW_FIRMWARE_MINOR         0
+
+// Link diagnostics of the reading connection, read-only, little-endian:
+//   version profile interval:u16 latency:u16 timeout:u16 mtu:u16 tx_phy rx_phy
+//   tx_octets:u16 samples:u32 last_us:u32 avg_us:u32 max_us:u32
+//   received:u32 coalesced:u32 dropped:u32 state_writes:u32
+//   state_writes_hour:u16
+// interval in 1.25 ms units, timeout in 10 ms units, latency_* measured
+// from a write being queued to the LEDs showing it, state_writes* the
+// state store's flash writes since boot and in the last hour
+#define RGBW_DIAG_VERSION           2
+#define RGBW_DIAG_SIZE              48
+
+// ATT application error for a write refused because another client holds
+// control (CONFIG_BLE_CONTROL_HOLD_MS)
+#define RGBW_ATT_ERR_CONTROL_HELD   0x80
+
+// Link profiles the peripheral asks the central for
+typedef enum {
+    BLE_LINK_PROFILE_NONE = 0,      // Not connected, or still on the central's choice
+    BLE_LINK_PROFILE_FAST,          // Short interval, no slave latency
+    BLE_LINK_PROFILE_IDLE,          // Long interval with slave latency
+} ble_link_profile_t;
+
+// Frame streaming, first byte of a write to the stream characteristic.
+// Frames are ts_ms:u32 r:u16 g:u16 b:u16 w:u16 (driver resolution), oldest
+// first. Reads and notifications return
+//   buffered latency_ms:u16 received:u32 late:u32 dropped:u32 underruns:u32
+#define STREAM_OP_FRAMES            0x01  // [op, frame...] - selects the stream effect
+#define STREAM_OP_LATENCY           0x02  // [op, latency_ms:u16]
+#define STREAM_FRAME_SIZE           12
+#define STREAM_STATUS_SIZE          19
+
+// Tempo, first byte of a write to the tempo characteristic. Beat times are
+// on the sender's clock, like stream frames. Reads return
+//   bpm_x100:u16 beats:u32 last_error_ms:i16 lead_ms:i16
+#define TEMPO_OP_BPM                0x01  // [op, bpm_x100:u16] - 0 stops the beat grid
+#define TEMPO_OP_BEAT               0x02  // [op, ts_ms:u32]
+#define TEMPO_OP_LEAD               0x03  // [op, lead_ms:i16]
+#define TEMPO_STATUS_SIZE           10
+
+// Upload opcodes, first byte of a write to the timeline and program
+// characteristics
+#define UPLOAD_OP_BEGIN             0x01  // [op, length:u16]
+#define UPLOAD_OP_DATA              0x02  // [op, offset:u16, bytes...]
+#define UPLOAD_OP_COMMIT            0x03  // [op] - validate and start playing
 
 // Device name from Kconfig
 #define DEVICE_NAME CONFIG_DEVICE_NAME
@@ -0,0 +1,179 @@
+#include "clock_sync.h"
+#include <string.h>
+
+void clock_sync_reset(clock_sync_t *sync) {
+    uint32_t resets = sync->resets;
+
+    memset(sync, 0, sizeof(*sync));
+    sync->resets = resets;
+}
+
+int64_t clock_sync_to_master(const clock_sync_model_t *model, int64_t local_us) {
+    if (!model->locked) {
+        return local_us;
+    }
+    int64_t since_ref = local_us - model->local_ref_us;
+    return local_us + model->offset_us + since_ref * model->drift_ppb / 1000000000;
+}
+
+int64_t clock_sync_effect_time(clock_sync_effect_t *effect, const clock_sync_model_t *model,
+                               int64_t local_us) {
+    uint32_t master_us = (uint32_t)clock_sync_to_master(model, local_us);
+    int32_t step_us = (int32_t)(master_us - effect->last_us);
+
+    if (!effect->running || step_us <= -CLOCK_SYNC_RESET_US) {
+        effect->running = true;
+        effect->effect_us = master_us;
+    } else if (step_us < 0) {
+        return effect->effect_us;  // Hold until the master time catches up
+    } else {
+        effect->effect_us += step_us;
+    }
+    effect->last_us = master_us;
+    return effect->effect_us;
+}
+
+// (b - a) x (c - a): positive if a, b, c turn left
+static int64_t cross(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t cx, int64_t cy) {
+    return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+// Fit a line that no block point lies above, as low as possible at the
+// points' mean time. Delivery delay only ever lowers a point, so this is
+// the line through the fastest deliveries, and late blocks simply sit
+// under it. The optimum is the edge of the upper convex hull spanning the
+// mean. The points are in time order, so one monotone chain pass builds
+// the hull. All integer: times are relative to the oldest point, so the
+// products stay far inside 64 bits for any span the ring can hold, and
+// the C3 has no FPU to spend on it.
+static void model_fit(clock_sync_t *sync) {
+    uint32_t n = sync->count;
+    uint32_t first = (sync->next + CLOCK_SYNC_BLOCKS - n) % CLOCK_SYNC_BLOCKS;
+    const clock_sync_point_t *base = &sync->points[first];
+    int64_t x[CLOCK_SYNC_BLOCKS], y[CLOCK_SYNC_BLOCKS];
+    uint32_t hull[CLOCK_SYNC_BLOCKS];
+    uint32_t h = 0;
+    int64_t sum_x = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const clock_sync_point_t *p = &sync->points[(first + i) % CLOCK_SYNC_BLOCKS];
+        x[i] = p->local_us - base->local_us;
+        y[i] = p->offset_us - base->offset_us;
+        sum_x += x[i];
+    }
+    int64_t mean_x = sum_x / n;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (h > 0 && x[i] == x[hull[h - 1]]) {
+            if (y[i] <= y[hull[h - 1]]) {
+                continue;
+            }
+            h--;
+        }
+        while (h >= 2 && cross(x[hull[h - 2]], y[hull[h - 2]], x[hull[h - 1]], y[hull[h - 1]],
+                               x[i], y[i]) >= 0) {
+            h--;
+        }
+        hull[h++] = i;
+    }
+
+    // One point, or all at one time: flat through the highest
+    int64_t drift_ppb = 0, at_mean = y[hull[0]];
+    for (uint32_t k = 0; k + 1 < h; k++) {
+        uint32_t i = hull[k], j = hull[k + 1];
+        if (x[i] <= mean_x && x[j] > mean_x) {
+            int64_t dx = x[j] - x[i], dy = y[j] - y[i];
+            drift_ppb = dy * 1000000000 / dx;
+            at_mean = y[i] + dy * (mean_x - x[i]) / dx;
+            break;
+        }
+    }
+    if (drift_ppb > CLOCK_SYNC_MAX_DRIFT_PPB) {
+        drift_ppb = CLOCK_SYNC_MAX_DRIFT_PPB;
+    } else if (drift_ppb < -CLOCK_SYNC_MAX_DRIFT_PPB) {
+        drift_ppb = -CLOCK_SYNC_MAX_DRIFT_PPB;
+    }
+
+    sync->model.locked = true;
+    sync->model.local_ref_us = base->local_us + mean_x;
+    sync->model.offset_us = base->offset_us + at_mean;
+    sync->model.drift_ppb = (int32_t)drift_ppb;
+}
+
+static void block_close(clock_sync_t *sync) {
+    sync->points[sync->next] = sync->block_best;
+    sync->next = (sync->next + 1) % CLOCK_SYNC_BLOCKS;
+    if (sync->count < CLOCK_SYNC_BLOCKS) {
+        sync->count++;
+    }
+    sync->block_open = false;
+    model_fit(sync);
+}
+
+bool clock_sync_sample(clock_sync_t *sync, uint32_t master_us, int64_t local_us) {
+    bool changed = false;
+
+    // Extend the 32-bit timestamp against the previous one
+    int64_t remote_us = sync->have_remote
+        ? sync->last_remote_us + (int32_t)(master_us - (uint32_t)sync->last_remote_us)
+        : master_us;
+    int64_t offset_us = remote_us - local_us;
+
+    // A master that rebooted, or a different master: start over
+    if (sync->model.locked) {
+        int64_t error_us = offset_us - (clock_sync_to_master(&sync->model, local_us) - local_us);
+        if (error_us > CLOCK_SYNC_RESET_US || error_us < -CLOCK_SYNC_RESET_US) {
+            clock_sync_reset(sync);
+            sync->resets++;
+            remote_us = master_us;
+            offset_us = remote_us - local_us;
+            changed = true;
+        }
+    }
+    sync->have_remote = true;
+    sync->last_remote_us = remote_us;
+    sync->samples++;
+
+    if (sync->block_open && local_us - sync->block_start_us >= CLOCK_SYNC_BLOCK_US) {
+        block_close(sync);
+        changed = true;
+    }
+    if (!sync->block_open) {
+        sync->block_open = true;
+        sync->block_start_us = local_us;
+        sync->block_best = (clock_sync_point_t){ .local_us = local_us, .offset_us = offset_us };
+    } else if (offset_us > sync->block_best.offset_us) {
+        // Largest master - local is the beacon that waited least
+        sync->block_best = (clock_sync_point_t){ .local_us = local_us, .offset_us = offset_us };
+    }
+    return changed;
+}
+
+void clock_sync_beacon_encode(uint8_t out[CLOCK_SYNC_BEACON_SIZE], uint32_t master_us) {
+    out[0] = CLOCK_SYNC_MAGIC;
+    for (int i = 0; i < 4; i++) {
+        out[1 + i] = (uint8_t)(master_us >> (8 * i));
+    }
+}
+
+bool clock_sync_beacon_find(const uint8_t *adv, uint8_t len, uint32_t *master_us) {
+    uint8_t pos = 0;
+
+    // Manufacturer data: company ID 0xFFFF, chip type, then the beacon
+    while (pos < len) {
+        uint8_t field_len = adv[pos];
+        if (field_len == 0 || field_len > len - pos - 1) {
+            return false;
+        }
+        const uint8_t *field = adv + pos + 1;
+        if (field[0] == 0xFF && field_len - 1 >= 3 + CLOCK_SYNC_BEACON_SIZE &&
+            field[1] == 0xFF && field[2] == 0xFF && field[4] == CLOCK_SYNC_MAGIC) {
+            const uint8_t *p = field + 5;
+            *master_us = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+                         ((uint32_t)p[3] << 24);
+            return true;
+        }
+        pos += field_len + 1;
+    }
+    return false;
+}
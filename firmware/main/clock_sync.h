@@ -0,0 +1,100 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Shared effect clock. One fixture, the sync master, puts its esp_timer
+// time in its advertising data; the others estimate offset and drift
+// against it and render periodic effects on the master's clock, so a
+// group of fixtures stays in phase.
+//
+// A beacon is late by however long it waited for its advertising event,
+// never early. Each block of samples is reduced to the one that arrived
+// fastest, and the line along the top of the last CLOCK_SYNC_BLOCKS of
+// those gives offset and drift. The constant part of the delivery delay
+// remains; it is about the same on every follower, so they agree with each
+// other more closely than with the master.
+//
+// Beacon, in the manufacturer data after the company ID and chip type:
+//   'S'  master_us:u32 (little-endian, wraps every 71 minutes)
+//
+// This module is pure: samples come in with both timestamps, the mapping
+// goes out. The BLE server does the radio work.
+
+#define CLOCK_SYNC_MAGIC        'S'
+#define CLOCK_SYNC_BEACON_SIZE  5         // Magic and timestamp
+#define CLOCK_SYNC_BLOCK_US     4000000   // One fastest sample per block
+#define CLOCK_SYNC_BLOCKS       16        // Fit over the last 64 s
+#define CLOCK_SYNC_MAX_DRIFT_PPB 200000   // Anything faster is noise, not a crystal
+#define CLOCK_SYNC_RESET_US     500000    // A jump this large means a new master clock
+
+// Local to master time: master = local + offset_us + (local - local_ref_us) * drift
+typedef struct {
+    bool locked;
+    int64_t local_ref_us;
+    int64_t offset_us;
+    int32_t drift_ppb;
+} clock_sync_model_t;
+
+typedef struct {
+    int64_t local_us;
+    int64_t offset_us;                    // master - local, fastest in the block
+} clock_sync_point_t;
+
+typedef struct {
+    clock_sync_point_t points[CLOCK_SYNC_BLOCKS];
+    uint32_t count;                       // Points in the ring
+    uint32_t next;                        // Ring write index
+
+    bool block_open;
+    int64_t block_start_us;
+    clock_sync_point_t block_best;
+
+    bool have_remote;
+    int64_t last_remote_us;               // Master clock, unwrapped
+    uint32_t resets;
+    uint32_t samples;
+
+    clock_sync_model_t model;
+} clock_sync_t;
+
+void clock_sync_reset(clock_sync_t *sync);
+
+// Add a beacon: master time as sent, local time when it arrived. Returns
+// true if the model changed.
+bool clock_sync_sample(clock_sync_t *sync, uint32_t master_us, int64_t local_us);
+
+// Master time for a local time; local time itself until locked
+int64_t clock_sync_to_master(const clock_sync_model_t *model, int64_t local_us);
+
+// Shared effect time, kept per fixture. It starts at the master's time
+// modulo 2^32, the value a beacon sent at that moment would carry, and
+// then runs on by each step of that value, taken modulo 2^32: the master's
+// wrap is just another step forward, so effect time never jumps back and
+// frame counts stay continuous. Small steps back, the estimate being
+// corrected, are held until the master time catches up; a jump back of
+// CLOCK_SYNC_RESET_US or more is a new master and restarts the count.
+//
+// Fixtures that start within the same 71.6-minute turn of the master's
+// clock agree exactly. One that starts after others have run through a
+// wrap is a whole number of 2^32 us apart from them; the beacon has no
+// room for the wrap count.
+typedef struct {
+    bool running;
+    uint32_t last_us;                     // Master time modulo 2^32 at the last step
+    int64_t effect_us;
+} clock_sync_effect_t;
+
+// Effect time for a local time. The model must be locked; stop the count
+// (running = false) while it is not.
+int64_t clock_sync_effect_time(clock_sync_effect_t *effect, const clock_sync_model_t *model,
+                               int64_t local_us);
+
+// Beacon bytes for the master's manufacturer data
+void clock_sync_beacon_encode(uint8_t out[CLOCK_SYNC_BEACON_SIZE], uint32_t master_us);
+
+// Find a beacon in raw advertising data (AD structures)
+bool clock_sync_beacon_find(const uint8_t *adv, uint8_t len, uint32_t *master_us);
+
+#endif
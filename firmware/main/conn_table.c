@@ -0,0 +1,69 @@
+#include "conn_table.h"
+
+void conn_table_init(conn_table_t *table, uint32_t slots, uint32_t hold_ms) {
+    table->slots = slots < CONN_TABLE_MAX_SLOTS ? slots : CONN_TABLE_MAX_SLOTS;
+    table->count = 0;
+    table->hold_ms = hold_ms;
+    table->control_owner = CONN_TABLE_NONE;
+    table->control_last_ms = 0;
+    for (uint32_t i = 0; i < CONN_TABLE_MAX_SLOTS; i++) {
+        table->handle[i] = CONN_TABLE_NONE;
+    }
+}
+
+int conn_table_find(const conn_table_t *table, uint16_t handle) {
+    if (handle == CONN_TABLE_NONE) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < table->slots; i++) {
+        if (table->handle[i] == handle) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int conn_table_add(conn_table_t *table, uint16_t handle) {
+    int slot = conn_table_find(table, handle);
+
+    if (slot >= 0 || handle == CONN_TABLE_NONE) {
+        return slot;
+    }
+    for (uint32_t i = 0; i < table->slots; i++) {
+        if (table->handle[i] == CONN_TABLE_NONE) {
+            table->handle[i] = handle;
+            table->count++;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int conn_table_remove(conn_table_t *table, uint16_t handle) {
+    int slot = conn_table_find(table, handle);
+
+    if (slot < 0) {
+        return -1;
+    }
+    table->handle[slot] = CONN_TABLE_NONE;
+    table->count--;
+    if (table->control_owner == handle) {
+        table->control_owner = CONN_TABLE_NONE;
+    }
+    return slot;
+}
+
+bool conn_table_should_advertise(const conn_table_t *table, bool advertising) {
+    return table->count < table->slots && !advertising;
+}
+
+bool conn_table_claim_control(conn_table_t *table, uint16_t handle, uint32_t now_ms) {
+    if (table->hold_ms > 0 && table->control_owner != handle &&
+        table->control_owner != CONN_TABLE_NONE &&
+        now_ms - table->control_last_ms < table->hold_ms) {
+        return false;
+    }
+    table->control_owner = handle;
+    table->control_last_ms = now_ms;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Connection bookkeeping for several centrals at once: which slot each
+// connection handle has, how many are in use, whether to keep advertising
+// for another, and which client holds control of the light.
+//
+// The effects engine only hears about the first connect (count goes to 1)
+// and the last disconnect (count goes to 0). Handles that are already in
+// the table, or not in it, leave the count alone, so a repeated or stray
+// GAP event cannot unbalance it.
+//
+// This module is pure: no NimBLE and no clock. The BLE server keeps the
+// per-link state in an array indexed by slot and feeds in GAP events.
+
+#define CONN_TABLE_NONE         0xFFFF  // Same as BLE_HS_CONN_HANDLE_NONE
+#define CONN_TABLE_MAX_SLOTS    9       // NimBLE's connection limit
+
+typedef struct {
+    uint16_t handle[CONN_TABLE_MAX_SLOTS];  // CONN_TABLE_NONE while free
+    uint32_t slots;                         // Configured slots
+    uint32_t count;                         // Slots in use
+    uint32_t hold_ms;                       // Control hold, 0 for last writer wins
+    uint16_t control_owner;                 // Client that wrote last
+    uint32_t control_last_ms;
+} conn_table_t;
+
+void conn_table_init(conn_table_t *table, uint32_t slots, uint32_t hold_ms);
+
+// Take a free slot for a new connection. Returns the slot, the existing
+// slot for a handle already in the table, or -1 if every slot is taken.
+int conn_table_add(conn_table_t *table, uint16_t handle);
+
+// Release a connection's slot. Returns the slot, or -1 for an unknown handle.
+int conn_table_remove(conn_table_t *table, uint16_t handle);
+
+// Slot of a connection, or -1
+int conn_table_find(const conn_table_t *table, uint16_t handle);
+
+// True if another central could still connect and advertising is not
+// already running
+bool conn_table_should_advertise(const conn_table_t *table, bool advertising);
+
+// Write policy. With hold_ms at 0 every write goes through in arrival
+// order. Otherwise the client that wrote last keeps control until it has
+// been quiet hold_ms; returns false for a write from anyone else meanwhile.
+bool conn_table_claim_control(conn_table_t *table, uint16_t handle, uint32_t now_ms);
+
+#endif
@@ -0,0 +1,30 @@
+#include "dimming.h"
+#include "effect_luts.h"
+
+#define Q16_FRAC_MASK         0xFFFF
+
+// Interpolate the generated lightness table
+uint32_t dimming_duty_q16(uint32_t level) {
+    if (level >= EFFECT_LUT_MAX_DUTY) {
+        return EFFECT_LUT_MAX_DUTY << 16;
+    }
+
+    uint32_t logical = (level << 16) / EFFECT_LUT_MAX_DUTY;
+    uint32_t shift = 16 - EFFECT_CIE_BITS;
+    uint32_t index = logical >> shift;
+    uint32_t frac = logical & ((1U << shift) - 1);
+    uint32_t a = effect_cie_q16[index];
+    uint32_t b = effect_cie_q16[index + 1];
+
+    return (a + (((b - a) * frac) >> shift)) * EFFECT_LUT_MAX_DUTY;
+}
+
+uint32_t dimming_quantize(uint32_t *residue, uint32_t duty_q16, bool dither) {
+    if (dither) {
+        uint32_t acc = duty_q16 + *residue;
+        *residue = acc & Q16_FRAC_MASK;
+        return acc >> 16;
+    }
+    *residue = 0;
+    return dimming_round(duty_q16);
+}
@@ -0,0 +1,29 @@
+#ifndef DIMMING_H
+#define DIMMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Output dimming: effect frames are perceived lightness, the LED drivers
+// take duty. Each channel goes through the CIE 1931 lightness curve to a
+// duty with 16 fractional bits, and is then quantized to a whole duty,
+// rounded or, on animated frames, dithered over time.
+//
+// This module is pure: levels in, duties out. The effects task keeps the
+// dither residue per channel and stages the duty on the PWM.
+
+// Logical level (0..EFFECT_LUT_MAX_DUTY, clamped) to duty, 16 fractional bits
+uint32_t dimming_duty_q16(uint32_t level);
+
+// Nearest whole duty
+static inline uint32_t dimming_round(uint32_t duty_q16) {
+    return (duty_q16 + 0x8000) >> 16;
+}
+
+// Quantize one channel. While dithering the fraction is carried into the
+// next frame in *residue (first-order sigma-delta), so the average over a
+// few frames keeps the full 16 fractional bits. Otherwise the duty is
+// rounded and the carry dropped, so a held level is one fixed duty.
+uint32_t dimming_quantize(uint32_t *residue, uint32_t duty_q16, bool dither);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef EFFECT_RNG_H
+#define EFFECT_RNG_H
+
+#include <stdint.h>
+
+// Per-effect random numbers: a 32-bit xorshift generator living in the
+// effect's state. Unlike rand() it takes no lock and no division, and the
+// same seed always renders the same frames.
+
+typedef struct {
+    uint32_t state;  // Never zero
+} effect_rng_t;
+
+// Mix the seed so nearby seeds (and seed 0) give unrelated sequences
+static inline void effect_rng_seed(effect_rng_t *rng, uint32_t seed)
+{
+    seed ^= seed >> 16;
+    seed *= 0x7feb352dU;
+    seed ^= seed >> 15;
+    seed *= 0x846ca68bU;
+    seed ^= seed >> 16;
+    rng->state = seed ? seed : 0x9e3779b9U;
+}
+
+static inline uint32_t effect_rng_next(effect_rng_t *rng)
+{
+    uint32_t x = rng->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng->state = x;
+    return x;
+}
+
+// Uniform integer in 0..n-1, by multiply and shift instead of modulo
+static inline uint32_t effect_rng_range(effect_rng_t *rng, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)effect_rng_next(rng) * n) >> 32);
+}
+
+// Uniform fraction in Q15 (0..32767)
+static inline uint32_t effect_rng_q15(effect_rng_t *rng)
+{
+    return effect_rng_next(rng) >> 17;
+}
+
+#endif
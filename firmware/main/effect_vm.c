@@ -0,0 +1,413 @@
+#include "effect_vm.h"
+#include "fixed_math.h"
+#include "effect_luts.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "EFFECT_VM";
+
+#define VM_OPCODES  0x40
+
+// Immediate size and stack effect of every opcode, for the verifier
+typedef struct {
+    bool valid;
+    uint8_t imm;
+    uint8_t pops;
+    uint8_t pushes;
+} op_info_t;
+
+static const op_info_t op_info[VM_OPCODES] = {
+    [VM_OP_END]    = {true, 0, 0, 0},
+    [VM_OP_PUSH]   = {true, 2, 0, 1},
+    [VM_OP_PUSH32] = {true, 4, 0, 1},
+    [VM_OP_DUP]    = {true, 0, 1, 2},
+    [VM_OP_DROP]   = {true, 0, 1, 0},
+    [VM_OP_SWAP]   = {true, 0, 2, 2},
+    [VM_OP_OVER]   = {true, 0, 2, 3},
+    [VM_OP_LOAD]   = {true, 1, 0, 1},
+    [VM_OP_STORE]  = {true, 1, 1, 0},
+    [VM_OP_ADD]    = {true, 0, 2, 1},
+    [VM_OP_SUB]    = {true, 0, 2, 1},
+    [VM_OP_MUL]    = {true, 0, 2, 1},
+    [VM_OP_DIV]    = {true, 0, 2, 1},
+    [VM_OP_NEG]    = {true, 0, 1, 1},
+    [VM_OP_ABS]    = {true, 0, 1, 1},
+    [VM_OP_MIN]    = {true, 0, 2, 1},
+    [VM_OP_MAX]    = {true, 0, 2, 1},
+    [VM_OP_CLAMP]  = {true, 0, 1, 1},
+    [VM_OP_LT]     = {true, 0, 2, 1},
+    [VM_OP_SELECT] = {true, 0, 3, 1},
+    [VM_OP_FRAC]   = {true, 0, 1, 1},
+    [VM_OP_SIN]    = {true, 0, 1, 1},
+    [VM_OP_NOISE]  = {true, 0, 1, 1},
+    [VM_OP_HSV]    = {true, 0, 3, 3},
+    [VM_OP_TIME]   = {true, 0, 0, 1},
+    [VM_OP_SPEED]  = {true, 0, 0, 1},
+    [VM_OP_PARAM]  = {true, 1, 0, 1},
+    [VM_OP_JMP]    = {true, 2, 0, 0},
+    [VM_OP_JZ]     = {true, 2, 1, 0},
+    [VM_OP_OUT]    = {true, 0, 4, 0},
+};
+
+// Uploads land in the raw buffer and are compiled into the program slot
+// that is not running; commit swaps the slots.
+static uint8_t upload_buffer[EFFECT_VM_HEADER_SIZE + EFFECT_VM_MAX_CODE];
+static effect_vm_program_t programs[2];
+static int active_index = -1;  // -1 until the first commit
+static uint32_t next_serial = 1;
+
+// Upload status belongs to the BLE host task. Overruns are counted by the
+// effects task, in a word of their own that only it writes.
+static effect_vm_status_t status = {0};
+static uint32_t budget_overruns = 0;
+
+// Verifier scratch; uploads are serialized on the BLE host task
+static int16_t index_of[EFFECT_VM_MAX_CODE + 1];
+static int8_t depth_at[EFFECT_VM_MAX_CODE];
+static uint16_t worklist[EFFECT_VM_MAX_CODE];
+
+bool effect_vm_compile(const uint8_t *bytes, uint16_t len, effect_vm_program_t *prog) {
+    if (len < EFFECT_VM_HEADER_SIZE || bytes[0] != 'F' || bytes[1] != 'X' ||
+        bytes[2] != EFFECT_VM_VERSION || len - EFFECT_VM_HEADER_SIZE > EFFECT_VM_MAX_CODE) {
+        ESP_LOGW(TAG, "Invalid program header (%u bytes)", len);
+        return false;
+    }
+    const uint8_t *code = bytes + EFFECT_VM_HEADER_SIZE;
+    uint32_t size = len - EFFECT_VM_HEADER_SIZE;
+    uint32_t count = 0;
+
+    // Decode into fixed-width instructions, remembering where each starts
+    memset(index_of, 0xFF, sizeof(index_of));
+    for (uint32_t pc = 0; pc < size; ) {
+        uint8_t op = code[pc];
+        if (op >= VM_OPCODES || !op_info[op].valid || pc + 1 + op_info[op].imm > size) {
+            ESP_LOGW(TAG, "Bad opcode 0x%02x at %lu", op, (unsigned long)pc);
+            return false;
+        }
+
+        const uint8_t *imm = &code[pc + 1];
+        int32_t arg = 0;
+        switch (op_info[op].imm) {
+            case 1: arg = imm[0]; break;
+            case 2: arg = (op == VM_OP_PUSH) ? (int16_t)(imm[0] | (imm[1] << 8)) : (imm[0] | (imm[1] << 8)); break;
+            case 4: arg = (int32_t)(imm[0] | (imm[1] << 8) | (imm[2] << 16) | ((uint32_t)imm[3] << 24)); break;
+        }
+        if (((op == VM_OP_LOAD || op == VM_OP_STORE) && arg >= EFFECT_VM_VARS) ||
+            (op == VM_OP_PARAM && arg >= 4)) {
+            ESP_LOGW(TAG, "Operand %ld out of range at %lu", (long)arg, (unsigned long)pc);
+            return false;
+        }
+
+        index_of[pc] = count;
+        prog->code[count].op = op;
+        prog->code[count].arg = arg;
+        count++;
+        pc += 1 + op_info[op].imm;
+    }
+    index_of[size] = count;  // Jumping to the end finishes the frame
+
+    // Jump targets must be instruction boundaries
+    for (uint32_t i = 0; i < count; i++) {
+        effect_vm_insn_t *insn = &prog->code[i];
+        if (insn->op == VM_OP_JMP || insn->op == VM_OP_JZ) {
+            if ((uint32_t)insn->arg > size || index_of[insn->arg] < 0) {
+                ESP_LOGW(TAG, "Jump into the middle of an instruction: %ld", (long)insn->arg);
+                return false;
+            }
+            insn->arg = index_of[insn->arg];
+        }
+    }
+
+    // Every path must reach each instruction with the same stack depth, in
+    // range, so the interpreter needs no stack checks
+    uint32_t pending = 0;
+    memset(depth_at, -1, sizeof(depth_at));
+    if (count > 0) {
+        depth_at[0] = 0;
+        worklist[pending++] = 0;
+    }
+    while (pending > 0) {
+        uint32_t i = worklist[--pending];
+        const effect_vm_insn_t *insn = &prog->code[i];
+        const op_info_t *info = &op_info[insn->op];
+        int depth = depth_at[i];
+
+        if (depth < info->pops || depth - info->pops + info->pushes > EFFECT_VM_STACK_SIZE) {
+            ESP_LOGW(TAG, "Stack %s at instruction %lu",
+                     depth < info->pops ? "underflow" : "overflow", (unsigned long)i);
+            return false;
+        }
+        depth = depth - info->pops + info->pushes;
+
+        uint32_t next[2];
+        int successors = 0;
+        if (insn->op != VM_OP_END && insn->op != VM_OP_JMP) {
+            next[successors++] = i + 1;
+        }
+        if (insn->op == VM_OP_JMP || insn->op == VM_OP_JZ) {
+            next[successors++] = (uint32_t)insn->arg;
+        }
+        for (int k = 0; k < successors; k++) {
+            if (next[k] >= count) {
+                continue;
+            }
+            if (depth_at[next[k]] < 0) {
+                depth_at[next[k]] = depth;
+                worklist[pending++] = next[k];
+            } else if (depth_at[next[k]] != depth) {
+                ESP_LOGW(TAG, "Stack depth mismatch at instruction %lu", (unsigned long)next[k]);
+                return false;
+            }
+        }
+    }
+
+    prog->length = count;
+    return true;
+}
+
+bool effect_vm_upload_begin(uint16_t length) {
+    if (length < EFFECT_VM_HEADER_SIZE || length > sizeof(upload_buffer)) {
+        ESP_LOGW(TAG, "Upload of %u bytes rejected (max %u)", length, (unsigned)sizeof(upload_buffer));
+        status.state = EFFECT_VM_UPLOAD_ERROR;
+        return false;
+    }
+
+    status.state = EFFECT_VM_UPLOAD_RECEIVING;
+    status.length = length;
+    status.received = 0;
+    return true;
+}
+
+bool effect_vm_upload_data(uint16_t offset, const uint8_t *data, uint16_t len) {
+    if (status.state != EFFECT_VM_UPLOAD_RECEIVING) {
+        return false;
+    }
+    if (offset != status.received || len > status.length - status.received) {
+        ESP_LOGW(TAG, "Chunk at %u+%u out of order (have %u of %u)",
+                 offset, len, status.received, status.length);
+        status.state = EFFECT_VM_UPLOAD_ERROR;
+        return false;
+    }
+
+    memcpy(upload_buffer + offset, data, len);
+    status.received += len;
+    return true;
+}
+
+bool effect_vm_upload_commit(void) {
+    if (status.state != EFFECT_VM_UPLOAD_RECEIVING || status.received != status.length) {
+        status.state = EFFECT_VM_UPLOAD_ERROR;
+        return false;
+    }
+
+    // The effects task fetches the active program once per frame, and the
+    // next commit is at least a connection event away, so the slot being
+    // overwritten is never the one a frame is still running.
+    int index = (active_index == 0) ? 1 : 0;
+    effect_vm_program_t *prog = &programs[index];
+    if (!effect_vm_compile(upload_buffer, status.length, prog)) {
+        status.state = EFFECT_VM_UPLOAD_ERROR;
+        return false;
+    }
+    prog->serial = next_serial++;
+
+    __atomic_store_n(&active_index, index, __ATOMIC_RELEASE);
+    status.state = EFFECT_VM_UPLOAD_READY;
+    status.instructions = prog->length;
+    ESP_LOGI(TAG, "Program verified: %u instructions", prog->length);
+    return true;
+}
+
+void effect_vm_get_status(effect_vm_status_t *out) {
+    *out = status;
+    out->budget_overruns = __atomic_load_n(&budget_overruns, __ATOMIC_RELAXED);
+}
+
+const effect_vm_program_t *effect_vm_get_active(void) {
+    int index = __atomic_load_n(&active_index, __ATOMIC_ACQUIRE);
+    return index < 0 ? NULL : &programs[index];
+}
+
+static uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// 1D value noise: a random level per unit cell, smoothstepped between cells
+static int32_t value_noise_q15(int32_t x) {
+    int32_t cell = x >> 15;
+    int32_t a = (int32_t)(hash_u32((uint32_t)cell) >> 17);
+    int32_t b = (int32_t)(hash_u32((uint32_t)cell + 1) >> 17);
+    int32_t f = (int32_t)fx_smoothstep_q15((uint32_t)(x & 0x7FFF));
+
+    return a + (((b - a) * f) >> 15);
+}
+
+static int32_t clamp_unit(int32_t v) {
+    return v < 0 ? 0 : (v > Q15_ONE ? Q15_ONE : v);
+}
+
+// Hue from the generated wheel, then saturation and value in Q15
+static void hsv_q15(int32_t h, int32_t s, int32_t v, int32_t rgb[3]) {
+    uint32_t index = ((uint32_t)(h & 0x7FFF) * EFFECT_HUE_STEPS) >> 15;
+
+    s = clamp_unit(s);
+    v = clamp_unit(v);
+    for (int c = 0; c < 3; c++) {
+        int32_t pure = (int32_t)(((uint32_t)effect_hue_rgb[index][c] * Q15_ONE) / EFFECT_LUT_MAX_DUTY);
+        int32_t level = Q15_ONE - ((s * (Q15_ONE - pure)) >> 15);
+        rgb[c] = (v * level) >> 15;
+    }
+}
+
+bool effect_vm_run(const effect_vm_program_t *prog, int32_t vars[EFFECT_VM_VARS],
+                   const effect_vm_input_t *in, effect_vm_output_t *out) {
+    int32_t stack[EFFECT_VM_STACK_SIZE];
+    int sp = 0;
+    uint32_t pc = 0;
+    uint32_t executed = 0;
+    int32_t a, b, c;
+    int64_t q;
+
+    // Stack bounds were proven by effect_vm_compile()
+    while (pc < prog->length) {
+        if (++executed > EFFECT_VM_BUDGET) {
+            __atomic_store_n(&budget_overruns, budget_overruns + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        const effect_vm_insn_t *insn = &prog->code[pc++];
+        switch (insn->op) {
+            case VM_OP_END:
+                return true;
+            case VM_OP_PUSH:
+            case VM_OP_PUSH32:
+                stack[sp++] = insn->arg;
+                break;
+            case VM_OP_DUP:
+                stack[sp] = stack[sp - 1];
+                sp++;
+                break;
+            case VM_OP_DROP:
+                sp--;
+                break;
+            case VM_OP_SWAP:
+                a = stack[sp - 1];
+                stack[sp - 1] = stack[sp - 2];
+                stack[sp - 2] = a;
+                break;
+            case VM_OP_OVER:
+                stack[sp] = stack[sp - 2];
+                sp++;
+                break;
+            case VM_OP_LOAD:
+                stack[sp++] = vars[insn->arg];
+                break;
+            case VM_OP_STORE:
+                vars[insn->arg] = stack[--sp];
+                break;
+
+            case VM_OP_ADD:
+                b = stack[--sp];
+                stack[sp - 1] = (int32_t)((uint32_t)stack[sp - 1] + (uint32_t)b);
+                break;
+            case VM_OP_SUB:
+                b = stack[--sp];
+                stack[sp - 1] = (int32_t)((uint32_t)stack[sp - 1] - (uint32_t)b);
+                break;
+            case VM_OP_MUL:
+                b = stack[--sp];
+                stack[sp - 1] = (int32_t)(((int64_t)stack[sp - 1] * b) >> 15);
+                break;
+            case VM_OP_DIV:
+                b = stack[--sp];
+                if (b == 0) {
+                    stack[sp - 1] = 0;
+                    break;
+                }
+                q = ((int64_t)stack[sp - 1] * Q15_ONE) / b;
+                stack[sp - 1] = q > INT32_MAX ? INT32_MAX : (q < INT32_MIN ? INT32_MIN : (int32_t)q);
+                break;
+            case VM_OP_NEG:
+                stack[sp - 1] = (int32_t)(0U - (uint32_t)stack[sp - 1]);
+                break;
+            case VM_OP_ABS:
+                if (stack[sp - 1] < 0) {
+                    stack[sp - 1] = (int32_t)(0U - (uint32_t)stack[sp - 1]);
+                }
+                break;
+            case VM_OP_MIN:
+                b = stack[--sp];
+                stack[sp - 1] = b < stack[sp - 1] ? b : stack[sp - 1];
+                break;
+            case VM_OP_MAX:
+                b = stack[--sp];
+                stack[sp - 1] = b > stack[sp - 1] ? b : stack[sp - 1];
+                break;
+            case VM_OP_CLAMP:
+                stack[sp - 1] = clamp_unit(stack[sp - 1]);
+                break;
+            case VM_OP_LT:
+                b = stack[--sp];
+                stack[sp - 1] = stack[sp - 1] < b ? Q15_ONE : 0;
+                break;
+            case VM_OP_SELECT:
+                b = stack[--sp];
+                a = stack[--sp];
+                stack[sp - 1] = stack[sp - 1] != 0 ? a : b;
+                break;
+            case VM_OP_FRAC:
+                stack[sp - 1] &= 0x7FFF;
+                break;
+
+            case VM_OP_SIN:
+                stack[sp - 1] = fx_sin_q15((uint32_t)stack[sp - 1] << 17);
+                break;
+            case VM_OP_NOISE:
+                stack[sp - 1] = value_noise_q15(stack[sp - 1]);
+                break;
+            case VM_OP_HSV: {
+                int32_t rgb[3];
+                c = stack[--sp];
+                b = stack[--sp];
+                hsv_q15(stack[sp - 1], b, c, rgb);
+                stack[sp - 1] = rgb[0];
+                stack[sp++] = rgb[1];
+                stack[sp++] = rgb[2];
+                break;
+            }
+
+            case VM_OP_TIME:
+                stack[sp++] = (int32_t)(uint32_t)((in->t_us * Q15_ONE) / 1000000);
+                break;
+            case VM_OP_SPEED:
+                stack[sp++] = in->speed;
+                break;
+            case VM_OP_PARAM:
+                stack[sp++] = in->param[insn->arg];
+                break;
+
+            case VM_OP_JMP:
+                pc = (uint32_t)insn->arg;
+                break;
+            case VM_OP_JZ:
+                if (stack[--sp] == 0) {
+                    pc = (uint32_t)insn->arg;
+                }
+                break;
+
+            case VM_OP_OUT:
+                out->w = clamp_unit(stack[--sp]);
+                out->b = clamp_unit(stack[--sp]);
+                out->g = clamp_unit(stack[--sp]);
+                out->r = clamp_unit(stack[--sp]);
+                break;
+        }
+    }
+
+    return true;
+}
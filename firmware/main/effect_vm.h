@@ -0,0 +1,124 @@
+#ifndef EFFECT_VM_H
+#define EFFECT_VM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+// User effect programs: a small stack machine uploaded over BLE and run by
+// the effects engine once per frame in place of a built-in effect.
+//
+// Values are Q15 fixed point (32768 == 1.0) in int32_t. A program is
+//   header  4 bytes  'F' 'X' version reserved
+//   code    opcode bytes, immediates little-endian
+// It runs top to bottom every frame; OUT sets the output color and END (or
+// the end of the code) finishes the frame. LOAD/STORE variables persist
+// between frames and start at zero.
+//
+// Programs are verified once on upload: opcodes, immediates, jump targets
+// and the stack depth at every instruction are checked, and the code is
+// decoded into a fixed-width form. At run time only the instruction budget
+// is checked, so a frame costs a bounded amount no matter what was uploaded.
+
+#define EFFECT_VM_VERSION        1
+#define EFFECT_VM_HEADER_SIZE    4
+#define EFFECT_VM_MAX_CODE       256   // Bytes of code after the header
+#define EFFECT_VM_STACK_SIZE     16
+#define EFFECT_VM_VARS           8
+#define EFFECT_VM_BUDGET         512   // Instructions per frame
+
+typedef enum {
+    VM_OP_END    = 0x00,  // Finish the frame
+    VM_OP_PUSH   = 0x01,  // imm16, sign-extended
+    VM_OP_PUSH32 = 0x02,  // imm32
+    VM_OP_DUP    = 0x03,
+    VM_OP_DROP   = 0x04,
+    VM_OP_SWAP   = 0x05,
+    VM_OP_OVER   = 0x06,
+    VM_OP_LOAD   = 0x08,  // imm8 variable -> value
+    VM_OP_STORE  = 0x09,  // imm8 variable, value ->
+
+    VM_OP_ADD    = 0x10,  // a b -> a+b
+    VM_OP_SUB    = 0x11,  // a b -> a-b
+    VM_OP_MUL    = 0x12,  // a b -> a*b (Q15)
+    VM_OP_DIV    = 0x13,  // a b -> a/b (Q15), 0 if b is 0
+    VM_OP_NEG    = 0x14,
+    VM_OP_ABS    = 0x15,
+    VM_OP_MIN    = 0x16,
+    VM_OP_MAX    = 0x17,
+    VM_OP_CLAMP  = 0x18,  // Clamp to 0..1
+    VM_OP_LT     = 0x19,  // a b -> 1.0 if a < b, else 0
+    VM_OP_SELECT = 0x1A,  // c a b -> a if c != 0, else b
+    VM_OP_FRAC   = 0x1B,  // Fractional part, 0..1
+
+    VM_OP_SIN    = 0x20,  // turns (1.0 == full turn) -> sine, -1..1
+    VM_OP_NOISE  = 0x21,  // x -> smooth value noise, 0..1, one cell per 1.0
+    VM_OP_HSV    = 0x22,  // h s v -> r g b, all 0..1 (h in turns)
+
+    VM_OP_TIME   = 0x28,  // -> effect time in seconds
+    VM_OP_SPEED  = 0x29,  // -> speed setting, 0..1
+    VM_OP_PARAM  = 0x2A,  // imm8 0-3 -> configured R, G, B or W, 0..1
+
+    VM_OP_JMP    = 0x30,  // imm16 code offset
+    VM_OP_JZ     = 0x31,  // imm16 code offset, c -> (jump if c == 0)
+
+    VM_OP_OUT    = 0x38,  // r g b w -> (0..1 each, before brightness)
+} effect_vm_opcode_t;
+
+// One decoded instruction; jump arguments are instruction indices
+typedef struct {
+    uint8_t op;
+    int32_t arg;
+} effect_vm_insn_t;
+
+typedef struct {
+    effect_vm_insn_t code[EFFECT_VM_MAX_CODE];
+    uint16_t length;          // Instructions
+    uint32_t serial;          // Changes with every committed upload
+} effect_vm_program_t;
+
+// Program output, Q15 per channel
+typedef struct {
+    int32_t r, g, b, w;
+} effect_vm_output_t;
+
+// Inputs for one frame
+typedef struct {
+    int64_t t_us;             // Effect time
+    int32_t speed;            // Q15
+    int32_t param[4];         // Configured color, Q15
+} effect_vm_input_t;
+
+typedef enum {
+    EFFECT_VM_UPLOAD_IDLE = 0,
+    EFFECT_VM_UPLOAD_RECEIVING,
+    EFFECT_VM_UPLOAD_READY,   // Last upload verified and running
+    EFFECT_VM_UPLOAD_ERROR,
+} effect_vm_upload_state_t;
+
+typedef struct {
+    effect_vm_upload_state_t state;
+    uint16_t received;
+    uint16_t length;
+    uint16_t instructions;    // In the active program
+    uint32_t budget_overruns; // Frames cut short by EFFECT_VM_BUDGET
+} effect_vm_status_t;
+
+// Upload, called from the BLE host task. Chunks must arrive in order.
+bool effect_vm_upload_begin(uint16_t length);
+bool effect_vm_upload_data(uint16_t offset, const uint8_t *data, uint16_t len);
+bool effect_vm_upload_commit(void);
+void effect_vm_get_status(effect_vm_status_t *status);
+
+// Verify and decode raw program bytes (header included)
+bool effect_vm_compile(const uint8_t *bytes, uint16_t len, effect_vm_program_t *prog);
+
+// The running program, or NULL if none was uploaded
+const effect_vm_program_t *effect_vm_get_active(void);
+
+// Run one frame. vars persist between frames. Returns false if the frame
+// hit the instruction budget; out then holds whatever was set before that.
+bool effect_vm_run(const effect_vm_program_t *prog, int32_t vars[EFFECT_VM_VARS],
+                   const effect_vm_input_t *in, effect_vm_output_t *out);
+
+#endif
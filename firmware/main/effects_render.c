@@ -0,0 +1,629 @@
+#include "effects_render.h"
+#include "fixed_math.h"
+#include "effect_luts.h"
+#include "timeline.h"
+#include "effect_vm.h"
+#include <string.h>
+
+// Driver-specific effect tuning based on Kconfig
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+    #define FAST_EFFECT_DIVISOR 8
+    #define SMOOTH_FADE_SPEED_MULT 0.001
+#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
+    #define FAST_EFFECT_DIVISOR 4
+    #define SMOOTH_FADE_SPEED_MULT 0.002
+#endif
+
+// Per-frame phase increments per speed unit (turns), folded at compile time
+#define SMOOTH_FADE_STEP      TURNS_PER_SPEED(SMOOTH_FADE_SPEED_MULT)
+#define BREATHING_STEP        RAD_PER_SPEED(0.02)
+#define PULSE_WAVE_STEP       RAD_PER_SPEED(0.05)
+#define PRECISION_FADE_STEP   TURNS_PER_SPEED(0.0001)
+
+#define Q16_ONE               65536
+#define TWINKLE_SATURATION    52429   // 0.8 in Q16
+
+// Keyframe (hardware fade) tuning
+#define BREATHING_KEYFRAMES   32    // Chords per breathing period
+#define KEYFRAME_HOLD_FRAMES  (1000 / EFFECT_UPDATE_INTERVAL_MS)  // Re-check rate for frozen effects
+
+// Helper function to convert HSV to RGB.
+// h is a phase in turns, s and v are Q16 (65536 == 1.0). The 64-bit
+// intermediates keep the result identical to the old float version except
+// where float rounding itself lands on an 8-bit boundary.
+static void hsv_to_rgb(uint32_t h, uint32_t s, uint32_t v, uint8_t *r, uint8_t *g, uint8_t *b) {
+    uint64_t h6 = (uint64_t)h * 6;
+    uint32_t i = (uint32_t)(h6 >> 32);
+    uint64_t f = (uint32_t)h6;                  // Position within the sextant, Q32
+    uint64_t s32 = (uint64_t)s << 16;
+    uint64_t fs = (f * s) >> 16;
+
+    uint32_t p = (uint32_t)(((v * ((1ULL << 32) - s32)) >> 16) * 255 >> 32);
+    uint32_t q = (uint32_t)(((v * ((1ULL << 32) - fs)) >> 16) * 255 >> 32);
+    uint32_t t = (uint32_t)(((v * ((1ULL << 32) - s32 + fs)) >> 16) * 255 >> 32);
+    uint32_t vv = (v * 255) >> 16;
+
+    switch (i) {
+        case 0: *r = vv; *g = t; *b = p; break;
+        case 1: *r = q; *g = vv; *b = p; break;
+        case 2: *r = p; *g = vv; *b = t; break;
+        case 3: *r = p; *g = q; *b = vv; break;
+        case 4: *r = t; *g = p; *b = vv; break;
+        default: *r = vv; *g = p; *b = q; break;
+    }
+}
+
+// Fully saturated hue at driver resolution, read from the generated table
+static void hue_to_rgb(uint32_t h, effect_frame_t *out) {
+    const effect_lut_duty_t *rgb = effect_hue_rgb[((uint64_t)h * EFFECT_HUE_STEPS) >> 32];
+    out->r = rgb[0];
+    out->g = rgb[1];
+    out->b = rgb[2];
+}
+
+// Apply brightness scaling with proper resolution scaling.
+// max_duty is a build-time constant, so the divisions compile to multiplies.
+static void apply_brightness(effect_frame_t *f, uint32_t brightness) {
+    // Apply brightness scaling (brightness is already in driver resolution)
+    f->r = (f->r * brightness) / EFFECT_LUT_MAX_DUTY;
+    f->g = (f->g * brightness) / EFFECT_LUT_MAX_DUTY;
+    f->b = (f->b * brightness) / EFFECT_LUT_MAX_DUTY;
+    f->w = (f->w * brightness) / EFFECT_LUT_MAX_DUTY;
+}
+
+// Scale color values to driver resolution
+static uint32_t scale_to_driver_resolution(uint8_t color_8bit) {
+    return (color_8bit * EFFECT_LUT_MAX_DUTY) / 255;
+}
+
+// Static color
+static void render_static(const effect_config_t *p, effect_frame_t *out) {
+    out->r = p->r; out->g = p->g; out->b = p->b; out->w = p->w;
+    apply_brightness(out, p->brightness);
+}
+
+// Smooth fade effect (default)
+static void render_smooth_fade(effect_state_t *s, const effect_config_t *p, uint32_t step, effect_frame_t *out) {
+    // Smooth hue transition with driver-optimized speed
+    s->fade.hue += step * p->speed * SMOOTH_FADE_STEP;
+
+    hue_to_rgb(s->fade.hue, out);
+    out->w = 0;
+    apply_brightness(out, p->brightness);
+}
+
+// RGB cycle effect (hard transitions between colors)
+static void render_rgb_cycle(effect_state_t *s, const effect_config_t *p, effect_frame_t *out) {
+    uint32_t level = p->brightness;
+
+    // Calculate delay based on speed
+    uint32_t delay_ticks = (255 - p->speed) * 2 + 50;
+
+    if (p->beat_locked) {
+        // One color per beat
+        s->cycle.color = p->beat_count % 7;
+        s->cycle.last_change = s->frame;
+    } else if (s->frame - s->cycle.last_change >= delay_ticks) {
+        s->cycle.color = (s->cycle.color + 1) % 7;
+        s->cycle.last_change = s->frame;
+    }
+
+    // Set colors based on cycle state, scale to driver resolution
+    switch (s->cycle.color) {
+        case 0: out->r = level; break;  // Red
+        case 1: out->g = level; break;  // Green
+        case 2: out->b = level; break;  // Blue
+        case 3: out->r = level; out->g = level; break;  // Yellow
+        case 4: out->r = level; out->b = level; break;  // Magenta
+        case 5: out->g = level; out->b = level; break;  // Cyan
+        case 6: out->r = level; out->g = level; out->b = level; break;  // White
+    }
+}
+
+// Breathing effect
+static void render_breathing(const effect_state_t *s, const effect_config_t *p, effect_frame_t *out) {
+    // Sine wave breathing, breath is (sin + 1) / 2 in Q15. On the beat grid
+    // one breath lasts one beat and peaks on it.
+    uint32_t phase = p->beat_locked ? p->beat_phase + 0x40000000 : s->frame * p->speed * BREATHING_STEP;
+    uint32_t breath = (fx_sin_q15(phase) + Q15_ONE) >> 1;
+
+    out->r = p->r; out->g = p->g; out->b = p->b; out->w = p->w;
+    apply_brightness(out, (p->brightness * breath) >> 15);
+}
+
+// Twinkle pulse effect
+static void render_twinkle_pulse(effect_state_t *s, const effect_config_t *p, effect_frame_t *out) {
+    // Random color changes
+    if ((s->frame % (256 - p->speed)) == 0) {
+        hsv_to_rgb(effect_rng_next(&s->rng), TWINKLE_SATURATION, Q16_ONE,
+                   &s->twinkle.r, &s->twinkle.g, &s->twinkle.b);
+    }
+
+    // Scale to driver resolution
+    out->r = scale_to_driver_resolution(s->twinkle.r);
+    out->g = scale_to_driver_resolution(s->twinkle.g);
+    out->b = scale_to_driver_resolution(s->twinkle.b);
+
+    // Apply low brightness with occasional flickers
+    uint32_t flicker_brightness = p->brightness / 4;
+    if ((s->frame % 50) == 0 && effect_rng_range(&s->rng, 10) == 0) {
+        flicker_brightness = p->brightness / 2;
+    }
+
+    apply_brightness(out, flicker_brightness);
+}
+
+// Lightning flash effect
+static void render_lightning_flash(effect_state_t *s, const effect_config_t *p, uint32_t step, effect_frame_t *out) {
+    s->lightning.timer += step;
+
+    if (!s->lightning.in_flash) {
+        // Random lightning strikes
+        if ((s->lightning.timer > (500 - p->speed * 2)) && effect_rng_range(&s->rng, 100) == 0) {
+            s->lightning.in_flash = true;
+            s->lightning.timer = 0;
+        }
+    } else {
+        // Lightning flash sequence
+        if (s->lightning.timer < 3) {
+            // Bright white flash
+            out->w = p->brightness;
+            out->r = p->brightness / 2;  // Cool white
+        } else if (s->lightning.timer < 6) {
+            // Quick dim
+            out->w = p->brightness / 4;
+        } else if (s->lightning.timer < 8) {
+            // Second flash
+            out->w = p->brightness * 3 / 4;
+        } else {
+            // Reset
+            s->lightning.in_flash = false;
+            s->lightning.timer = 0;
+        }
+    }
+}
+
+// Candle flicker effect
+static void render_candle_flicker(effect_state_t *s, const effect_config_t *p, effect_frame_t *out) {
+    int32_t flame = s->candle.intensity;
+
+    // Random flame flicker (Q15)
+    flame += (((int32_t)effect_rng_q15(&s->rng) - Q15_ONE / 2) * Q15(0.1)) >> 15;
+    if (flame < Q15(0.3)) flame = Q15(0.3);
+    if (flame > Q15_ONE) flame = Q15_ONE;
+    s->candle.intensity = flame;
+
+    // Warm candle colors scaled to driver resolution
+    uint64_t base = (uint64_t)p->brightness * (Q15(0.7) + ((Q15(0.3) * flame) >> 15));
+    out->r = (uint32_t)(base >> 15);
+    out->g = (uint32_t)((base * Q15(0.4)) >> 30);
+    out->b = 0;
+    out->w = (uint32_t)((base * Q15(0.8)) >> 30);
+}
+
+// Board-specific effects based on Kconfig
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+// AL8860 specific effects
+
+// Triangle wave in Q16: rises over the first half turn, falls over the second
+static uint32_t pulse_wave_intensity(uint32_t phase) {
+    return (phase < 0x80000000UL) ? (phase >> 15) : ((0u - phase) >> 15);
+}
+
+// Warm white at the given Q16 intensity, tinted by the base color
+static void pulse_wave_frame(const effect_config_t *p, uint32_t intensity, effect_frame_t *out) {
+    uint32_t brightness = (p->brightness * intensity) >> 16;
+    out->r = p->r * brightness / EFFECT_LUT_MAX_DUTY;
+    out->g = p->g * brightness / EFFECT_LUT_MAX_DUTY;
+    out->b = p->b * brightness / EFFECT_LUT_MAX_DUTY;
+    out->w = brightness;
+}
+
+// Pulse wave effect - optimized for AL8860's hysteretic control
+static void render_pulse_wave(effect_state_t *s, const effect_config_t *p, uint32_t step, effect_frame_t *out) {
+    // Slower wave progression for AL8860's natural behavior
+    s->wave.phase += step * p->speed * PULSE_WAVE_STEP;
+
+    // Triangle wave pattern that works well with hysteretic control
+    pulse_wave_frame(p, pulse_wave_intensity(s->wave.phase), out);
+}
+
+// Soft transition effect - leverages AL8860's soft-start capability
+static void render_soft_transition(effect_state_t *s, const effect_config_t *p, effect_frame_t *out) {
+    // Define transition targets
+    uint32_t targets[4][4] = {
+        {p->brightness, 0, 0, 0},                    // Red
+        {0, p->brightness, 0, 0},                    // Green
+        {0, 0, p->brightness, 0},                    // Blue
+        {0, 0, 0, p->brightness}                     // Warm White
+    };
+
+    // Check if it's time for a new transition
+    uint32_t transition_duration = (255 - p->speed) * 10 + 100;
+    if (s->frame - s->soft.start >= transition_duration) {
+        s->soft.target = (s->soft.target + 1) % 4;
+        s->soft.start = s->frame;
+    }
+
+    // Smooth interpolation to new target (Q15)
+    uint32_t progress = ((s->frame - s->soft.start) << 15) / transition_duration;
+
+    // Ease-in-out for smoother transitions with AL8860
+    progress = fx_smoothstep_q15(progress);
+
+    effect_frame_t *cur = &s->soft.current;
+    cur->r = fx_lerp_q15(cur->r, targets[s->soft.target][0], progress);
+    cur->g = fx_lerp_q15(cur->g, targets[s->soft.target][1], progress);
+    cur->b = fx_lerp_q15(cur->b, targets[s->soft.target][2], progress);
+    cur->w = fx_lerp_q15(cur->w, targets[s->soft.target][3], progress);
+    *out = *cur;
+}
+
+#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
+// LM3414 specific effects
+
+// Precision fade effect - high-resolution fading for LM3414
+static void render_precision_fade(effect_state_t *s, const effect_config_t *p, uint32_t step, effect_frame_t *out) {
+    // Ultra-smooth hue progression using LM3414's 12-bit resolution
+    s->fade.hue += step * p->speed * PRECISION_FADE_STEP;  // Very fine steps
+
+    // Hue table is already at full 12-bit resolution
+    hue_to_rgb(s->fade.hue, out);
+    out->w = 0;
+
+    // Apply brightness with 12-bit precision
+    apply_brightness(out, p->brightness);
+}
+
+// Fast strobe effect - high-frequency effects for LM3414
+static void render_fast_strobe(effect_state_t *s, const effect_config_t *p, effect_frame_t *out) {
+    // Fast strobe timing taking advantage of LM3414's capabilities
+    uint32_t strobe_interval = (255 - p->speed) / FAST_EFFECT_DIVISOR + 1;
+
+    if (s->frame - s->strobe.last_toggle >= strobe_interval) {
+        s->strobe.on = !s->strobe.on;
+        s->strobe.last_toggle = s->frame;
+    }
+
+    uint32_t intensity = s->strobe.on ? p->brightness : 0;
+
+    // Alternate between colors at high frequency
+    uint8_t color_cycle = (s->frame / (strobe_interval * 2)) % 3;
+
+    // On the beat grid: one flash on each beat, the first eighth of it
+    if (p->beat_locked) {
+        intensity = p->beat_phase < 0x20000000 ? p->brightness : 0;
+        color_cycle = p->beat_count % 3;
+    }
+
+    switch (color_cycle) {
+        case 0: out->r = intensity; break;  // Red strobe
+        case 1: out->g = intensity; break;  // Green strobe
+        case 2: out->b = intensity; break;  // Blue strobe
+    }
+}
+
+#endif
+
+// Timeline show: interpolate between the uploaded keyframes at the exact
+// effect time. The cursor only moves forward, except on a loop or a new upload.
+static void render_timeline(effect_state_t *s, const effect_config_t *p, int64_t t_us, effect_frame_t *out) {
+    const timeline_t *tl = timeline_get_active();
+    timeline_keyframe_t from, to;
+
+    if (tl == NULL) {
+        return;  // Nothing uploaded yet: stay dark
+    }
+
+    // Fold time into the looped part
+    int64_t length_us = (int64_t)tl->length_ms * 1000;
+    if (tl->loop_index != TIMELINE_NO_LOOP && t_us >= length_us) {
+        int64_t loop_us = (int64_t)tl->loop_ms * 1000;
+        t_us = loop_us + (t_us - length_us) % (length_us - loop_us);
+    }
+    uint32_t t_ms = (uint32_t)(t_us / 1000);
+
+    // index is the first keyframe after t; start/end are the segment bounds
+    if (s->timeline.serial != tl->serial || t_ms < s->timeline.start_ms) {
+        s->timeline.serial = tl->serial;
+        s->timeline.index = 0;
+        s->timeline.start_ms = 0;
+        if (tl->loop_index != TIMELINE_NO_LOOP && t_ms >= tl->loop_ms) {
+            s->timeline.index = tl->loop_index + 1;
+            s->timeline.start_ms = tl->loop_ms;
+        }
+        timeline_get_keyframe(tl, s->timeline.index, &to);
+        s->timeline.end_ms = s->timeline.start_ms + to.delta_ms;
+    }
+    while (s->timeline.index < tl->count && t_ms >= s->timeline.end_ms) {
+        s->timeline.index++;
+        s->timeline.start_ms = s->timeline.end_ms;
+        if (s->timeline.index < tl->count) {
+            timeline_get_keyframe(tl, s->timeline.index, &to);
+            s->timeline.end_ms += to.delta_ms;
+        }
+    }
+
+    uint32_t progress = 0;
+    if (s->timeline.index == 0) {
+        timeline_get_keyframe(tl, 0, &from);  // Before the first keyframe
+        to = from;
+    } else if (s->timeline.index >= tl->count) {
+        timeline_get_keyframe(tl, tl->count - 1, &from);  // Show over: hold
+        to = from;
+    } else {
+        timeline_get_keyframe(tl, s->timeline.index - 1, &from);
+        timeline_get_keyframe(tl, s->timeline.index, &to);
+
+        int64_t elapsed_us = t_us - (int64_t)s->timeline.start_ms * 1000;
+        progress = (uint32_t)((elapsed_us << 15) / ((int64_t)to.delta_ms * 1000));
+        if (to.mode == TIMELINE_INTERP_STEP) {
+            progress = 0;
+        } else if (to.mode == TIMELINE_INTERP_SMOOTH) {
+            progress = fx_smoothstep_q15(progress);
+        }
+    }
+
+    out->r = fx_lerp_q15(scale_to_driver_resolution(from.r), scale_to_driver_resolution(to.r), progress);
+    out->g = fx_lerp_q15(scale_to_driver_resolution(from.g), scale_to_driver_resolution(to.g), progress);
+    out->b = fx_lerp_q15(scale_to_driver_resolution(from.b), scale_to_driver_resolution(to.b), progress);
+    out->w = fx_lerp_q15(scale_to_driver_resolution(from.w), scale_to_driver_resolution(to.w), progress);
+    apply_brightness(out, p->brightness);
+}
+
+// User program: run the uploaded VM program and scale its Q15 output
+static void render_user_program(effect_state_t *s, const effect_config_t *p, int64_t t_us, effect_frame_t *out) {
+    const effect_vm_program_t *prog = effect_vm_get_active();
+    effect_vm_output_t result = {0};
+
+    if (prog == NULL) {
+        return;  // Nothing uploaded yet: stay dark
+    }
+
+    // A new program starts with fresh variables
+    if (s->vm.serial != prog->serial) {
+        s->vm.serial = prog->serial;
+        memset(s->vm.vars, 0, sizeof(s->vm.vars));
+    }
+
+    effect_vm_input_t in = {
+        .t_us = t_us,
+        .speed = (int32_t)((p->speed * Q15_ONE) / 255),
+        .param = {
+            (int32_t)((p->r * Q15_ONE) / EFFECT_LUT_MAX_DUTY),
+            (int32_t)((p->g * Q15_ONE) / EFFECT_LUT_MAX_DUTY),
+            (int32_t)((p->b * Q15_ONE) / EFFECT_LUT_MAX_DUTY),
+            (int32_t)((p->w * Q15_ONE) / EFFECT_LUT_MAX_DUTY),
+        },
+    };
+    effect_vm_run(prog, s->vm.vars, &in, &result);
+
+    out->r = ((uint32_t)result.r * EFFECT_LUT_MAX_DUTY) >> 15;
+    out->g = ((uint32_t)result.g * EFFECT_LUT_MAX_DUTY) >> 15;
+    out->b = ((uint32_t)result.b * EFFECT_LUT_MAX_DUTY) >> 15;
+    out->w = ((uint32_t)result.w * EFFECT_LUT_MAX_DUTY) >> 15;
+    apply_brightness(out, p->brightness);
+}
+
+void effect_state_init(effect_state_t *state, light_effect_t type, uint32_t seed) {
+    memset(state, 0, sizeof(*state));
+    effect_rng_seed(&state->rng, seed);
+    if (type == EFFECT_CANDLE_FLICKER) {
+        state->candle.intensity = Q15_ONE;
+    }
+}
+
+bool effect_render(light_effect_t type, effect_state_t *state, const effect_config_t *params,
+                   int64_t t_us, effect_frame_t *out) {
+    // A set_effect() racing the frame clock can land just after the deadline
+    if (t_us < 0) {
+        t_us = 0;
+    }
+    uint32_t frame = (uint32_t)(t_us / EFFECT_FRAME_US);
+    uint32_t step = frame - state->frame;  // Frames since the previous render
+
+    state->frame = frame;
+    memset(out, 0, sizeof(*out));
+
+    switch (type) {
+        case EFFECT_OFF:
+            break;
+        case EFFECT_STATIC:
+            render_static(params, out);
+            break;
+        case EFFECT_SMOOTH_FADE:
+            render_smooth_fade(state, params, step, out);
+            break;
+        case EFFECT_RGB_CYCLE:
+            render_rgb_cycle(state, params, out);
+            break;
+        case EFFECT_BREATHING:
+            render_breathing(state, params, out);
+            break;
+        case EFFECT_TWINKLE_PULSE:
+            render_twinkle_pulse(state, params, out);
+            break;
+        case EFFECT_LIGHTNING_FLASH:
+            render_lightning_flash(state, params, step, out);
+            break;
+        case EFFECT_CANDLE_FLICKER:
+            render_candle_flicker(state, params, out);
+            break;
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+        case EFFECT_PULSE_WAVE:
+            render_pulse_wave(state, params, step, out);
+            break;
+        case EFFECT_SOFT_TRANSITION:
+            render_soft_transition(state, params, out);
+            break;
+#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
+        case EFFECT_PRECISION_FADE:
+            render_precision_fade(state, params, step, out);
+            break;
+        case EFFECT_FAST_STROBE:
+            render_fast_strobe(state, params, out);
+            break;
+#endif
+        case EFFECT_TIMELINE:
+            render_timeline(state, params, t_us, out);
+            break;
+        case EFFECT_USER_PROGRAM:
+            render_user_program(state, params, t_us, out);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static uint32_t blend_channel(uint32_t below, uint32_t layer, layer_blend_t mode) {
+    switch (mode) {
+        case LAYER_BLEND_ADD:
+            below += layer;
+            return below > EFFECT_LUT_MAX_DUTY ? EFFECT_LUT_MAX_DUTY : below;
+        case LAYER_BLEND_MAX:
+            return layer > below ? layer : below;
+        case LAYER_BLEND_MULTIPLY:
+            return (below * layer) / EFFECT_LUT_MAX_DUTY;
+        case LAYER_BLEND_ALPHA:
+        default:
+            return layer;
+    }
+}
+
+void effect_blend(effect_frame_t *dst, const effect_frame_t *src, layer_blend_t mode, uint8_t opacity) {
+    // Opacity fades between the layers below and the blended result
+    uint32_t t = ((uint32_t)opacity * Q15_ONE + 127) / 255;
+
+    dst->r = fx_lerp_q15(dst->r, blend_channel(dst->r, src->r, mode), t);
+    dst->g = fx_lerp_q15(dst->g, blend_channel(dst->g, src->g, mode), t);
+    dst->b = fx_lerp_q15(dst->b, blend_channel(dst->b, src->b, mode), t);
+    dst->w = fx_lerp_q15(dst->w, blend_channel(dst->w, src->w, mode), t);
+}
+
+void effect_composite(effect_frame_t *frame, const effect_layer_t layers[LIGHT_OVERLAY_LAYERS],
+                      effect_state_t states[LIGHT_OVERLAY_LAYERS], const effect_config_t *params,
+                      const int64_t t_us[LIGHT_OVERLAY_LAYERS], const effect_frame_t *stream) {
+    effect_frame_t scratch;
+
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        if (layers[i].type == EFFECT_OFF || layers[i].opacity == 0) {
+            continue;
+        }
+        if (layers[i].type == EFFECT_STREAM) {
+            if (stream != NULL) {
+                effect_blend(frame, stream, layers[i].blend, layers[i].opacity);
+            }
+        } else if (effect_render(layers[i].type, &states[i], params, t_us[i], &scratch)) {
+            effect_blend(frame, &scratch, layers[i].blend, layers[i].opacity);
+        }
+    }
+}
+
+// Keyframe generators: emit the next linear segment of an effect so that
+// the LEDC fade engine can interpolate it while the CPU sleeps.
+
+// HSV at full saturation is piecewise linear in RGB, so one keyframe per
+// hue sextant reproduces the software fade exactly.
+static bool keyframe_smooth_fade(const effect_state_t *s, const effect_config_t *p, effect_keyframe_t *kf) {
+    uint32_t step = p->speed * SMOOTH_FADE_STEP;
+    uint32_t hue = s->fade.hue;
+    uint32_t target_hue = hue;
+
+    if (step == 0) {
+        kf->frames = KEYFRAME_HOLD_FRAMES;
+    } else {
+        // Run to the end of the current sextant (rounded up so the hue
+        // table lands exactly on the sextant's first entry)
+        uint64_t sextant_end = ((((uint64_t)hue * 6 >> 32) + 1) * (1ULL << 32) + 5) / 6;
+        kf->frames = (uint32_t)((sextant_end - hue + step - 1) / step);
+        if (kf->frames == 0) kf->frames = 1;
+        target_hue = (uint32_t)sextant_end;
+    }
+
+    hue_to_rgb(target_hue, &kf->to);
+    kf->to.w = 0;
+    apply_brightness(&kf->to, p->brightness);
+    return true;
+}
+
+// Breathing is approximated by BREATHING_KEYFRAMES chords per sine period
+static bool keyframe_breathing(const effect_state_t *s, const effect_config_t *p, effect_keyframe_t *kf) {
+    uint32_t step = p->speed * BREATHING_STEP;
+
+    if (step == 0) {
+        kf->frames = KEYFRAME_HOLD_FRAMES;
+    } else {
+        kf->frames = (uint32_t)(((1ULL << 32) / BREATHING_KEYFRAMES + step / 2) / step);
+        if (kf->frames == 0) kf->frames = 1;
+    }
+
+    uint32_t breath = (fx_sin_q15((s->frame + kf->frames) * step) + Q15_ONE) >> 1;
+    kf->to.r = p->r; kf->to.g = p->g; kf->to.b = p->b; kf->to.w = p->w;
+    apply_brightness(&kf->to, (p->brightness * breath) >> 15);
+    return true;
+}
+
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+// The triangle wave is exactly two linear segments per period
+static bool keyframe_pulse_wave(const effect_state_t *s, const effect_config_t *p, effect_keyframe_t *kf) {
+    uint32_t step = p->speed * PULSE_WAVE_STEP;
+    uint32_t phase = s->wave.phase;
+    uint32_t intensity;
+
+    if (step == 0) {
+        kf->frames = KEYFRAME_HOLD_FRAMES;
+        intensity = pulse_wave_intensity(phase);
+    } else {
+        // Run to the next peak or trough
+        uint64_t corner = (phase < 0x80000000UL) ? 0x80000000ULL : (1ULL << 32);
+        kf->frames = (uint32_t)((corner - phase + step - 1) / step);
+        intensity = (corner == 0x80000000ULL) ? Q16_ONE : 0;
+    }
+
+    pulse_wave_frame(p, intensity, &kf->to);
+    return true;
+}
+#endif
+
+bool effect_follows_beat(light_effect_t type) {
+    switch (type) {
+        case EFFECT_RGB_CYCLE:
+        case EFFECT_BREATHING:
+#ifdef CONFIG_BOARD_ESP32C3_NO_OLED
+        case EFFECT_FAST_STROBE:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool effect_has_keyframes(light_effect_t type) {
+    switch (type) {
+        case EFFECT_SMOOTH_FADE:
+        case EFFECT_BREATHING:
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+        case EFFECT_PULSE_WAVE:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool effect_next_keyframe(light_effect_t type, const effect_state_t *state,
+                          const effect_config_t *params, effect_keyframe_t *kf) {
+    switch (type) {
+        case EFFECT_SMOOTH_FADE:
+            return keyframe_smooth_fade(state, params, kf);
+        case EFFECT_BREATHING:
+            return keyframe_breathing(state, params, kf);
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+        case EFFECT_PULSE_WAVE:
+            return keyframe_pulse_wave(state, params, kf);
+#endif
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef EFFECTS_RENDER_H
+#define EFFECTS_RENDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "light_effects.h"
+#include "effect_rng.h"
+
+// Effect renderers. Each effect is a pure function of its state, the
+// effect parameters and the effect time; it returns one frame and touches
+// no hardware, so effects can be rendered side by side or off-device.
+// Only the generated LUTs and the board selection are needed to build it.
+
+// Driver-specific frame period based on Kconfig
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+    // AL8860 optimized timings (slower, more stable)
+    #define EFFECT_UPDATE_INTERVAL_MS 50
+#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
+    // LM3414 optimized timings (faster, more precise)
+    #define EFFECT_UPDATE_INTERVAL_MS 20
+#else
+    #error "No board configuration selected. Please run 'idf.py menuconfig'"
+#endif
+
+#define EFFECT_FRAME_US       ((int64_t)EFFECT_UPDATE_INTERVAL_MS * 1000)
+
+// One output frame in logical levels (0..EFFECT_LUT_MAX_DUTY), before the
+// perceptual output stage
+typedef struct {
+    uint32_t r, g, b, w;
+} effect_frame_t;
+
+// Everything an effect remembers between frames
+typedef struct {
+    uint32_t frame;  // Frame index of the previous render
+    effect_rng_t rng;
+    union {
+        struct { uint32_t hue; } fade;                            // Smooth / precision fade
+        struct { uint32_t last_change; uint8_t color; } cycle;    // RGB cycle
+        struct { uint8_t r, g, b; } twinkle;
+        struct { uint32_t timer; bool in_flash; } lightning;
+        struct { int32_t intensity; } candle;                    // Flame intensity, Q15
+        struct { uint32_t phase; } wave;                          // Pulse wave, turns
+        struct { uint32_t start; uint8_t target; effect_frame_t current; } soft;
+        struct { uint32_t last_toggle; bool on; } strobe;
+        struct { uint32_t serial, index, start_ms, end_ms; } timeline;  // Playback cursor
+        struct { uint32_t serial; int32_t vars[8]; } vm;                 // User program variables
+    };
+} effect_state_t;
+
+// One hardware fade segment; frames is the effect time it covers
+typedef struct {
+    effect_frame_t to;
+    uint32_t frames;
+} effect_keyframe_t;
+
+// Reset the state to the start of the effect's timeline. Random effects
+// replay the same frames for the same seed.
+void effect_state_init(effect_state_t *state, light_effect_t type, uint32_t seed);
+
+// Advance the effect to t_us (time since the effect started) and render
+// that frame. Returns false for an unknown effect.
+bool effect_render(light_effect_t type, effect_state_t *state, const effect_config_t *params,
+                   int64_t t_us, effect_frame_t *out);
+
+// Blend a layer over dst, per channel, faded in by opacity (0-255)
+void effect_blend(effect_frame_t *dst, const effect_frame_t *src, layer_blend_t mode, uint8_t opacity);
+
+// Composite the overlay layers over frame, bottom to top. Each visible
+// layer renders at its own effect time t_us[i] into one scratch frame and
+// is blended in. The stream is not rendered here: a stream layer takes the
+// frame passed in, and is left out if that is NULL.
+void effect_composite(effect_frame_t *frame, const effect_layer_t layers[LIGHT_OVERLAY_LAYERS],
+                      effect_state_t states[LIGHT_OVERLAY_LAYERS], const effect_config_t *params,
+                      const int64_t t_us[LIGHT_OVERLAY_LAYERS], const effect_frame_t *stream);
+
+// True if the effect follows the tempo engine's beat grid while it runs
+bool effect_follows_beat(light_effect_t type);
+
+// True if the effect can be played as hardware fade keyframes
+bool effect_has_keyframes(light_effect_t type);
+
+// Next linear segment of the effect, starting from the state's current
+// frame. Returns false if the effect has to be rendered frame by frame.
+bool effect_next_keyframe(light_effect_t type, const effect_state_t *state,
+                          const effect_config_t *params, effect_keyframe_t *kf);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FIXED_MATH_H
+#define FIXED_MATH_H
+
+#include <stdint.h>
+#include "effect_luts.h"
+
+// Fixed-point helpers for the effects engine. The ESP32-C3 has no FPU, so
+// effect kernels stay in integer math:
+//   Q15   - fraction with 1.0 == 32768
+//   turns - uint32_t phase where 2^32 is one full turn (wraps for free)
+
+#define Q15_ONE             32768
+#define Q15(x)              ((int32_t)((x) * Q15_ONE + 0.5))
+
+// Float value per frame per speed unit, expressed as a turns increment
+#define TURNS_PER_SPEED(turns_per_frame_at_255) \
+    ((uint32_t)((turns_per_frame_at_255) / 255.0 * 4294967296.0 + 0.5))
+
+// Radians per frame per speed unit, expressed as a turns increment
+#define RAD_PER_SPEED(rad_per_frame_at_255) \
+    TURNS_PER_SPEED((rad_per_frame_at_255) / 6.283185307179586)
+
+// sin(2*pi*phase / 2^32) in Q15, linearly interpolated from the generated
+// 1024-entry table (max error ~5e-5)
+static inline int32_t fx_sin_q15(uint32_t phase)
+{
+    uint32_t index = phase >> (32 - EFFECT_SINE_BITS);
+    int32_t frac = (int32_t)((phase >> (17 - EFFECT_SINE_BITS)) & 0x7FFF);
+    int32_t a = effect_sine_q15[index];
+    int32_t b = effect_sine_q15[(index + 1) & (EFFECT_SINE_SIZE - 1)];
+
+    return a + (((b - a) * frac) >> 15);
+}
+
+// Hermite smoothstep p*p*(3 - 2p) on a Q15 progress value
+static inline uint32_t fx_smoothstep_q15(uint32_t p)
+{
+    if (p > Q15_ONE) {
+        p = Q15_ONE;
+    }
+    uint32_t p2 = (p * p) >> 15;
+    return (p2 * (3 * Q15_ONE - 2 * p)) >> 15;
+}
+
+// Linear interpolation from a to b by a Q15 fraction, signed-safe
+static inline uint32_t fx_lerp_q15(uint32_t a, uint32_t b, uint32_t t)
+{
+    return (uint32_t)((int64_t)a + (((int64_t)b - (int64_t)a) * (int64_t)t) / Q15_ONE);
+}
+
+#endif
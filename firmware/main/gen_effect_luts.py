@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Lookup table generator for the light effects engine
+Writes board-specific sine, hue and dimming tables at the driver's PWM resolution.
+Run by main/CMakeLists.txt at build time; the output lands in the build tree.
+"""
+
+import argparse
+import math
+import os
+
+SINE_BITS = 10                 # 1024-entry sine table
+HUE_STEPS_PER_SEXTANT = 256    # Same granularity as the 8-bit HSV kernel
+CIE_BITS = 8                   # 257-entry lightness curve, interpolated at runtime
+
+
+def sine_table():
+    """Full sine period in Q15, clamped to int16"""
+    size = 1 << SINE_BITS
+    return [min(32767, round(math.sin(2 * math.pi * k / size) * 32768)) for k in range(size)]
+
+
+def hue_table(max_duty):
+    """Fully saturated hue wheel at driver resolution, matching hsv_to_rgb() + scaling"""
+    table = []
+    for k in range(6 * HUE_STEPS_PER_SEXTANT):
+        sextant, step = divmod(k, HUE_STEPS_PER_SEXTANT)
+        v = 255
+        t = (step * 255) // HUE_STEPS_PER_SEXTANT
+        q = ((HUE_STEPS_PER_SEXTANT - step) * 255) // HUE_STEPS_PER_SEXTANT
+        p = 0
+        rgb = [(v, t, p), (q, v, p), (p, v, t), (p, q, v), (t, p, v), (v, p, q)][sextant]
+        table.append(tuple(c * max_duty // 255 for c in rgb))
+    return table
+
+
+def cie_table():
+    """CIE 1931 lightness: logical level (L*/100) to relative luminance Y in Q16 (65536 == 1.0)"""
+    size = 1 << CIE_BITS
+    table = []
+    for k in range(size + 1):
+        lightness = 100.0 * k / size
+        if lightness <= 8.0:
+            y = lightness / 903.3
+        else:
+            y = ((lightness + 16.0) / 116.0) ** 3
+        table.append(round(y * 65536))
+    return table
+
+
+def format_rows(values, per_line=12):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append("    " + ", ".join(values[i:i + per_line]) + ",")
+    return "\n".join(lines)
+
+
+def write_tables(output_dir, bits):
+    max_duty = (1 << bits) - 1
+    duty_type = "uint8_t" if bits <= 8 else "uint16_t"
+    sine = sine_table()
+    hue = hue_table(max_duty)
+    cie = cie_table()
+
+    header = f"""// Generated by gen_effect_luts.py for {bits}-bit PWM - do not edit
+#ifndef EFFECT_LUTS_H
+#define EFFECT_LUTS_H
+
+#include <stdint.h>
+
+#define EFFECT_LUT_MAX_DUTY   {max_duty}
+#define EFFECT_SINE_BITS      {SINE_BITS}
+#define EFFECT_SINE_SIZE      {len(sine)}
+#define EFFECT_HUE_STEPS      {len(hue)}
+#define EFFECT_CIE_BITS       {CIE_BITS}
+
+typedef {duty_type} effect_lut_duty_t;
+
+extern const int16_t effect_sine_q15[EFFECT_SINE_SIZE];
+extern const effect_lut_duty_t effect_hue_rgb[EFFECT_HUE_STEPS][3];
+extern const uint32_t effect_cie_q16[(1 << EFFECT_CIE_BITS) + 1];
+
+#endif
+"""
+
+    source = f"""// Generated by gen_effect_luts.py for {bits}-bit PWM - do not edit
+#include "effect_luts.h"
+
+const int16_t effect_sine_q15[EFFECT_SINE_SIZE] = {{
+{format_rows([str(v) for v in sine])}
+}};
+
+const effect_lut_duty_t effect_hue_rgb[EFFECT_HUE_STEPS][3] = {{
+{format_rows(["{%d, %d, %d}" % rgb for rgb in hue], per_line=6)}
+}};
+
+const uint32_t effect_cie_q16[(1 << EFFECT_CIE_BITS) + 1] = {{
+{format_rows([str(v) for v in cie])}
+}};
+"""
+
+    os.makedirs(output_dir, exist_ok=True)
+    with open(os.path.join(output_dir, "effect_luts.h"), "w") as f:
+        f.write(header)
+    with open(os.path.join(output_dir, "effect_luts.c"), "w") as f:
+        f.write(source)
+
+    duty_size = 1 if bits <= 8 else 2
+    flash_bytes = len(sine) * 2 + len(hue) * 3 * duty_size + len(cie) * 4
+    print(f"Effect LUTs: {bits}-bit, {flash_bytes} bytes of rodata")
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate lookup tables for the light effects engine')
+    parser.add_argument('--bits', type=int, required=True, choices=[8, 12],
+                        help='PWM duty resolution of the target board')
+    parser.add_argument('--output-dir', required=True,
+                        help='Directory for effect_luts.h and effect_luts.c')
+    args = parser.parse_args()
+
+    write_tables(args.output_dir, args.bits)
+
+
+if __name__ == "__main__":
+    main()
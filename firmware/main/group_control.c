@@ -0,0 +1,159 @@
+#include "group_control.h"
+#include "mbedtls/md.h"
+#include <string.h>
+
+static uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void write_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool group_key_parse(const char *hex, uint8_t key[GROUP_KEY_SIZE]) {
+    if (hex == NULL || strlen(hex) != GROUP_KEY_SIZE * 2) {
+        return false;
+    }
+    for (int i = 0; i < GROUP_KEY_SIZE; i++) {
+        int hi = hex_nibble(hex[2 * i]);
+        int lo = hex_nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        key[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return true;
+}
+
+// Truncated HMAC-SHA256 over the signed part of raw
+static bool packet_mac(const uint8_t key[GROUP_KEY_SIZE], const uint8_t *raw,
+                       uint8_t mac[GROUP_MAC_SIZE]) {
+    uint8_t digest[32];
+    const mbedtls_md_info_t *info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    if (info == NULL ||
+        mbedtls_md_hmac(info, key, GROUP_KEY_SIZE, raw + GROUP_SIGNED_OFFSET,
+                        GROUP_MAC_OFFSET - GROUP_SIGNED_OFFSET, digest) != 0) {
+        return false;
+    }
+    memcpy(mac, digest, GROUP_MAC_SIZE);
+    return true;
+}
+
+// Constant time, so a forger learns nothing from how long a reject takes
+static bool mac_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < GROUP_MAC_SIZE; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static void packet_decode(const uint8_t *raw, group_packet_t *out) {
+    out->group = read_u16(raw + 4);
+    out->seq = read_u32(raw + 6);
+    out->effect = raw[10];
+    out->brightness = raw[11];
+    out->r = raw[12];
+    out->g = raw[13];
+    out->b = raw[14];
+    out->w = raw[15];
+    out->speed = raw[16];
+    out->transition = raw[17];
+    memcpy(out->raw, raw, GROUP_PACKET_SIZE);
+}
+
+bool group_packet_find(const uint8_t *adv, uint8_t len, group_packet_t *out) {
+    uint8_t pos = 0;
+
+    // AD structures: length (type + data), type, data. A zero length ends
+    // the significant part of the packet.
+    while (pos < len) {
+        uint8_t field_len = adv[pos];
+        if (field_len == 0 || field_len > len - pos - 1) {
+            return false;
+        }
+        const uint8_t *field = adv + pos + 1;
+        if (field[0] == 0xFF && field_len - 1 == GROUP_PACKET_SIZE) {
+            const uint8_t *raw = field + 1;
+            if (read_u16(raw) == GROUP_COMPANY_ID && raw[2] == GROUP_MAGIC &&
+                raw[3] == GROUP_VERSION) {
+                packet_decode(raw, out);
+                return true;
+            }
+        }
+        pos += field_len + 1;
+    }
+    return false;
+}
+
+group_verdict_t group_control_check(group_ctx_t *ctx, const group_packet_t *pkt) {
+    // Broadcasters repeat each command for a while so every fixture hears
+    // it; the copies are byte for byte the last one we accepted.
+    if (ctx->have_seq && memcmp(pkt->raw, ctx->last_raw, GROUP_PACKET_SIZE) == 0) {
+        ctx->stats.duplicates++;
+        return GROUP_DUPLICATE;
+    }
+
+    uint8_t mac[GROUP_MAC_SIZE];
+    if (!packet_mac(ctx->key, pkt->raw, mac) || !mac_equal(mac, pkt->raw + GROUP_MAC_OFFSET)) {
+        ctx->stats.bad_mac++;
+        return GROUP_BAD_MAC;
+    }
+
+    // Serial number arithmetic, so the sequence may wrap after 2^31 commands
+    if (ctx->have_seq && (int32_t)(pkt->seq - ctx->last_seq) <= 0) {
+        ctx->stats.replays++;
+        return GROUP_REPLAY;
+    }
+
+    ctx->have_seq = true;
+    ctx->last_seq = pkt->seq;
+    memcpy(ctx->last_raw, pkt->raw, GROUP_PACKET_SIZE);
+
+    if (pkt->group != ctx->group && pkt->group != GROUP_ALL) {
+        ctx->stats.other_group++;
+        return GROUP_OTHER_GROUP;
+    }
+    ctx->stats.applied++;
+    return GROUP_APPLY;
+}
+
+void group_packet_sign(const uint8_t key[GROUP_KEY_SIZE], group_packet_t *pkt) {
+    uint8_t *raw = pkt->raw;
+
+    write_u16(raw, GROUP_COMPANY_ID);
+    raw[2] = GROUP_MAGIC;
+    raw[3] = GROUP_VERSION;
+    write_u16(raw + 4, pkt->group);
+    write_u32(raw + 6, pkt->seq);
+    raw[10] = pkt->effect;
+    raw[11] = pkt->brightness;
+    raw[12] = pkt->r;
+    raw[13] = pkt->g;
+    raw[14] = pkt->b;
+    raw[15] = pkt->w;
+    raw[16] = pkt->speed;
+    raw[17] = pkt->transition;
+
+    if (!packet_mac(key, raw, raw + GROUP_MAC_OFFSET)) {
+        memset(raw + GROUP_MAC_OFFSET, 0, GROUP_MAC_SIZE);
+    }
+}
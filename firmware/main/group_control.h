@@ -0,0 +1,90 @@
+#ifndef GROUP_CONTROL_H
+#define GROUP_CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Connectionless group commands: a broadcaster puts a signed state in the
+// manufacturer data of an advertising packet, and every fixture in range
+// that is scanning applies it. One advertising burst retargets a whole
+// fleet without a single GATT connection.
+//
+// Manufacturer data, 26 bytes, multi-byte fields little-endian:
+//   company:u16 (0xFFFF)  magic 'G'  version
+//   group:u16  seq:u32
+//   effect brightness r g b w speed transition   (8-bit values, transition
+//                                                 in 100 ms units)
+//   mac[8]    first 8 bytes of HMAC-SHA256(key, magic .. transition)
+//
+// Sequence numbers are per key, shared by all groups, and must increase
+// with every new command. Several broadcasters sharing a key should use
+// something like (unix seconds << 8 | counter). A fixture applies a command
+// only if its MAC verifies and its sequence is newer than anything seen
+// with that key, so neither forged nor recorded packets do anything.
+// Repeats of the last command, as sent in a burst, are dropped before the
+// MAC is checked.
+//
+// This module is pure: no BLE, no NVS, no clock. The BLE server feeds it
+// advertising data and persists the sequence.
+
+#define GROUP_COMPANY_ID        0xFFFF
+#define GROUP_MAGIC             'G'
+#define GROUP_VERSION           1
+#define GROUP_ALL               0xFFFF  // Addressed to every group
+#define GROUP_KEY_SIZE          32
+#define GROUP_MAC_SIZE          8
+#define GROUP_PACKET_SIZE       26      // Manufacturer data, company ID included
+#define GROUP_SIGNED_OFFSET     2       // MAC covers magic .. transition
+#define GROUP_MAC_OFFSET        (GROUP_PACKET_SIZE - GROUP_MAC_SIZE)
+
+typedef struct {
+    uint16_t group;
+    uint32_t seq;
+    uint8_t effect;
+    uint8_t brightness;
+    uint8_t r, g, b, w;
+    uint8_t speed;
+    uint8_t transition;                 // 100 ms units
+    uint8_t raw[GROUP_PACKET_SIZE];     // As received, or as built by group_packet_sign()
+} group_packet_t;
+
+typedef enum {
+    GROUP_APPLY = 0,                    // New command for this fixture
+    GROUP_OTHER_GROUP,                  // Valid and new, but for another group
+    GROUP_DUPLICATE,                    // Repeat of the last command
+    GROUP_REPLAY,                       // Sequence not newer than the last one
+    GROUP_BAD_MAC,
+} group_verdict_t;
+
+typedef struct {
+    uint32_t applied;
+    uint32_t other_group;
+    uint32_t duplicates;
+    uint32_t replays;
+    uint32_t bad_mac;
+} group_stats_t;
+
+typedef struct {
+    uint8_t key[GROUP_KEY_SIZE];
+    uint16_t group;                     // This fixture's group
+    bool have_seq;                      // false until the first valid command
+    uint32_t last_seq;
+    uint8_t last_raw[GROUP_PACKET_SIZE];
+    group_stats_t stats;
+} group_ctx_t;
+
+// Parse a 64-character hex key. Returns false if it is malformed.
+bool group_key_parse(const char *hex, uint8_t key[GROUP_KEY_SIZE]);
+
+// Find a group command in raw advertising data (AD structures)
+bool group_packet_find(const uint8_t *adv, uint8_t len, group_packet_t *out);
+
+// Decide what to do with a parsed packet. Valid packets with a newer
+// sequence move ctx->last_seq forward, whichever group they address.
+group_verdict_t group_control_check(group_ctx_t *ctx, const group_packet_t *pkt);
+
+// Build raw (header, fields and MAC) from the fields of pkt, for
+// broadcasters and recorded test packets
+void group_packet_sign(const uint8_t key[GROUP_KEY_SIZE], group_packet_t *pkt);
+
+#endif
@@ -1,445 +1,840 @@
 #include "light_effects.h"
+#include "effects_render.h"
+#include "dimming.h"
+#include "stream_buffer.h"
 #include "pwm_control.h"
+#include "effect_luts.h"
+#include "fixed_math.h"
+#include "tempo_pll.h"
+#include "seqlock.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "sdkconfig.h"
-#include <math.h>
-#include <stdlib.h>
+#include <string.h>
 
 static const char *TAG = "LIGHT_EFFECTS";
 
-// Effect configuration
-static effect_config_t config = {
-    .type = EFFECT_SMOOTH_FADE,
-    .brightness = 128,  // Start with 8-bit value, will be converted during init
-    .speed = 50,
-    .r = 255, .g = 0, .b = 0, .w = 0,  // Start with 8-bit values
-    .enabled = true,
-    .max_duty = 255  // Will be set correctly during init
+// Published effect state. Setters run on the BLE host task and publish
+// whole updates under a sequence lock; effects_task copies a consistent
+// snapshot once per frame without blocking.
+typedef struct {
+    effect_config_t config;
+    bool manual_mode;
+    uint32_t generation;  // Bumped by light_effects_set_effect() to restart the effect
+    int64_t epoch_us;     // Effect time zero, esp_timer clock
+    effect_layer_t layers[LIGHT_OVERLAY_LAYERS];
+    int64_t layer_epoch_us[LIGHT_OVERLAY_LAYERS];  // Moves when a layer's effect changes
+    clock_sync_model_t clock;                      // Local to shared effect clock
+} effect_shared_t;
+
+static effect_shared_t shared = {
+    .config = {
+        .type = EFFECT_SMOOTH_FADE,
+        .brightness = 128,  // Start with 8-bit value, will be converted during init
+        .speed = 50,
+        .r = 255, .g = 0, .b = 0, .w = 0,  // Start with 8-bit values
+        .enabled = true,
+        .max_duty = 255,  // Will be set correctly during init
+        .transition_ms = 0  // Hard cut until the app asks for a crossfade
+    },
 };
+static uint32_t shared_seq = 0;  // Odd while a writer is publishing
+static portMUX_TYPE shared_write_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// effects_task's snapshot of the published state, read by the renderers
+static effect_config_t config;
+static bool manual_mode = false;
+static uint32_t config_generation = 0;
+static clock_sync_model_t shared_clock;
+static clock_sync_effect_t shared_effect;  // Shared effect time, unwrapped here
 
 // Effect state variables
 static TaskHandle_t effects_task_handle = NULL;
 static bool ble_connected = false;
-static bool manual_mode = false;
-static uint32_t effect_counter = 0;
-static float hue = 0.0f;
-static uint8_t rgb_cycle_state = 0;  // For RGB cycle effect
-
-// Driver-specific timing constants based on Kconfig
-#ifdef CONFIG_BOARD_ESP32C3_OLED
-    // AL8860 optimized timings (slower, more stable)
-    #define EFFECT_UPDATE_INTERVAL_MS 50
-    #define FAST_EFFECT_DIVISOR 8
-    #define SMOOTH_FADE_SPEED_MULT 0.001f
-#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
-    // LM3414 optimized timings (faster, more precise)
-    #define EFFECT_UPDATE_INTERVAL_MS 20
-    #define FAST_EFFECT_DIVISOR 4
-    #define SMOOTH_FADE_SPEED_MULT 0.002f
-#else
-    #error "No board configuration selected. Please run 'idf.py menuconfig'"
-#endif
+static effect_state_t effect_state;  // Render state of the running effect
+
+// Crossfade: the outgoing effect keeps rendering on its own timeline and
+// is blended out under the incoming one
+static struct {
+    bool active;
+    light_effect_t type;
+    effect_state_t state;
+    int64_t epoch_us;   // Outgoing effect's time zero
+    int64_t start_us;   // Crossfade start, the incoming effect's time zero
+    int64_t length_us;
+} transition = {0};
+
+// Overlay layers as of the last snapshot, each with its own effect timeline
+static effect_layer_t layers[LIGHT_OVERLAY_LAYERS];
+static int64_t layer_epoch_us[LIGHT_OVERLAY_LAYERS];
+static effect_state_t layer_state[LIGHT_OVERLAY_LAYERS];
+static bool layers_active = false;    // At least one layer is visible
+static bool layers_animated = false;  // ...and one of them moves on its own
+
+// Manual color changed since it was last written to the channels
+static bool manual_dirty = false;
+
+// State listeners, added at startup, and the last state handed to them
+static light_state_listener_t state_listeners[LIGHT_STATE_LISTENERS];
+static uint32_t state_listener_count = 0;
+static light_state_t published_state;
 
-// Helper function to convert HSV to RGB
-static void hsv_to_rgb(float h, float s, float v, uint8_t *r, uint8_t *g, uint8_t *b) {
-    int i = (int)(h * 6.0f);
-    float f = (h * 6.0f) - i;
-    float p = v * (1.0f - s);
-    float q = v * (1.0f - f * s);
-    float t = v * (1.0f - (1.0f - f) * s);
+// BLE commands. The NimBLE host task is the only producer and effects_task
+// the only consumer, so the ring needs no lock: each side owns one index.
+#define COMMAND_QUEUE_LEN     32   // Power of two
+static light_command_t command_queue[COMMAND_QUEUE_LEN];
+static uint32_t command_head = 0;  // Written by the producer
+static uint32_t command_tail = 0;  // Written by the consumer
+static light_command_stats_t command_stats = {0};
+static int64_t command_posted_us[COMMAND_QUEUE_LEN];  // Post time per slot
 
-    switch (i % 6) {
-        case 0: *r = v * 255; *g = t * 255; *b = p * 255; break;
-        case 1: *r = q * 255; *g = v * 255; *b = p * 255; break;
-        case 2: *r = p * 255; *g = v * 255; *b = t * 255; break;
-        case 3: *r = p * 255; *g = q * 255; *b = v * 255; break;
-        case 4: *r = t * 255; *g = p * 255; *b = v * 255; break;
-        case 5: *r = v * 255; *g = p * 255; *b = q * 255; break;
+// Oldest command applied but not yet on the LEDs, 0 if none
+static int64_t latency_since_us = 0;
+static uint64_t latency_total_us = 0;
+static light_latency_stats_t latency_stats = {0};
+
+// Latest value per parameter from one drain of the queue
+static struct {
+    uint32_t pending;                            // Bit per light_command_type_t
+    light_command_t latest[LIGHT_CMD_MAX];
+    uint8_t channels;                            // Bit per pwm_channel_t
+    uint32_t channel_duty[PWM_CHANNEL_MAX];
+    uint8_t layers;                              // Bit per overlay layer
+    effect_layer_t layer[LIGHT_OVERLAY_LAYERS];
+} batch;
+
+// Beat grid, owned by effects_task: tempo commands arrive through the
+// command ring and the renderers read it through config. Beats are shown
+// tempo_lead_us early to make up for the delivery delay the sender clock
+// mapping cannot see.
+static tempo_pll_t tempo;
+static int64_t tempo_lead_us = CONFIG_LIGHT_TEMPO_LEAD_MS * 1000;
+static uint32_t tempo_beats = 0;
+
+// Streamed frames: BLE host task in, effects task out (stream_buffer.h)
+static stream_buffer_t stream = {
+    .stats.latency_ms = CONFIG_LIGHT_STREAM_LATENCY_MS,
+};
+
+// Task notification bits for effects_task
+#define EFFECTS_NOTIFY_CONFIG      (1U << 0)  // Configuration changed
+#define EFFECTS_NOTIFY_FADE_DONE   (1U << 1)  // Hardware fade segment finished
+#define EFFECTS_NOTIFY_FRAME       (1U << 2)  // Frame clock tick
+
+// CPU wakeup accounting, reported when the effect changes
+static uint32_t effect_wakeups = 0;
+static int64_t effect_epoch_us = 0;  // Effect time zero, esp_timer clock
+
+// Wake the effects task so a running keyframe picks up the new settings.
+// Commands applied by the task itself are picked up without a wakeup.
+static void notify_config_changed(void) {
+    if (effects_task_handle != NULL && xTaskGetCurrentTaskHandle() != effects_task_handle) {
+        xTaskNotify(effects_task_handle, EFFECTS_NOTIFY_CONFIG, eSetBits);
     }
 }
 
-// Apply brightness scaling with proper resolution scaling
-static void apply_brightness(uint32_t *r, uint32_t *g, uint32_t *b, uint32_t *w, uint32_t brightness) {
-    uint32_t max_duty = config.max_duty;
-    
-    // Apply brightness scaling (brightness is already in driver resolution)
-    *r = (*r * brightness) / max_duty;
-    *g = (*g * brightness) / max_duty;
-    *b = (*b * brightness) / max_duty;
-    *w = (*w * brightness) / max_duty;
+// Start publishing an update. Writers are serialized by the critical
+// section; readers retry while the sequence is odd or has moved.
+static effect_shared_t *shared_write_begin(void) {
+    portENTER_CRITICAL(&shared_write_mux);
+    seqlock_write_begin(&shared_seq);
+    return &shared;
 }
 
-// Scale color values to driver resolution
-static uint32_t scale_to_driver_resolution(uint8_t color_8bit) {
-    return (color_8bit * config.max_duty) / 255;
+static void shared_write_end(void) {
+    seqlock_write_end(&shared_seq);
+    portEXIT_CRITICAL(&shared_write_mux);
+    notify_config_changed();
 }
 
-// Smooth fade effect (default)
-static void effect_smooth_fade(void) {
-    uint8_t r, g, b;
-    uint32_t scaled_r, scaled_g, scaled_b, scaled_w = 0;
-    
-    // Smooth hue transition with driver-optimized speed
-    hue += (config.speed / 255.0f) * SMOOTH_FADE_SPEED_MULT;
-    if (hue >= 1.0f) hue = 0.0f;
-    
-    hsv_to_rgb(hue, 1.0f, 1.0f, &r, &g, &b);
-    
-    // Scale to driver resolution
-    scaled_r = scale_to_driver_resolution(r);
-    scaled_g = scale_to_driver_resolution(g);
-    scaled_b = scale_to_driver_resolution(b);
-    
-    apply_brightness(&scaled_r, &scaled_g, &scaled_b, &scaled_w, config.brightness);
-    
-    pwm_set_rgbw(scaled_r, scaled_g, scaled_b, scaled_w);
+// Copy out a consistent snapshot of the published state
+static void shared_read(effect_shared_t *out) {
+    uint32_t seq;
+    do {
+        seq = seqlock_read_begin(&shared_seq);
+        *out = shared;
+    } while (seqlock_read_retry(&shared_seq, seq));
 }
 
-// RGB cycle effect (hard transitions between colors)
-static void effect_rgb_cycle(void) {
-    static uint32_t last_change = 0;
-    uint32_t r = 0, g = 0, b = 0, w = 0;
-    
-    // Calculate delay based on speed
-    uint32_t delay_ticks = (255 - config.speed) * 2 + 50;
-    
-    if (effect_counter - last_change >= delay_ticks) {
-        rgb_cycle_state = (rgb_cycle_state + 1) % 7;
-        last_change = effect_counter;
+// Frame clock. A periodic esp_timer wakes the task; frame n is due at
+// clock origin + n * EFFECT_FRAME_US, so render cost and scheduling latency
+// never accumulate into drift.
+#define JITTER_BUCKET_US      100
+#define JITTER_BUCKETS        128   // 12.8 ms range, later wakeups land in the last bucket
+
+static esp_timer_handle_t frame_timer = NULL;
+static bool frame_clock_running = false;
+static int64_t next_deadline_us = 0;
+static uint32_t frames_rendered = 0;
+static uint32_t missed_deadlines = 0;
+static uint32_t jitter_histogram[JITTER_BUCKETS] = {0};
+static uint32_t jitter_max_us = 0;
+
+#ifdef CONFIG_LIGHT_EFFECTS_PROFILE
+// Per-effect render cost in CPU cycles, logged every PROFILE_REPORT_FRAMES
+#define PROFILE_REPORT_FRAMES 500
+static uint64_t profile_cycles[EFFECT_MAX] = {0};
+static uint32_t profile_frames[EFFECT_MAX] = {0};
+
+static void profile_record(light_effect_t effect, uint32_t cycles) {
+    if (effect >= EFFECT_MAX) {
+        return;
     }
-    
-    // Set colors based on cycle state, scale to driver resolution
-    switch (rgb_cycle_state) {
-        case 0: r = config.brightness; break;  // Red
-        case 1: g = config.brightness; break;  // Green  
-        case 2: b = config.brightness; break;  // Blue
-        case 3: r = config.brightness; g = config.brightness; break;  // Yellow
-        case 4: r = config.brightness; b = config.brightness; break;  // Magenta
-        case 5: g = config.brightness; b = config.brightness; break;  // Cyan
-        case 6: r = config.brightness; g = config.brightness; b = config.brightness; break;  // White
+    profile_cycles[effect] += cycles;
+    if (++profile_frames[effect] >= PROFILE_REPORT_FRAMES) {
+        ESP_LOGI(TAG, "Effect %d: %lu cycles/frame (avg over %d frames)", effect,
+                 (unsigned long)(profile_cycles[effect] / profile_frames[effect]), PROFILE_REPORT_FRAMES);
+        profile_cycles[effect] = 0;
+        profile_frames[effect] = 0;
     }
-    
-    pwm_set_rgbw(r, g, b, w);
 }
+#endif
 
-// Breathing effect
-static void effect_breathing(void) {
-    uint32_t r = config.r, g = config.g, b = config.b, w = config.w;
-    
-    // Sine wave breathing
-    float breath = (sin(effect_counter * (config.speed / 255.0f) * 0.02f) + 1.0f) / 2.0f;
-    uint32_t brightness = (uint32_t)(config.brightness * breath);
-    
-    apply_brightness(&r, &g, &b, &w, brightness);
-    pwm_set_rgbw(r, g, b, w);
+// Tempo events are timestamps, not settings: each one is fed to the PLL in
+// order instead of being coalesced with the rest of the batch.
+static void command_tempo(const light_command_t *cmd) {
+    switch (cmd->tempo.op) {
+        case LIGHT_TEMPO_BPM:
+            tempo_pll_set_bpm(&tempo, cmd->tempo.value, cmd->tempo.arrival_us);
+            ESP_LOGI(TAG, "Tempo set to: %lu.%02lu BPM", (unsigned long)(cmd->tempo.value / 100),
+                     (unsigned long)(cmd->tempo.value % 100));
+            break;
+        case LIGHT_TEMPO_BEAT:
+            tempo_pll_beat(&tempo, cmd->tempo.value, cmd->tempo.arrival_us);
+            tempo_beats++;
+            break;
+        case LIGHT_TEMPO_LEAD:
+            tempo_lead_us = (int64_t)(int32_t)cmd->tempo.value * 1000;
+            ESP_LOGI(TAG, "Tempo lead set to: %ld ms", (long)(int32_t)cmd->tempo.value);
+            break;
+    }
 }
 
-// Twinkle pulse effect
-static void effect_twinkle_pulse(void) {
-    static uint8_t last_r = 0, last_g = 0, last_b = 0;
-    uint8_t r, g, b;
-    uint32_t scaled_r, scaled_g, scaled_b, scaled_w = 0;
-    
-    // Random color changes
-    if ((effect_counter % (256 - config.speed)) == 0) {
-        hsv_to_rgb((float)rand() / RAND_MAX, 0.8f, 1.0f, &r, &g, &b);
-        last_r = r; last_g = g; last_b = b;
-    } else {
-        r = last_r; g = last_g; b = last_b;
+static void command_supersede(uint32_t types) {
+    command_stats.coalesced += __builtin_popcount(batch.pending & types);
+    batch.pending &= ~types;
+}
+
+// Fold one command into the batch, keeping only the newest value of each
+// parameter. Commands that a later one makes moot are dropped as coalesced.
+static void command_collect(const light_command_t *cmd) {
+    uint32_t bit = 1U << cmd->type;
+
+    switch (cmd->type) {
+        case LIGHT_CMD_STATE:
+            command_supersede((1U << LIGHT_CMD_STATE) | (1U << LIGHT_CMD_EFFECT) |
+                              (1U << LIGHT_CMD_BRIGHTNESS) | (1U << LIGHT_CMD_SPEED) |
+                              (1U << LIGHT_CMD_TRANSITION));
+            command_stats.coalesced += __builtin_popcount(batch.channels);
+            batch.channels = 0;
+            break;
+        case LIGHT_CMD_CHANNEL:
+            if (cmd->channel.channel >= PWM_CHANNEL_MAX) {
+                return;
+            }
+            command_supersede(1U << LIGHT_CMD_EFFECT);  // The channel write selects static
+            if (batch.channels & (1U << cmd->channel.channel)) {
+                command_stats.coalesced++;
+            }
+            batch.channels |= 1U << cmd->channel.channel;
+            batch.channel_duty[cmd->channel.channel] = cmd->channel.duty;
+            return;
+        case LIGHT_CMD_LAYER:
+            if (cmd->layer.index >= LIGHT_OVERLAY_LAYERS) {
+                return;
+            }
+            if (batch.layers & (1U << cmd->layer.index)) {
+                command_stats.coalesced++;
+            }
+            batch.layers |= 1U << cmd->layer.index;
+            batch.layer[cmd->layer.index] = cmd->layer.layer;
+            return;
+        case LIGHT_CMD_TEMPO:
+            command_tempo(cmd);
+            return;
+        default:
+            command_supersede(bit);
+            break;
     }
-    
-    // Scale to driver resolution
-    scaled_r = scale_to_driver_resolution(r);
-    scaled_g = scale_to_driver_resolution(g);
-    scaled_b = scale_to_driver_resolution(b);
-    
-    // Apply low brightness with occasional flickers
-    uint32_t flicker_brightness = config.brightness / 4;
-    if ((effect_counter % 50) == 0 && (rand() % 10) == 0) {
-        flicker_brightness = config.brightness / 2;
+    batch.pending |= bit;
+    batch.latest[cmd->type] = *cmd;
+}
+
+// Manual channel writes: static effect, manual mode, new color in one publish
+static void command_apply_channels(void) {
+    effect_shared_t *w = shared_write_begin();
+    uint32_t *color[PWM_CHANNEL_MAX] = {&w->config.r, &w->config.g, &w->config.b, &w->config.w};
+
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        if (batch.channels & (1U << i)) {
+            *color[i] = (batch.channel_duty[i] > PWM_MAX_DUTY) ? PWM_MAX_DUTY : batch.channel_duty[i];
+        }
     }
-    
-    apply_brightness(&scaled_r, &scaled_g, &scaled_b, &scaled_w, flicker_brightness);
-    pwm_set_rgbw(scaled_r, scaled_g, scaled_b, scaled_w);
+    if (w->config.type != EFFECT_STATIC) {
+        w->config.type = EFFECT_STATIC;
+        w->epoch_us = esp_timer_get_time();
+        w->generation++;
+    }
+    w->manual_mode = true;
+    shared_write_end();
+    ESP_LOGI(TAG, "Manual color: R=%lu, G=%lu, B=%lu, W=%lu", (unsigned long)*color[0],
+             (unsigned long)*color[1], (unsigned long)*color[2], (unsigned long)*color[3]);
 }
 
-// Lightning flash effect
-static void effect_lightning_flash(void) {
-    static uint32_t flash_timer = 0;
-    static bool in_flash = false;
-    uint32_t r = 0, g = 0, b = 0, w = 0;
-    
-    flash_timer++;
-    
-    if (!in_flash) {
-        // Random lightning strikes
-        if ((flash_timer > (500 - config.speed * 2)) && (rand() % 100) == 0) {
-            in_flash = true;
-            flash_timer = 0;
+// Apply the batch in a fixed order. A state command cleared everything
+// queued before it and a channel write cleared earlier effect writes, so
+// whatever is left here arrived after the command it is applied after.
+static void command_apply(void) {
+    if (batch.pending & (1U << LIGHT_CMD_STATE)) {
+        light_effects_apply(&batch.latest[LIGHT_CMD_STATE].state);
+    }
+    if (batch.channels) {
+        command_apply_channels();
+    }
+    if (batch.pending & (1U << LIGHT_CMD_EFFECT)) {
+        light_effect_t effect = batch.latest[LIGHT_CMD_EFFECT].effect;
+        light_effects_set_effect(effect);
+        if (effect != EFFECT_STATIC && effect != EFFECT_OFF) {
+            light_effects_disable_manual_mode();
+        } else {
+            light_effects_enable_manual_mode();
         }
-    } else {
-        // Lightning flash sequence
-        if (flash_timer < 3) {
-            // Bright white flash
-            w = config.brightness;
-            r = config.brightness / 2;  // Cool white
-        } else if (flash_timer < 6) {
-            // Quick dim
-            w = config.brightness / 4;
-        } else if (flash_timer < 8) {
-            // Second flash
-            w = config.brightness * 3 / 4;
+    }
+    if (batch.pending & (1U << LIGHT_CMD_BRIGHTNESS)) {
+        light_effects_set_brightness(batch.latest[LIGHT_CMD_BRIGHTNESS].value);
+    }
+    if (batch.pending & (1U << LIGHT_CMD_SPEED)) {
+        light_effects_set_speed((uint8_t)batch.latest[LIGHT_CMD_SPEED].value);
+    }
+    if (batch.pending & (1U << LIGHT_CMD_TRANSITION)) {
+        light_effects_set_transition(batch.latest[LIGHT_CMD_TRANSITION].value);
+    }
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        if (batch.layers & (1U << i)) {
+            light_effects_set_layer(i, batch.layer[i].type, batch.layer[i].opacity, batch.layer[i].blend);
+        }
+    }
+
+    batch.pending = 0;
+    batch.channels = 0;
+    batch.layers = 0;
+}
+
+// Take everything queued since the last frame and apply it once
+static void commands_drain(void) {
+    uint32_t tail = command_tail;
+    uint32_t head = __atomic_load_n(&command_head, __ATOMIC_ACQUIRE);
+
+    if (tail == head) {
+        return;
+    }
+    if (latency_since_us == 0) {
+        latency_since_us = command_posted_us[tail % COMMAND_QUEUE_LEN];
+    }
+    while (tail != head) {
+        command_collect(&command_queue[tail % COMMAND_QUEUE_LEN]);
+        tail++;
+    }
+    __atomic_store_n(&command_tail, tail, __ATOMIC_RELEASE);
+    command_apply();
+}
+
+// Called right after the LEDs were updated
+static void latency_record(void) {
+    if (latency_since_us == 0) {
+        return;
+    }
+    uint32_t latency_us = (uint32_t)(esp_timer_get_time() - latency_since_us);
+    latency_since_us = 0;
+
+    latency_stats.samples++;
+    latency_stats.last_us = latency_us;
+    latency_total_us += latency_us;
+    latency_stats.avg_us = (uint32_t)(latency_total_us / latency_stats.samples);
+    if (latency_us > latency_stats.max_us) {
+        latency_stats.max_us = latency_us;
+    }
+}
+
+// Take the snapshot the next frame renders from, after applying queued
+// commands. A new generation means light_effects_set_effect() was called:
+// restart the effect's timeline.
+static void config_refresh(void) {
+    effect_shared_t snap;
+    light_effect_t outgoing = config.type;
+
+    commands_drain();
+    shared_read(&snap);
+
+    if (snap.manual_mode && (!manual_mode || snap.config.r != config.r || snap.config.g != config.g ||
+                             snap.config.b != config.b || snap.config.w != config.w)) {
+        manual_dirty = true;
+    }
+    config = snap.config;
+    manual_mode = snap.manual_mode;
+    shared_clock = snap.clock;
+    if (snap.generation != config_generation) {
+        config_generation = snap.generation;
+        if (config.transition_ms > 0) {
+            transition.active = true;
+            transition.type = outgoing;
+            transition.state = effect_state;
+            transition.epoch_us = effect_epoch_us;
+            transition.start_us = snap.epoch_us;
+            transition.length_us = (int64_t)config.transition_ms * 1000;
         } else {
-            // Reset
-            in_flash = false;
-            flash_timer = 0;
+            transition.active = false;
+        }
+        effect_epoch_us = snap.epoch_us;
+        effect_wakeups = 0;
+        effect_state_init(&effect_state, config.type, config.seed);  // Reset effect state
+        if (config.type == EFFECT_STREAM) {
+            stream_buffer_restart(&stream);  // Start from black, not from the last stream's frame
         }
     }
-    
-    pwm_set_rgbw(r, g, b, w);
+
+    bool was_active = layers_active;
+    layers_active = false;
+    layers_animated = false;
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        layers[i] = snap.layers[i];
+        if (snap.layer_epoch_us[i] != layer_epoch_us[i]) {
+            layer_epoch_us[i] = snap.layer_epoch_us[i];
+            effect_state_init(&layer_state[i], layers[i].type, config.seed + i + 1);
+        }
+        if (layers[i].type != EFFECT_OFF && layers[i].opacity > 0) {
+            layers_active = true;
+            layers_animated |= (layers[i].type != EFFECT_STATIC);
+        }
+    }
+    if (was_active && !layers_active) {
+        manual_dirty = true;  // Hand the channels back to the manual color
+    }
 }
 
-// Candle flicker effect
-static void effect_candle_flicker(void) {
-    static float flame_intensity = 1.0f;
-    uint32_t r, g, b, w;
-    
-    // Random flame flicker
-    flame_intensity += (((float)rand() / RAND_MAX) - 0.5f) * 0.1f;
-    if (flame_intensity < 0.3f) flame_intensity = 0.3f;
-    if (flame_intensity > 1.0f) flame_intensity = 1.0f;
-    
-    // Warm candle colors scaled to driver resolution
-    float base_intensity = 0.7f + 0.3f * flame_intensity;
-    r = (uint32_t)(config.brightness * base_intensity);
-    g = (uint32_t)(config.brightness * base_intensity * 0.4f);
-    b = 0;
-    w = (uint32_t)(config.brightness * base_intensity * 0.8f);
-    
-    pwm_set_rgbw(r, g, b, w);
+static void frame_clock_tick(void *arg) {
+    xTaskNotify(effects_task_handle, EFFECTS_NOTIFY_FRAME, eSetBits);
 }
 
-// Board-specific effects based on Kconfig
-#ifdef CONFIG_BOARD_ESP32C3_OLED
-// AL8860 specific effects
+static void frame_clock_start(void) {
+    if (frame_clock_running) {
+        return;
+    }
+    // Read before arming so the first deadline never trails the real alarm
+    next_deadline_us = esp_timer_get_time() + EFFECT_FRAME_US;
+    ESP_ERROR_CHECK(esp_timer_start_periodic(frame_timer, EFFECT_FRAME_US));
+    frame_clock_running = true;
+}
 
-// Pulse wave effect - optimized for AL8860's hysteretic control
-static void effect_pulse_wave(void) {
-    static float wave_phase = 0.0f;
-    uint32_t r, g, b, w;
-    
-    // Slower wave progression for AL8860's natural behavior
-    wave_phase += (config.speed / 255.0f) * 0.05f;
-    if (wave_phase >= 2.0f * M_PI) wave_phase = 0.0f;
-    
-    // Triangle wave pattern that works well with hysteretic control
-    float intensity;
-    if (wave_phase < M_PI) {
-        intensity = wave_phase / M_PI;
-    } else {
-        intensity = 2.0f - (wave_phase / M_PI);
+static void frame_clock_stop(void) {
+    if (frame_clock_running) {
+        esp_timer_stop(frame_timer);
+        frame_clock_running = false;
     }
-    
-    // Apply to warm white for smooth operation
-    uint32_t brightness = (uint32_t)(config.brightness * intensity);
-    r = config.r * brightness / config.max_duty;
-    g = config.g * brightness / config.max_duty;
-    b = config.b * brightness / config.max_duty;
-    w = brightness;
-    
-    pwm_set_rgbw(r, g, b, w);
 }
 
-// Soft transition effect - leverages AL8860's soft-start capability
-static void effect_soft_transition(void) {
-    static uint8_t target_state = 0;
-    static uint32_t transition_start = 0;
-    static uint32_t current_r = 0, current_g = 0, current_b = 0, current_w = 0;
-    
-    // Define transition targets
-    uint32_t targets[4][4] = {
-        {config.brightness, 0, 0, 0},                    // Red
-        {0, config.brightness, 0, 0},                    // Green
-        {0, 0, config.brightness, 0},                    // Blue
-        {0, 0, 0, config.brightness}                     // Warm White
-    };
-    
-    // Check if it's time for a new transition
-    uint32_t transition_duration = (255 - config.speed) * 10 + 100;
-    if (effect_counter - transition_start >= transition_duration) {
-        target_state = (target_state + 1) % 4;
-        transition_start = effect_counter;
+// Block until the next frame deadline. Returns the deadline being served;
+// if the task woke too late, the missed deadlines are skipped.
+static int64_t frame_clock_wait(void) {
+    uint32_t bits = 0;
+    int64_t now;
+
+    frame_clock_start();
+
+    // Ignore config wakeups and a tick left over from before a restart
+    while (1) {
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+        now = esp_timer_get_time();
+        if ((bits & EFFECTS_NOTIFY_FRAME) && now >= next_deadline_us) {
+            break;
+        }
     }
-    
-    // Smooth interpolation to new target
-    float progress = (float)(effect_counter - transition_start) / transition_duration;
-    if (progress > 1.0f) progress = 1.0f;
-    
-    // Ease-in-out for smoother transitions with AL8860
-    progress = progress * progress * (3.0f - 2.0f * progress);
-    
-    uint32_t target_r = targets[target_state][0];
-    uint32_t target_g = targets[target_state][1];
-    uint32_t target_b = targets[target_state][2];
-    uint32_t target_w = targets[target_state][3];
-    
-    current_r = current_r + (uint32_t)((target_r - current_r) * progress);
-    current_g = current_g + (uint32_t)((target_g - current_g) * progress);
-    current_b = current_b + (uint32_t)((target_b - current_b) * progress);
-    current_w = current_w + (uint32_t)((target_w - current_w) * progress);
-    
-    pwm_set_rgbw(current_r, current_g, current_b, current_w);
+
+    int64_t late_us = now - next_deadline_us;
+    uint32_t missed = (uint32_t)(late_us / EFFECT_FRAME_US);
+    int64_t deadline_us = next_deadline_us + missed * EFFECT_FRAME_US;
+
+    uint32_t bucket = (uint32_t)(late_us / JITTER_BUCKET_US);
+    jitter_histogram[(bucket < JITTER_BUCKETS) ? bucket : JITTER_BUCKETS - 1]++;
+    if (late_us > jitter_max_us) {
+        jitter_max_us = (uint32_t)late_us;
+    }
+    missed_deadlines += missed;
+    frames_rendered++;
+
+    next_deadline_us = deadline_us + EFFECT_FRAME_US;
+    return deadline_us;
 }
 
-#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
-// LM3414 specific effects
+// Play the stream at local time t_us, at the configured brightness
+static void stream_render(int64_t t_us, effect_frame_t *out) {
+    stream_buffer_play(&stream, t_us, out);
+    out->r = (out->r * config.brightness) / PWM_MAX_DUTY;
+    out->g = (out->g * config.brightness) / PWM_MAX_DUTY;
+    out->b = (out->b * config.brightness) / PWM_MAX_DUTY;
+    out->w = (out->w * config.brightness) / PWM_MAX_DUTY;
+}
 
-// Precision fade effect - high-resolution fading for LM3414
-static void effect_precision_fade(void) {
-    static float precise_hue = 0.0f;
-    static float hue_step = 0.0f;
-    
-    uint8_t r, g, b;
-    uint32_t scaled_r, scaled_g, scaled_b, scaled_w = 0;
-    
-    // Ultra-smooth hue progression using LM3414's 12-bit resolution
-    hue_step = (config.speed / 255.0f) * 0.0001f;  // Very fine steps
-    precise_hue += hue_step;
-    if (precise_hue >= 1.0f) precise_hue = 0.0f;
-    
-    hsv_to_rgb(precise_hue, 1.0f, 1.0f, &r, &g, &b);
-    
-    // Use full 12-bit resolution for maximum precision
-    scaled_r = (r * config.max_duty) / 255;
-    scaled_g = (g * config.max_duty) / 255;
-    scaled_b = (b * config.max_duty) / 255;
-    
-    // Apply brightness with 12-bit precision
-    scaled_r = (scaled_r * config.brightness) / config.max_duty;
-    scaled_g = (scaled_g * config.brightness) / config.max_duty;
-    scaled_b = (scaled_b * config.brightness) / config.max_duty;
-    
-    pwm_set_rgbw(scaled_r, scaled_g, scaled_b, scaled_w);
+// True if the stream shows anywhere in this frame: as the effect, as the
+// effect a transition is leaving, or as a layer
+static bool stream_shown(void) {
+    if ((config.type == EFFECT_STREAM && !manual_mode) ||
+        (transition.active && transition.type == EFFECT_STREAM)) {
+        return true;
+    }
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        if (layers[i].type == EFFECT_STREAM && layers[i].opacity > 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-// Fast strobe effect - high-frequency effects for LM3414
-static void effect_fast_strobe(void) {
-    static bool strobe_state = false;
-    static uint32_t last_strobe = 0;
-    
-    // Fast strobe timing taking advantage of LM3414's capabilities
-    uint32_t strobe_interval = (255 - config.speed) / FAST_EFFECT_DIVISOR + 1;
-    
-    if (effect_counter - last_strobe >= strobe_interval) {
-        strobe_state = !strobe_state;
-        last_strobe = effect_counter;
+// Effect time for the frame at local time frame_us. Once a shared clock is
+// set, periodic effects run on it instead of on their own start, so every
+// fixture on the same clock renders the same phase. Shows and programs
+// keep their own start. clock_sync_effect_time() counts on through the
+// master's 32-bit wrap and holds small corrections back rather than
+// running time backwards.
+static int64_t effect_time_us(light_effect_t type, int64_t epoch_us, int64_t frame_us) {
+    if (!shared_clock.locked) {
+        shared_effect.running = false;  // Count again from the next lock
+        return frame_us - epoch_us;
     }
-    
-    uint32_t intensity = strobe_state ? config.brightness : 0;
-    
-    // Alternate between colors at high frequency
-    uint8_t color_cycle = (effect_counter / (strobe_interval * 2)) % 3;
-    uint32_t r = 0, g = 0, b = 0, w = 0;
-    
-    switch (color_cycle) {
-        case 0: r = intensity; break;  // Red strobe
-        case 1: g = intensity; break;  // Green strobe
-        case 2: b = intensity; break;  // Blue strobe
+    if (type == EFFECT_TIMELINE || type == EFFECT_USER_PROGRAM) {
+        return frame_us - epoch_us;
     }
-    
-    pwm_set_rgbw(r, g, b, w);
+    return clock_sync_effect_time(&shared_effect, &shared_clock, frame_us);
+}
+
+// Beat position for the frame at local time frame_us. The frame is on
+// the LEDs for one frame period, so its middle is what lands on the beat.
+static void tempo_fill(int64_t frame_us) {
+    config.beat_locked = tempo_pll_position(&tempo, frame_us + tempo_lead_us + EFFECT_FRAME_US / 2,
+                                            &config.beat_count, &config.beat_phase);
 }
 
+// Render any effect for the frame at local time frame_us. The stream is
+// played once per frame by the caller, since playing moves the ring on,
+// and comes in as stream_frame; everything else runs on effect time.
+static bool render_effect(light_effect_t type, effect_state_t *state, int64_t epoch_us,
+                          int64_t frame_us, const effect_frame_t *stream_frame, effect_frame_t *out) {
+    if (type == EFFECT_STREAM) {
+        *out = *stream_frame;
+        return true;
+    }
+    tempo_fill(frame_us);
+    return effect_render(type, state, &config, effect_time_us(type, epoch_us, frame_us), out);
+}
+
+// Blend the outgoing effect under the incoming frame. Frames are in
+// logical (lightness) levels, so with perceptual dimming the linear blend
+// is also perceptually even.
+static void transition_blend(effect_frame_t *frame, int64_t t_us, const effect_frame_t *stream_frame) {
+    int64_t elapsed_us = t_us - transition.start_us;
+    effect_frame_t outgoing;
+
+    if (elapsed_us >= transition.length_us) {
+        transition.active = false;
+        return;
+    }
+    if (elapsed_us < 0) {
+        elapsed_us = 0;
+    }
+
+    render_effect(transition.type, &transition.state, transition.epoch_us, t_us, stream_frame,
+                  &outgoing);
+
+    uint32_t progress = (uint32_t)((elapsed_us << 15) / transition.length_us);
+    frame->r = fx_lerp_q15(outgoing.r, frame->r, progress);
+    frame->g = fx_lerp_q15(outgoing.g, frame->g, progress);
+    frame->b = fx_lerp_q15(outgoing.b, frame->b, progress);
+    frame->w = fx_lerp_q15(outgoing.w, frame->w, progress);
+}
+
+// Composite the overlay layers over the base frame (effect_composite()).
+// Each layer has its own effect time.
+static void composite_layers(effect_frame_t *frame, int64_t t_us, const effect_frame_t *stream_frame) {
+    int64_t layer_t_us[LIGHT_OVERLAY_LAYERS];
+
+    tempo_fill(t_us);
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        layer_t_us[i] = effect_time_us(layers[i].type, layer_epoch_us[i], t_us);
+    }
+    effect_composite(frame, layers, layer_state, &config, layer_t_us, stream_frame);
+}
+
+// Block until a light_effects_set_* call changes something. Used whenever the
+// output cannot change on its own, so the CPU can stay in light sleep.
+static void wait_for_change(void) {
+    frame_clock_stop();
+    xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+}
+
+// Wakeup latency at the given percentile, as the upper edge of its bucket
+static uint32_t jitter_percentile_us(uint32_t percent) {
+    uint32_t total = 0;
+    for (int i = 0; i < JITTER_BUCKETS; i++) {
+        total += jitter_histogram[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint32_t rank = (uint32_t)(((uint64_t)total * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < JITTER_BUCKETS; i++) {
+        seen += jitter_histogram[i];
+        if (seen >= rank) {
+            uint32_t edge = (i + 1) * JITTER_BUCKET_US;
+            return (i == JITTER_BUCKETS - 1 || edge > jitter_max_us) ? jitter_max_us : edge;
+        }
+    }
+    return jitter_max_us;
+}
+
+_Static_assert(EFFECT_LUT_MAX_DUTY == PWM_MAX_DUTY, "effect LUTs generated for a different PWM resolution");
+
+#ifdef CONFIG_LIGHT_TEMPORAL_DITHER
+// Sigma-delta residue per channel, in 1/65536 duty steps
+static uint32_t dither_residue[PWM_CHANNEL_MAX] = {0};
+#endif
+
+// Output stage: every effect frame passes through here on its way to the
+// LEDs. animated frames come on the frame clock and may be dithered; a
+// static frame is the last one until something changes, so it is not.
+static void light_output(const effect_frame_t *frame, bool animated) {
+#ifdef CONFIG_LIGHT_PERCEPTUAL_DIMMING
+    const uint32_t level[PWM_CHANNEL_MAX] = {frame->r, frame->g, frame->b, frame->w};
+
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        uint32_t duty_q16 = dimming_duty_q16(level[i]);
+#ifdef CONFIG_LIGHT_TEMPORAL_DITHER
+        pwm_stage_duty((pwm_channel_t)i, dimming_quantize(&dither_residue[i], duty_q16, animated));
+#else
+        pwm_stage_duty((pwm_channel_t)i, dimming_round(duty_q16));
+#endif
+    }
+    pwm_commit_frame();
+#else
+    pwm_set_rgbw(frame->r, frame->g, frame->b, frame->w);
+#endif
+    latency_record();
+}
+
+#ifdef CONFIG_LIGHT_EFFECTS_HW_FADE
+// Hand a keyframe to the fade engine. Endpoints go through the perceptual
+// curve; the hardware interpolates linearly in duty between them.
+static void light_output_fade(const effect_keyframe_t *kf, uint32_t duration_ms) {
+#ifdef CONFIG_LIGHT_PERCEPTUAL_DIMMING
+    const uint32_t level[PWM_CHANNEL_MAX] = {kf->to.r, kf->to.g, kf->to.b, kf->to.w};
+    uint32_t duty[PWM_CHANNEL_MAX];
+
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        duty[i] = dimming_round(dimming_duty_q16(level[i]));
+    }
+    pwm_fade_rgbw(duty[0], duty[1], duty[2], duty[3], duration_ms);
+#else
+    pwm_fade_rgbw(kf->to.r, kf->to.g, kf->to.b, kf->to.w, duration_ms);
+#endif
+    latency_record();  // The fade starts moving towards the new values now
+}
+
+static bool IRAM_ATTR effects_fade_done(void *arg) {
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR((TaskHandle_t)arg, EFFECTS_NOTIFY_FADE_DONE, eSetBits, &woken);
+    return woken == pdTRUE;
+}
+
+// Run one keyframe of the current effect on the fade engine and sleep until
+// it is done or the configuration changes. Returns false if the effect has
+// no keyframe form.
+static bool run_keyframe_effect(void) {
+    effect_keyframe_t kf;
+    effect_frame_t now_frame;
+
+    if (transition.active || layers_active || !effect_has_keyframes(config.type)) {
+        return false;
+    }
+    if (tempo.running && effect_follows_beat(config.type)) {
+        return false;  // The beat grid moves under the fade engine; render frames
+    }
+
+    // Drop stale notifications; the keyframe below sees the latest config
+    xTaskNotifyWait(0, UINT32_MAX, NULL, 0);
+    config_refresh();
+    if (transition.active || layers_active) {
+        return false;  // Crossfades and layers are rendered frame by frame
+    }
+
+#ifdef CONFIG_LIGHT_EFFECTS_PROFILE
+    esp_cpu_cycle_count_t cycles_start = esp_cpu_get_cycle_count();
+#endif
+
+    // Bring the effect up to now and plan the segment from there
+    int64_t start = esp_timer_get_time();
+    effect_render(config.type, &effect_state, &config,
+                  effect_time_us(config.type, effect_epoch_us, start), &now_frame);
+    if (!effect_next_keyframe(config.type, &effect_state, &config, &kf)) {
+        return false;
+    }
+
+    // The fade engine paces this segment; no frame ticks needed
+    frame_clock_stop();
+
+#ifdef CONFIG_LIGHT_EFFECTS_PROFILE
+    profile_record(config.type, esp_cpu_get_cycle_count() - cycles_start);
+#endif
+
+    uint32_t duration_ms = kf.frames * EFFECT_UPDATE_INTERVAL_MS;
+    int64_t length_us = kf.frames * EFFECT_FRAME_US;
+
+    light_output_fade(&kf, duration_ms);
+
+    while (1) {
+        int64_t remaining_us = length_us - (esp_timer_get_time() - start);
+        uint32_t bits = 0;
+
+        // The fade engine may finish a tick early, or clamp long fades short;
+        // keep the effect timeline on the requested duration either way.
+        TickType_t wait = pdMS_TO_TICKS(remaining_us / 1000);
+        if (wait == 0) {
+            break;
+        }
+
+        xTaskNotifyWait(0, UINT32_MAX, &bits, wait);
+        effect_wakeups++;
+
+        // The next segment starts from wherever the hardware got to, with
+        // the effect state advanced to the time of the change
+        if (bits & EFFECTS_NOTIFY_CONFIG) {
+            pwm_fade_stop();
+            break;
+        }
+    }
+
+    return true;
+}
 #endif
 
+// Tell the listeners about a changed state. Called once per pass of the
+// task loop, so a burst of commands costs one callback per frame.
+static void state_publish(void) {
+    uint32_t listeners = __atomic_load_n(&state_listener_count, __ATOMIC_ACQUIRE);
+    const light_state_t *p = &published_state;
+
+    if (listeners == 0 ||
+        (p->type == config.type && p->r == config.r && p->g == config.g && p->b == config.b &&
+         p->w == config.w && p->brightness == config.brightness && p->speed == config.speed &&
+         p->transition_ms == config.transition_ms && p->manual == manual_mode)) {
+        return;
+    }
+
+    published_state = (light_state_t){
+        .type = config.type,
+        .r = config.r, .g = config.g, .b = config.b, .w = config.w,
+        .brightness = config.brightness,
+        .speed = config.speed,
+        .transition_ms = config.transition_ms,
+        .manual = manual_mode,
+    };
+    for (uint32_t i = 0; i < listeners; i++) {
+        state_listeners[i](&published_state);
+    }
+}
+
 // Main effects task
 static void effects_task(void *pvParameters) {
     ESP_LOGI(TAG, "Effects task started for %s", LED_DRIVER_TYPE);
+
+#ifdef CONFIG_LIGHT_EFFECTS_HW_FADE
+    pwm_fade_set_callback(effects_fade_done, xTaskGetCurrentTaskHandle());
+#endif
     
     while (1) {
+        config_refresh();
+        state_publish();
+
         if (!config.enabled) {
             // Effects disabled
-            vTaskDelay(pdMS_TO_TICKS(100));
+            latency_since_us = 0;  // Nothing to measure until output resumes
+            wait_for_change();
+            effect_wakeups++;
             continue;
         }
         
-        // Always run effects unless manually overridden or off
-        if (manual_mode && config.type != EFFECT_OFF) {
-            vTaskDelay(pdMS_TO_TICKS(100));
+        // Always run effects unless manually overridden or off; overlay
+        // layers keep running over a manual color
+        if (manual_mode && config.type != EFFECT_OFF && !layers_active) {
+            // Manual colors are raw duty, written straight to the channels
+            if (manual_dirty) {
+                pwm_set_rgbw(config.r, config.g, config.b, config.w);
+                manual_dirty = false;
+            }
+            latency_record();
+            wait_for_change();
+            effect_wakeups++;
             continue;
         }
-        
-        switch (config.type) {
-            case EFFECT_OFF:
-                pwm_set_rgbw(0, 0, 0, 0);
-                vTaskDelay(pdMS_TO_TICKS(1000)); // Sleep longer when off
-                break;
-                
-            case EFFECT_STATIC:
-                // Static color - only update when values change
-                {
-                    uint32_t r = config.r, g = config.g, b = config.b, w = config.w;
-                    apply_brightness(&r, &g, &b, &w, config.brightness);
-                    pwm_set_rgbw(r, g, b, w);
-                    vTaskDelay(pdMS_TO_TICKS(500)); // Update less frequently for static
-                }
-                break;
-                
-            case EFFECT_SMOOTH_FADE:
-                effect_smooth_fade();
-                break;
-                
-            case EFFECT_RGB_CYCLE:
-                effect_rgb_cycle();
-                break;
-                
-            case EFFECT_BREATHING:
-                effect_breathing();
-                break;
-                
-            case EFFECT_TWINKLE_PULSE:
-                effect_twinkle_pulse();
-                break;
-                
-            case EFFECT_LIGHTNING_FLASH:
-                effect_lightning_flash();
-                break;
-                
-            case EFFECT_CANDLE_FLICKER:
-                effect_candle_flicker();
-                break;
-
-#ifdef CONFIG_BOARD_ESP32C3_OLED
-            case EFFECT_PULSE_WAVE:
-                effect_pulse_wave();
-                break;
-                
-            case EFFECT_SOFT_TRANSITION:
-                effect_soft_transition();
-                break;
-#elif defined(CONFIG_BOARD_ESP32C3_NO_OLED)
-            case EFFECT_PRECISION_FADE:
-                effect_precision_fade();
-                break;
-                
-            case EFFECT_FAST_STROBE:
-                effect_fast_strobe();
-                break;
+        manual_dirty = false;
+
+#ifdef CONFIG_LIGHT_EFFECTS_HW_FADE
+        if (run_keyframe_effect()) {
+            continue;
+        }
+#endif
+
+        // Animated effects render on the frame clock; effect time comes from
+        // the deadline being served, not from how often the loop ran
+        bool animated = (config.type != EFFECT_OFF && config.type != EFFECT_STATIC) ||
+                        transition.active || layers_animated;
+        int64_t frame_time_us = esp_timer_get_time();
+        if (animated) {
+            frame_time_us = frame_clock_wait();
+            config_refresh();
+        }
+
+#ifdef CONFIG_LIGHT_EFFECTS_PROFILE
+        esp_cpu_cycle_count_t cycles_start = esp_cpu_get_cycle_count();
 #endif
-                
-            default:
-                ESP_LOGW(TAG, "Unknown effect: %d", config.type);
-                config.type = EFFECT_SMOOTH_FADE;
-                break;
+
+        effect_frame_t frame, stream_frame = {0};
+        if (stream_shown()) {
+            stream_render(frame_time_us, &stream_frame);
+        }
+        if (manual_mode) {
+            // Manual writes drive the channels unscaled; layers go over that
+            frame = (effect_frame_t){config.r, config.g, config.b, config.w};
+        } else if (!render_effect(config.type, &effect_state, effect_epoch_us, frame_time_us,
+                                  &stream_frame, &frame)) {
+            ESP_LOGW(TAG, "Unknown effect: %d", config.type);
+            light_effects_set_effect(EFFECT_SMOOTH_FADE);
+            continue;
+        }
+        if (transition.active) {
+            transition_blend(&frame, frame_time_us, &stream_frame);
+        }
+        if (layers_active) {
+            composite_layers(&frame, frame_time_us, &stream_frame);
+        }
+
+#ifdef CONFIG_LIGHT_EFFECTS_PROFILE
+        profile_record(config.type, esp_cpu_get_cycle_count() - cycles_start);
+#endif
+
+        light_output(&frame, animated);
+        effect_wakeups++;
+
+        // Off and static output only change through a setter
+        if (!animated) {
+            wait_for_change();
         }
-        
-        effect_counter++;
-        
-        // Use driver-optimized update interval
-        vTaskDelay(pdMS_TO_TICKS(EFFECT_UPDATE_INTERVAL_MS));
     }
 }
 
@@ -447,26 +842,39 @@ static void effects_task(void *pvParameters) {
 void light_effects_init(void) {
     ESP_LOGI(TAG, "Initializing light effects system");
     
+    effect_shared_t *w = shared_write_begin();
+
     // Set max duty based on driver
-    config.max_duty = pwm_get_max_duty();
-    
+    w->config.max_duty = pwm_get_max_duty();
+
+    // Fixtures flicker independently unless the app gives them one seed
+    w->config.seed = esp_random();
+
     // Convert initial values from 8-bit to driver resolution
-    config.brightness = (config.brightness * config.max_duty) / 255;
-    config.r = (config.r * config.max_duty) / 255;
-    config.g = (config.g * config.max_duty) / 255;
-    config.b = (config.b * config.max_duty) / 255;
-    config.w = (config.w * config.max_duty) / 255;
-    
-    ESP_LOGI(TAG, "Driver: %s, Resolution: %d-bit (max duty: %lu)", 
-             LED_DRIVER_TYPE,
-             (config.max_duty == 255) ? 8 : 12, 
-             (unsigned long)config.max_duty);
-    
+    w->config.brightness = (w->config.brightness * w->config.max_duty) / 255;
+    w->config.r = (w->config.r * w->config.max_duty) / 255;
+    w->config.g = (w->config.g * w->config.max_duty) / 255;
+    w->config.b = (w->config.b * w->config.max_duty) / 255;
+    w->config.w = (w->config.w * w->config.max_duty) / 255;
+
     // Set default effect when no BLE connection
     if (!ble_connected) {
-        config.type = EFFECT_SMOOTH_FADE;
-        config.enabled = true;
+        w->config.type = EFFECT_SMOOTH_FADE;
+        w->config.enabled = true;
     }
+    uint32_t max_duty = w->config.max_duty;
+    shared_write_end();
+
+    const esp_timer_create_args_t frame_timer_args = {
+        .callback = frame_clock_tick,
+        .name = "effects_frame"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&frame_timer_args, &frame_timer));
+    
+    ESP_LOGI(TAG, "Driver: %s, Resolution: %d-bit (max duty: %lu)", 
+             LED_DRIVER_TYPE,
+             (max_duty == 255) ? 8 : 12, 
+             (unsigned long)max_duty);
 }
 
 void light_effects_start(void) {
@@ -481,6 +889,7 @@ void light_effects_stop(void) {
     if (effects_task_handle != NULL) {
         vTaskDelete(effects_task_handle);
         effects_task_handle = NULL;
+        frame_clock_stop();
         pwm_set_rgbw(0, 0, 0, 0);
         ESP_LOGI(TAG, "Light effects stopped");
     }
@@ -488,45 +897,224 @@ void light_effects_stop(void) {
 
 void light_effects_set_effect(light_effect_t effect) {
     if (effect < EFFECT_MAX) {
-        config.type = effect;
-        effect_counter = 0;  // Reset effect state
-        hue = 0.0f;
-        rgb_cycle_state = 0; // Reset RGB cycle
+        effect_shared_t previous;
+        shared_read(&previous);
+
+        int64_t now = esp_timer_get_time();
+        uint32_t run_ms = (uint32_t)((now - previous.epoch_us) / 1000);
+        if (run_ms > 0) {
+            ESP_LOGI(TAG, "Effect %d averaged %lu.%02lu CPU wakeups/s", previous.config.type,
+                     (unsigned long)(effect_wakeups * 1000UL / run_ms),
+                     (unsigned long)((effect_wakeups * 100000ULL / run_ms) % 100));
+        }
+        if (frames_rendered > 0) {
+            ESP_LOGI(TAG, "Frame clock: %lu frames, %lu missed, jitter p50 %luus p99 %luus max %luus",
+                     (unsigned long)frames_rendered, (unsigned long)missed_deadlines,
+                     (unsigned long)jitter_percentile_us(50), (unsigned long)jitter_percentile_us(99),
+                     (unsigned long)jitter_max_us);
+        }
+        if (command_stats.received > 0) {
+            ESP_LOGI(TAG, "Commands: %lu received, %lu coalesced, %lu dropped",
+                     (unsigned long)command_stats.received, (unsigned long)command_stats.coalesced,
+                     (unsigned long)command_stats.dropped);
+        }
+        if (latency_stats.samples > 0) {
+            ESP_LOGI(TAG, "Write-to-light latency: last %luus avg %luus max %luus",
+                     (unsigned long)latency_stats.last_us, (unsigned long)latency_stats.avg_us,
+                     (unsigned long)latency_stats.max_us);
+        }
+
+        effect_shared_t *w = shared_write_begin();
+        w->config.type = effect;
+        w->epoch_us = now;
+        w->generation++;  // effects_task resets the effect state
+        shared_write_end();
         ESP_LOGI(TAG, "Effect changed to: %d", effect);
     }
 }
 
 void light_effects_set_brightness(uint32_t brightness) {
     // Brightness is always passed in driver resolution
-    if (brightness > config.max_duty) {
-        brightness = config.max_duty;
+    effect_shared_t *w = shared_write_begin();
+    if (brightness > w->config.max_duty) {
+        brightness = w->config.max_duty;
     }
-    config.brightness = brightness;
-    ESP_LOGI(TAG, "Brightness set to: %lu/%lu", (unsigned long)brightness, (unsigned long)config.max_duty);
+    w->config.brightness = brightness;
+    shared_write_end();
+    ESP_LOGI(TAG, "Brightness set to: %lu/%lu", (unsigned long)brightness, (unsigned long)PWM_MAX_DUTY);
 }
 
 void light_effects_set_speed(uint8_t speed) {
-    config.speed = speed;
+    effect_shared_t *w = shared_write_begin();
+    w->config.speed = speed;
+    shared_write_end();
     ESP_LOGI(TAG, "Speed set to: %d", speed);
 }
 
 void light_effects_set_color(uint32_t r, uint32_t g, uint32_t b, uint32_t w) {
-    // Colors are always passed in driver resolution
-    config.r = (r > config.max_duty) ? config.max_duty : r;
-    config.g = (g > config.max_duty) ? config.max_duty : g;
-    config.b = (b > config.max_duty) ? config.max_duty : b;
-    config.w = (w > config.max_duty) ? config.max_duty : w;
+    // Colors are always passed in driver resolution, published as one update
+    r = (r > PWM_MAX_DUTY) ? PWM_MAX_DUTY : r;
+    g = (g > PWM_MAX_DUTY) ? PWM_MAX_DUTY : g;
+    b = (b > PWM_MAX_DUTY) ? PWM_MAX_DUTY : b;
+    w = (w > PWM_MAX_DUTY) ? PWM_MAX_DUTY : w;
+
+    effect_shared_t *shared_w = shared_write_begin();
+    shared_w->config.r = r;
+    shared_w->config.g = g;
+    shared_w->config.b = b;
+    shared_w->config.w = w;
+    shared_write_end();
     ESP_LOGI(TAG, "Color set to: R=%lu, G=%lu, B=%lu, W=%lu (max=%lu)", 
-             (unsigned long)config.r, (unsigned long)config.g, (unsigned long)config.b, (unsigned long)config.w, (unsigned long)config.max_duty);
+             (unsigned long)r, (unsigned long)g, (unsigned long)b, (unsigned long)w, (unsigned long)PWM_MAX_DUTY);
+}
+
+void light_effects_set_transition(uint32_t transition_ms) {
+    if (transition_ms > LIGHT_TRANSITION_MAX_MS) {
+        transition_ms = LIGHT_TRANSITION_MAX_MS;
+    }
+    effect_shared_t *w = shared_write_begin();
+    w->config.transition_ms = transition_ms;
+    shared_write_end();
+    ESP_LOGI(TAG, "Transition set to: %lums", (unsigned long)transition_ms);
+}
+
+// Apply every field of a packed update in one publish, so the effects task
+// never renders a mix of old and new values. The effects task renders static
+// colors too; nothing here touches the PWM directly. A manual state, as
+// restored from a record, goes back to raw duty the way the per-channel
+// writes left it.
+void light_effects_apply(const light_state_t *state) {
+    if (state->type >= EFFECT_MAX) {
+        ESP_LOGW(TAG, "Invalid effect in update: %d", state->type);
+        return;
+    }
+
+    effect_shared_t *w = shared_write_begin();
+    if (w->config.type != state->type) {
+        w->epoch_us = esp_timer_get_time();
+        w->generation++;  // effects_task resets the effect state
+    }
+    w->config.type = state->type;
+    w->config.r = (state->r > PWM_MAX_DUTY) ? PWM_MAX_DUTY : state->r;
+    w->config.g = (state->g > PWM_MAX_DUTY) ? PWM_MAX_DUTY : state->g;
+    w->config.b = (state->b > PWM_MAX_DUTY) ? PWM_MAX_DUTY : state->b;
+    w->config.w = (state->w > PWM_MAX_DUTY) ? PWM_MAX_DUTY : state->w;
+    w->config.brightness = (state->brightness > PWM_MAX_DUTY) ? PWM_MAX_DUTY : state->brightness;
+    w->config.speed = state->speed;
+    w->config.transition_ms = (state->transition_ms > LIGHT_TRANSITION_MAX_MS) ?
+                              LIGHT_TRANSITION_MAX_MS : state->transition_ms;
+    w->manual_mode = state->manual;
+    shared_write_end();
+}
+
+// Called from the NimBLE host task. Never blocks: a full queue drops the
+// command and says so, the BLE callback reports it to the client.
+bool light_effects_post(const light_command_t *cmd) {
+    uint32_t head = command_head;
+    uint32_t tail = __atomic_load_n(&command_tail, __ATOMIC_ACQUIRE);
+
+    command_stats.received++;
+    if (head - tail >= COMMAND_QUEUE_LEN) {
+        command_stats.dropped++;
+        return false;
+    }
+
+    command_queue[head % COMMAND_QUEUE_LEN] = *cmd;
+    command_posted_us[head % COMMAND_QUEUE_LEN] = esp_timer_get_time();
+    __atomic_store_n(&command_head, head + 1, __ATOMIC_RELEASE);
+    notify_config_changed();
+    return true;
+}
+
+void light_effects_get_command_stats(light_command_stats_t *stats) {
+    *stats = command_stats;
+}
+
+void light_effects_get_latency_stats(light_latency_stats_t *stats) {
+    *stats = latency_stats;
+}
+
+// Called from the NimBLE host task with a batch of frames in sender order.
+// Returns how many were accepted.
+uint32_t light_effects_stream_push(const light_stream_frame_t *frames, uint32_t count) {
+    return stream_buffer_push(&stream, frames, count, esp_timer_get_time());
+}
+
+void light_effects_stream_set_latency(uint32_t latency_ms) {
+    if (latency_ms > LIGHT_STREAM_MAX_LATENCY_MS) {
+        latency_ms = LIGHT_STREAM_MAX_LATENCY_MS;
+    }
+    stream.stats.latency_ms = latency_ms;
+    ESP_LOGI(TAG, "Stream latency set to: %lu ms", (unsigned long)latency_ms);
+}
+
+void light_effects_get_stream_stats(light_stream_stats_t *stats) {
+    stream_buffer_get_stats(&stream, stats);
+}
+
+void light_effects_get_tempo_stats(light_tempo_stats_t *stats) {
+    stats->bpm_x100 = tempo_pll_bpm_x100(&tempo);
+    stats->beats = tempo_beats;
+    stats->last_error_us = tempo.last_error_us;
+    stats->lead_ms = (int32_t)(tempo_lead_us / 1000);
+}
+
+// Listeners are added from app_main and ble_server_init, one after the
+// other; the effects task only sees the count once the slot is filled
+bool light_effects_add_state_listener(light_state_listener_t listener) {
+    uint32_t count = state_listener_count;
+
+    if (count >= LIGHT_STATE_LISTENERS) {
+        return false;
+    }
+    state_listeners[count] = listener;
+    __atomic_store_n(&state_listener_count, count + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void light_effects_set_seed(uint32_t seed) {
+    effect_shared_t *w = shared_write_begin();
+    w->config.seed = seed;
+    w->epoch_us = esp_timer_get_time();
+    w->generation++;  // Replay the effect from the new seed
+    shared_write_end();
+    ESP_LOGI(TAG, "Seed set to: 0x%08lx", (unsigned long)seed);
+}
+
+void light_effects_set_layer(uint8_t index, light_effect_t effect, uint8_t opacity, layer_blend_t blend) {
+    if (index >= LIGHT_OVERLAY_LAYERS || effect >= EFFECT_MAX || blend >= LAYER_BLEND_MAX_MODE) {
+        ESP_LOGW(TAG, "Invalid layer %d: effect %d, blend %d", index, effect, blend);
+        return;
+    }
+
+    effect_shared_t *w = shared_write_begin();
+    if (w->layers[index].type != effect) {
+        w->layer_epoch_us[index] = esp_timer_get_time();  // Restart the layer's effect
+    }
+    w->layers[index].type = effect;
+    w->layers[index].opacity = opacity;
+    w->layers[index].blend = blend;
+    shared_write_end();
+    ESP_LOGI(TAG, "Layer %d set to: effect %d, opacity %d, blend %d", index, effect, opacity, blend);
+}
+
+void light_effects_get_layers(effect_layer_t out[LIGHT_OVERLAY_LAYERS]) {
+    effect_shared_t snap;
+    shared_read(&snap);
+    memcpy(out, snap.layers, sizeof(snap.layers));
 }
 
 void light_effects_enable_manual_mode(void) {
-    manual_mode = true;
+    effect_shared_t *w = shared_write_begin();
+    w->manual_mode = true;
+    shared_write_end();
     ESP_LOGI(TAG, "Manual mode enabled - effects paused");
 }
 
 void light_effects_disable_manual_mode(void) {
-    manual_mode = false;
+    effect_shared_t *w = shared_write_begin();
+    w->manual_mode = false;
+    shared_write_end();
     ESP_LOGI(TAG, "Manual mode disabled - effects resumed");
 }
 
@@ -537,16 +1125,41 @@ void light_effects_set_ble_connected(bool connected) {
         ESP_LOGI(TAG, "🔗 BLE connected - ready for control");
         // Don't automatically enable manual mode, let the app control effects
     } else {
+#ifdef CONFIG_LIGHT_STATE_PERSIST
+        // The light stays as the app left it, the same as after a reboot
+        ESP_LOGI(TAG, "🔌 BLE disconnected - keeping the current state");
+#else
         ESP_LOGI(TAG, "🔌 BLE disconnected - starting smooth fade effect");
         light_effects_disable_manual_mode();
         light_effects_set_effect(EFFECT_SMOOTH_FADE);
+#endif
     }
 }
 
+// Called whenever the clock estimate moves; periodic effects follow it
+// from the next frame
+void light_effects_set_shared_clock(const clock_sync_model_t *model) {
+    effect_shared_t *w = shared_write_begin();
+    w->clock = *model;
+    shared_write_end();
+}
+
 light_effect_t light_effects_get_current_effect(void) {
-    return config.type;
+    effect_shared_t snap;
+    shared_read(&snap);
+    return snap.config.type;
+}
+
+void light_effects_get_frame_stats(light_frame_stats_t *stats) {
+    stats->frames = frames_rendered;
+    stats->missed_deadlines = missed_deadlines;
+    stats->jitter_p50_us = jitter_percentile_us(50);
+    stats->jitter_p99_us = jitter_percentile_us(99);
+    stats->jitter_max_us = jitter_max_us;
 }
 
-effect_config_t* light_effects_get_config(void) {
-    return &config;
+void light_effects_get_config(effect_config_t *out) {
+    effect_shared_t snap;
+    shared_read(&snap);
+    *out = snap.config;
 }
\ No newline at end of file
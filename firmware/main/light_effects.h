@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "sdkconfig.h"
+#include "clock_sync.h"
 
 // Effect types optimized for each driver
 typedef enum {
@@ -26,6 +27,9 @@ typedef enum {
     EFFECT_PRECISION_FADE,   // High-resolution fading for LM3414
     EFFECT_FAST_STROBE,      // High-frequency effects for LM3414
 #endif
+    EFFECT_TIMELINE,         // Uploaded keyframe show (see timeline.h)
+    EFFECT_USER_PROGRAM,     // Uploaded effect program (see effect_vm.h)
+    EFFECT_STREAM,           // Frames streamed over BLE, played from a jitter buffer
     EFFECT_MAX
 } light_effect_t;
 
@@ -37,8 +41,131 @@ typedef struct {
     uint32_t r, g, b, w;    // Base color values (0 to max_duty)
     bool enabled;           // Effect system enabled/disabled
     uint32_t max_duty;      // Maximum duty cycle for current driver
+    uint32_t transition_ms; // Crossfade length when the effect changes (0 = hard cut)
+    uint32_t seed;          // Random effects replay the same frames for the same seed
+
+    // Beat grid from the tempo engine, filled in by the effects task per frame
+    bool beat_locked;       // Beat-aware effects follow the beat instead of speed
+    uint32_t beat_count;    // Beats since the grid started
+    uint32_t beat_phase;    // Position in the current beat, turns (Q32), 0 on the beat
 } effect_config_t;
 
+#define LIGHT_TRANSITION_MAX_MS  60000
+
+// Overlay layers composited bottom to top over the base effect
+#define LIGHT_OVERLAY_LAYERS     4
+
+typedef enum {
+    LAYER_BLEND_ALPHA = 0,   // Cover the layers below by the opacity
+    LAYER_BLEND_ADD,         // Sum, clamped at full duty
+    LAYER_BLEND_MAX,         // Brightest value per channel wins
+    LAYER_BLEND_MULTIPLY,    // Scale the layers below (darken / mask)
+    LAYER_BLEND_MAX_MODE
+} layer_blend_t;
+
+typedef struct {
+    light_effect_t type;     // EFFECT_OFF leaves the layer out
+    uint8_t opacity;         // 0-255
+    layer_blend_t blend;
+} effect_layer_t;
+
+// A complete control update, published to the effects task in one step
+typedef struct {
+    light_effect_t type;
+    uint32_t r, g, b, w;    // Driver resolution
+    uint32_t brightness;    // Driver resolution
+    uint8_t speed;
+    uint32_t transition_ms;
+    bool manual;            // Per-channel writes: r, g, b, w are raw duty, not scaled by brightness
+} light_state_t;
+
+// Called by the effects task, at most once per frame, when the state a
+// light_state_t describes has changed. Must not block.
+typedef void (*light_state_listener_t)(const light_state_t *state);
+#define LIGHT_STATE_LISTENERS    2     // BLE notifications and the state store
+
+// Control commands from the BLE callbacks, applied by the effects task
+typedef enum {
+    LIGHT_CMD_STATE = 0,     // Whole state, supersedes earlier commands
+    LIGHT_CMD_CHANNEL,       // One manual channel; implies EFFECT_STATIC
+    LIGHT_CMD_EFFECT,        // Effect, with manual mode for OFF/STATIC
+    LIGHT_CMD_BRIGHTNESS,
+    LIGHT_CMD_SPEED,
+    LIGHT_CMD_TRANSITION,
+    LIGHT_CMD_LAYER,
+    LIGHT_CMD_TEMPO,         // Tempo events, applied in order, never coalesced
+    LIGHT_CMD_MAX
+} light_command_type_t;
+
+typedef enum {
+    LIGHT_TEMPO_BPM = 0,     // value: BPM x 100, 0 stops the beat grid
+    LIGHT_TEMPO_BEAT,        // value: beat time on the sender's clock, ms
+    LIGHT_TEMPO_LEAD,        // value: playout lead, ms (signed)
+} light_tempo_op_t;
+
+typedef struct {
+    light_command_type_t type;
+    union {
+        light_state_t state;
+        struct { uint8_t channel; uint32_t duty; } channel;  // Driver resolution
+        light_effect_t effect;
+        uint32_t value;      // Brightness (driver resolution), speed or transition ms
+        struct { uint8_t index; effect_layer_t layer; } layer;
+        struct { light_tempo_op_t op; uint32_t value; int64_t arrival_us; } tempo;
+    };
+} light_command_t;
+
+typedef struct {
+    uint32_t received;       // Commands posted
+    uint32_t coalesced;      // Overwritten by a newer value before they applied
+    uint32_t dropped;        // Rejected because the queue was full
+} light_command_stats_t;
+
+// Write-to-light latency: from a command being posted to the first output
+// that includes it, for the oldest command of each batch
+typedef struct {
+    uint32_t samples;
+    uint32_t last_us;
+    uint32_t avg_us;
+    uint32_t max_us;
+} light_latency_stats_t;
+
+// Streamed frames. ts_ms is the sender's clock when it produced the frame;
+// the jitter buffer maps it to local time and plays it the configured
+// latency after the fastest delivery it has seen.
+#define LIGHT_STREAM_BUFFER_FRAMES  64    // Power of two
+#define LIGHT_STREAM_MAX_LATENCY_MS 1000
+
+typedef struct {
+    uint32_t ts_ms;
+    uint32_t r, g, b, w;     // Driver resolution
+} light_stream_frame_t;
+
+typedef struct {
+    uint32_t received;       // Frames accepted into the buffer
+    uint32_t late;           // Arrived after their play time (skipped or shown late)
+    uint32_t dropped;        // Rejected: buffer full, repeated or out of order
+    uint32_t underruns;      // Times the buffer ran dry while streaming
+    uint32_t buffered;       // Frames waiting to play
+    uint32_t latency_ms;     // Current latency target
+} light_stream_stats_t;
+
+typedef struct {
+    uint32_t bpm_x100;       // Current estimate, 0 while there is no beat grid
+    uint32_t beats;          // Beat messages received
+    int32_t last_error_us;   // Last beat against its prediction, after latency mapping
+    int32_t lead_ms;         // Beats are shown this much ahead of the mapped time
+} light_tempo_stats_t;
+
+// Frame clock statistics since boot
+typedef struct {
+    uint32_t frames;            // Frames rendered on the frame clock
+    uint32_t missed_deadlines;  // Frames skipped because the task woke too late
+    uint32_t jitter_p50_us;     // Wakeup latency past the deadline, 100us resolution
+    uint32_t jitter_p99_us;
+    uint32_t jitter_max_us;
+} light_frame_stats_t;
+
 // Function declarations
 void light_effects_init(void);
 void light_effects_start(void);
@@ -47,10 +174,25 @@ void light_effects_set_effect(light_effect_t effect);
 void light_effects_set_brightness(uint32_t brightness);
 void light_effects_set_speed(uint8_t speed);
 void light_effects_set_color(uint32_t r, uint32_t g, uint32_t b, uint32_t w);
+void light_effects_set_transition(uint32_t transition_ms);
+void light_effects_set_seed(uint32_t seed);
+void light_effects_apply(const light_state_t *state);
+bool light_effects_post(const light_command_t *cmd);
+void light_effects_get_command_stats(light_command_stats_t *stats);
+bool light_effects_add_state_listener(light_state_listener_t listener);
+void light_effects_get_latency_stats(light_latency_stats_t *stats);
+uint32_t light_effects_stream_push(const light_stream_frame_t *frames, uint32_t count);
+void light_effects_stream_set_latency(uint32_t latency_ms);
+void light_effects_get_stream_stats(light_stream_stats_t *stats);
+void light_effects_get_tempo_stats(light_tempo_stats_t *stats);
+void light_effects_set_layer(uint8_t index, light_effect_t effect, uint8_t opacity, layer_blend_t blend);
+void light_effects_get_layers(effect_layer_t layers[LIGHT_OVERLAY_LAYERS]);
 void light_effects_enable_manual_mode(void);
 void light_effects_disable_manual_mode(void);
 light_effect_t light_effects_get_current_effect(void);
-effect_config_t* light_effects_get_config(void);
+void light_effects_get_config(effect_config_t *out);
+void light_effects_get_frame_stats(light_frame_stats_t *stats);
 void light_effects_set_ble_connected(bool connected);
+void light_effects_set_shared_clock(const clock_sync_model_t *model);
 
 #endif
\ No newline at end of file
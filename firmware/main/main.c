@@ -3,6 +3,7 @@
 
 #include "ble_server.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nimble/nimble_port.h"
@@ -10,6 +11,7 @@
 #include "nvs_flash.h"
 #include "pwm_control.h"
 #include "light_effects.h"
+#include "state_store.h"
 #include "sdkconfig.h"
 
 static const char *TAG = "RGBW_MAIN";
@@ -17,7 +19,7 @@ static const char *TAG = "RGBW_MAIN";
 void app_main(void) {
     esp_err_t ret;
 
-    /* Initialize NVS — it is used to store PHY calibration data */
+    /* Initialize NVS — it holds PHY calibration data and the light state */
     ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -38,11 +40,28 @@ void app_main(void) {
     ESP_LOGI(TAG, "  Blue: GPIO %d", CONFIG_GPIO_BLUE);
     ESP_LOGI(TAG, "  Warm White: GPIO %d", CONFIG_GPIO_WARM_WHITE);
 
+#ifdef CONFIG_PM_ENABLE
+    /* Scale the CPU down and light-sleep whenever every task is blocked */
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 40,
+        .light_sleep_enable = true
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#endif
+
     /* Initialize PWM for LED control */
     pwm_init();
 
     /* Initialize light effects system */
     light_effects_init();
+#ifdef CONFIG_LIGHT_STATE_PERSIST
+    /* Come back as the light was left, before the first frame or client */
+    state_store_restore();
+#endif
+#if defined(CONFIG_LIGHT_STATE_PERSIST) || defined(CONFIG_LIGHT_GROUP_CONTROL)
+    state_store_start();
+#endif
     light_effects_start();
 
     ESP_LOGI(TAG, "Starting NimBLE BLE stack");
@@ -67,6 +86,10 @@ void app_main(void) {
     ESP_LOGI(TAG, "LM3414 driver optimizations active (12-bit PWM, %dHz)", CONFIG_PWM_FREQUENCY_HZ);
 #endif
     
+#ifdef CONFIG_LIGHT_STATE_PERSIST
+    ESP_LOGI(TAG, "Light effects running - state is kept across disconnects and reboots");
+#else
     ESP_LOGI(TAG, "Light effects running - will switch to smooth fade when no device connected");
+#endif
     ESP_LOGI(TAG, "Ready for connections!");
 }
\ No newline at end of file
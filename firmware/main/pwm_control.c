@@ -1,8 +1,70 @@
 #include "pwm_control.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
 
 static const char *TAG = "PWM_CONTROL";
 
+// Duty currently latched in hardware and duty staged for the next frame
+static uint32_t committed_duty[PWM_CHANNEL_MAX] = {0};
+static uint32_t staged_duty[PWM_CHANNEL_MAX] = {0};
+static uint8_t staged_mask = 0;
+
+static pwm_frame_stats_t frame_stats = {0};
+
+// Keeps the update latches of one frame back to back
+static portMUX_TYPE frame_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Channels with a hardware fade in flight, cleared from the fade ISR
+static volatile uint8_t fading_mask = 0;
+static pwm_fade_done_cb_t fade_done_cb = NULL;
+static void *fade_done_arg = NULL;
+
+#ifdef CONFIG_PM_ENABLE
+// LEDC is clocked from XTAL, which stops in light sleep. Hold the chip awake
+// while any channel is lit; with all channels dark it may light-sleep freely.
+static esp_pm_lock_handle_t lit_lock = NULL;
+static bool lit_lock_held = false;
+
+static void pwm_update_sleep_lock(void)
+{
+    bool lit = (fading_mask != 0);
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        lit |= (committed_duty[i] != 0);
+    }
+
+    if (lit && !lit_lock_held) {
+        ESP_ERROR_CHECK(esp_pm_lock_acquire(lit_lock));
+        lit_lock_held = true;
+    } else if (!lit && lit_lock_held) {
+        ESP_ERROR_CHECK(esp_pm_lock_release(lit_lock));
+        lit_lock_held = false;
+    }
+}
+#endif
+
+static bool IRAM_ATTR pwm_fade_end_isr(const ledc_cb_param_t *param, void *user_arg)
+{
+    bool woken = false;
+
+    if (param->event != LEDC_FADE_END_EVT) {
+        return false;
+    }
+
+    portENTER_CRITICAL_ISR(&frame_mux);
+    uint8_t before = fading_mask;
+    fading_mask &= ~(1U << param->channel);
+    bool segment_done = (before != 0 && fading_mask == 0);
+    portEXIT_CRITICAL_ISR(&frame_mux);
+
+    if (segment_done && fade_done_cb != NULL) {
+        woken = fade_done_cb(fade_done_arg);
+    }
+    return woken;
+}
+
 void pwm_init(void)
 {
     ESP_LOGI(TAG, "Initializing PWM for: %s", BOARD_TYPE);
@@ -27,10 +89,19 @@ void pwm_init(void)
         .freq_hz = PWM_FREQUENCY,
         .speed_mode = PWM_SPEED_MODE,
         .timer_num = LEDC_TIMER_0,
+#ifdef CONFIG_PM_ENABLE
+        // APB follows the CPU under frequency scaling; XTAL keeps the PWM frequency fixed
+        .clk_cfg = LEDC_USE_XTAL_CLK,
+#else
         .clk_cfg = LEDC_AUTO_CLK,
+#endif
     };
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
+#ifdef CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "pwm_lit", &lit_lock));
+#endif
+
     // Configure channels
     for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
         ledc_channel_config_t ledc_channel = {
@@ -44,44 +115,175 @@ void pwm_init(void)
         ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
     }
 
+    // Hardware fade engine used for keyframed effects
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+    ledc_cbs_t fade_cbs = {
+        .fade_cb = pwm_fade_end_isr,
+    };
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        ESP_ERROR_CHECK(ledc_cb_register(PWM_SPEED_MODE, (ledc_channel_t)i, &fade_cbs, NULL));
+    }
+
     ESP_LOGI(TAG, "PWM initialized - Freq: %dHz, Resolution: %d-bit, Max duty: %lu", 
              PWM_FREQUENCY, (PWM_RESOLUTION == LEDC_TIMER_8_BIT) ? 8 : 12, (unsigned long)pwm_get_max_duty());
 }
 
 uint32_t pwm_get_max_duty(void)
 {
-    return (PWM_RESOLUTION == LEDC_TIMER_8_BIT) ? 255 : 4095;
+    return PWM_MAX_DUTY;
 }
 
-
-void pwm_set_duty(pwm_channel_t channel, uint32_t duty)
+void pwm_stage_duty(pwm_channel_t channel, uint32_t duty)
 {
     if (channel >= PWM_CHANNEL_MAX) {
         ESP_LOGE(TAG, "Invalid PWM channel: %d", channel);
         return;
     }
 
-    uint32_t max_duty = pwm_get_max_duty();
-    if (duty > max_duty) {
-        ESP_LOGW(TAG, "Duty cycle %lu exceeds maximum %lu, clamping", (unsigned long)duty, (unsigned long)max_duty);
-        duty = max_duty;
+    if (duty > PWM_MAX_DUTY) {
+        ESP_LOGW(TAG, "Duty cycle %lu exceeds maximum %lu, clamping", (unsigned long)duty, (unsigned long)PWM_MAX_DUTY);
+        duty = PWM_MAX_DUTY;
+    }
+
+    staged_duty[channel] = duty;
+    staged_mask |= (1U << channel);
+}
+
+// Latch all staged channels on the same timer period.
+// ledc_set_duty() only loads the duty registers; the new values take effect
+// when the update bit is set, at the next overflow of the shared LEDC_TIMER_0.
+// Setting all update bits back to back makes the channels switch together.
+// Returns the number of register writes saved by skipping unchanged channels.
+uint32_t pwm_commit_frame(void)
+{
+    uint8_t dirty_mask = 0;
+
+    // A running hardware fade owns the duty registers until it is stopped
+    if (fading_mask != 0) {
+        pwm_fade_stop();
+    }
+
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        if ((staged_mask & (1U << i)) && staged_duty[i] != committed_duty[i]) {
+            ESP_ERROR_CHECK(ledc_set_duty(PWM_SPEED_MODE, (ledc_channel_t)i, staged_duty[i]));
+            dirty_mask |= (1U << i);
+        }
     }
 
-    ESP_ERROR_CHECK(ledc_set_duty(PWM_SPEED_MODE, channel, duty));
-    ESP_ERROR_CHECK(ledc_update_duty(PWM_SPEED_MODE, channel));
-    
-    ESP_LOGD(TAG, "Channel %d set to duty: %lu/%lu (%.1f%%)", 
-             channel, (unsigned long)duty, (unsigned long)max_duty, (float)duty * 100.0f / max_duty);
+    if (dirty_mask != 0) {
+        portENTER_CRITICAL(&frame_mux);
+        for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+            if (dirty_mask & (1U << i)) {
+                ledc_update_duty(PWM_SPEED_MODE, (ledc_channel_t)i);
+                committed_duty[i] = staged_duty[i];
+            }
+        }
+        portEXIT_CRITICAL(&frame_mux);
+#ifdef CONFIG_PM_ENABLE
+        pwm_update_sleep_lock();
+#endif
+    }
+
+    // Only channels staged with the duty they already had count as saved;
+    // channels nobody staged this frame were never going to be written
+    uint32_t written = __builtin_popcount(dirty_mask);
+    uint32_t saved = (__builtin_popcount(staged_mask) - written) * PWM_WRITES_PER_CHANNEL;
+
+    frame_stats.frames++;
+    frame_stats.channels_written += written;
+    frame_stats.writes_saved += saved;
+    frame_stats.last_writes_saved = saved;
+    staged_mask = 0;
+
+    ESP_LOGD(TAG, "Frame committed: R=%lu, G=%lu, B=%lu, W=%lu (%lu writes saved)",
+             (unsigned long)committed_duty[PWM_CHANNEL_RED], (unsigned long)committed_duty[PWM_CHANNEL_GREEN],
+             (unsigned long)committed_duty[PWM_CHANNEL_BLUE], (unsigned long)committed_duty[PWM_CHANNEL_WARM_WHITE],
+             (unsigned long)saved);
+
+    return saved;
+}
+
+void pwm_get_frame_stats(pwm_frame_stats_t *stats)
+{
+    *stats = frame_stats;
+}
+
+void pwm_fade_set_callback(pwm_fade_done_cb_t cb, void *arg)
+{
+    fade_done_cb = cb;
+    fade_done_arg = arg;
+}
+
+// Start a linear hardware fade of all four channels towards the given duties.
+// Unchanged channels are skipped. Returns the number of channels fading; the
+// fade callback fires once the last of them reaches its target.
+uint32_t pwm_fade_rgbw(uint32_t r, uint32_t g, uint32_t b, uint32_t w, uint32_t duration_ms)
+{
+    const uint32_t target[PWM_CHANNEL_MAX] = {r, g, b, w};
+    uint8_t fade_mask = 0;
+
+    if (fading_mask != 0) {
+        pwm_fade_stop();
+    }
+
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        uint32_t duty = (target[i] > PWM_MAX_DUTY) ? PWM_MAX_DUTY : target[i];
+        if (duty != committed_duty[i]) {
+            ESP_ERROR_CHECK(ledc_set_fade_with_time(PWM_SPEED_MODE, (ledc_channel_t)i, duty, duration_ms));
+            committed_duty[i] = duty;
+            fade_mask |= (1U << i);
+        }
+    }
+
+    if (fade_mask == 0) {
+        return 0;
+    }
+
+    // Publish the full mask before any channel can finish
+    fading_mask = fade_mask;
+#ifdef CONFIG_PM_ENABLE
+    pwm_update_sleep_lock();
+#endif
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        if (fade_mask & (1U << i)) {
+            ESP_ERROR_CHECK(ledc_fade_start(PWM_SPEED_MODE, (ledc_channel_t)i, LEDC_FADE_NO_WAIT));
+        }
+    }
+
+    ESP_LOGD(TAG, "Fade started: R=%lu, G=%lu, B=%lu, W=%lu over %lums",
+             (unsigned long)r, (unsigned long)g, (unsigned long)b, (unsigned long)w, (unsigned long)duration_ms);
+
+    return __builtin_popcount(fade_mask);
+}
+
+// Abort any running fade, leaving each channel at its current duty
+void pwm_fade_stop(void)
+{
+    uint8_t mask = fading_mask;
+
+    for (int i = 0; i < PWM_CHANNEL_MAX; i++) {
+        if (mask & (1U << i)) {
+            ESP_ERROR_CHECK(ledc_fade_stop(PWM_SPEED_MODE, (ledc_channel_t)i));
+            committed_duty[i] = ledc_get_duty(PWM_SPEED_MODE, (ledc_channel_t)i);
+        }
+    }
+
+    portENTER_CRITICAL(&frame_mux);
+    fading_mask &= ~mask;
+    portEXIT_CRITICAL(&frame_mux);
+}
+
+void pwm_set_duty(pwm_channel_t channel, uint32_t duty)
+{
+    pwm_stage_duty(channel, duty);
+    pwm_commit_frame();
 }
 
 void pwm_set_rgbw(uint32_t r, uint32_t g, uint32_t b, uint32_t w)
 {
-    pwm_set_duty(PWM_CHANNEL_RED, r);
-    pwm_set_duty(PWM_CHANNEL_GREEN, g);
-    pwm_set_duty(PWM_CHANNEL_BLUE, b);
-    pwm_set_duty(PWM_CHANNEL_WARM_WHITE, w);
-    
-    uint32_t max_duty = pwm_get_max_duty();
-    ESP_LOGI(TAG, "RGBW set to: R=%lu, G=%lu, B=%lu, W=%lu (max=%lu)", 
-             (unsigned long)r, (unsigned long)g, (unsigned long)b, (unsigned long)w, (unsigned long)max_duty);
+    pwm_stage_duty(PWM_CHANNEL_RED, r);
+    pwm_stage_duty(PWM_CHANNEL_GREEN, g);
+    pwm_stage_duty(PWM_CHANNEL_BLUE, b);
+    pwm_stage_duty(PWM_CHANNEL_WARM_WHITE, w);
+    pwm_commit_frame();
 }
\ No newline at end of file
@@ -75,10 +75,38 @@ typedef enum {
 #define WARM_WHITE_GPIO  CONFIG_GPIO_WARM_WHITE
 #define MAX_CURRENT_MA   CONFIG_LED_MAX_CURRENT_MA
 
+// Maximum duty for the configured resolution (fixed at build time)
+#define PWM_MAX_DUTY     ((1UL << PWM_RESOLUTION) - 1)
+
+// LEDC register writes needed to change one channel (duty + update)
+#define PWM_WRITES_PER_CHANNEL 2
+
+// Frame commit statistics
+typedef struct {
+    uint32_t frames;             // Frames committed
+    uint32_t channels_written;   // Channels whose duty actually changed
+    uint32_t writes_saved;       // Register writes skipped for staged channels already at that duty
+    uint32_t last_writes_saved;  // Register writes skipped by the most recent frame
+} pwm_frame_stats_t;
+
+// Called from the fade ISR once every channel of a hardware fade has finished.
+// Returns true if a higher priority task was woken.
+typedef bool (*pwm_fade_done_cb_t)(void *arg);
+
 // Function declarations
 void pwm_init(void);
 void pwm_set_duty(pwm_channel_t channel, uint32_t duty);
 void pwm_set_rgbw(uint32_t r, uint32_t g, uint32_t b, uint32_t w);
 uint32_t pwm_get_max_duty(void);
 
+// Frame API: stage any number of channels, then latch them together
+void pwm_stage_duty(pwm_channel_t channel, uint32_t duty);
+uint32_t pwm_commit_frame(void);
+void pwm_get_frame_stats(pwm_frame_stats_t *stats);
+
+// Hardware fade API: hand a whole segment to the LEDC fade engine
+void pwm_fade_set_callback(pwm_fade_done_cb_t cb, void *arg);
+uint32_t pwm_fade_rgbw(uint32_t r, uint32_t g, uint32_t b, uint32_t w, uint32_t duration_ms);
+void pwm_fade_stop(void);
+
 #endif
\ No newline at end of file
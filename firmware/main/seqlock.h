@@ -0,0 +1,41 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sequence lock: one writer at a time publishes a struct while readers
+// copy it out without blocking the writer. The sequence is odd while a
+// write is in progress; a reader that saw it odd, or saw it move during
+// its copy, copies again. Writers must be serialized by the caller.
+//
+//   seqlock_write_begin(&seq);  ...update...  seqlock_write_end(&seq);
+//
+//   do {
+//       start = seqlock_read_begin(&seq);
+//       copy = data;
+//   } while (seqlock_read_retry(&seq, start));
+
+static inline void seqlock_write_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t seqlock_read_begin(const uint32_t *seq)
+{
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+static inline bool seqlock_read_retry(const uint32_t *seq, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (start & 1) || start != __atomic_load_n(seq, __ATOMIC_RELAXED);
+}
+
+#endif
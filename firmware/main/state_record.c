@@ -0,0 +1,203 @@
+#include "state_record.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+static void put_u16(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    put_u16(p, value);
+    put_u16(p + 2, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+void state_record_encode(uint8_t out[STATE_RECORD_SIZE], uint32_t seq, const light_state_t *state) {
+    put_u32(&out[0], seq);
+    out[4] = STATE_RECORD_VERSION;
+    out[5] = (uint8_t)state->type;
+    put_u16(&out[6], state->r);
+    put_u16(&out[8], state->g);
+    put_u16(&out[10], state->b);
+    put_u16(&out[12], state->w);
+    put_u16(&out[14], state->brightness);
+    out[16] = state->speed;
+    put_u16(&out[17], state->transition_ms);
+    out[19] = state->manual ? STATE_RECORD_FLAG_MANUAL : 0;
+    put_u32(&out[20], esp_rom_crc32_le(0, out, STATE_RECORD_SIZE - 4));
+}
+
+bool state_record_decode(const uint8_t in[STATE_RECORD_SIZE], uint32_t *seq, light_state_t *state) {
+    if (get_u32(&in[20]) != esp_rom_crc32_le(0, in, STATE_RECORD_SIZE - 4) ||
+        in[4] != STATE_RECORD_VERSION || in[5] >= EFFECT_MAX) {
+        return false;
+    }
+    *seq = get_u32(&in[0]);
+    *state = (light_state_t){
+        .type = (light_effect_t)in[5],
+        .r = get_u16(&in[6]),
+        .g = get_u16(&in[8]),
+        .b = get_u16(&in[10]),
+        .w = get_u16(&in[12]),
+        .brightness = get_u16(&in[14]),
+        .speed = in[16],
+        .transition_ms = get_u16(&in[17]),
+        .manual = (in[19] & STATE_RECORD_FLAG_MANUAL) != 0,
+    };
+    return true;
+}
+
+void state_record_pick_init(state_record_pick_t *pick) {
+    *pick = (state_record_pick_t){ .found = false, .slot = -1 };
+}
+
+void state_record_pick_offer(state_record_pick_t *pick, int slot, const uint8_t *data, size_t len) {
+    uint32_t seq;
+    light_state_t state;
+
+    if (len != STATE_RECORD_SIZE || !state_record_decode(data, &seq, &state)) {
+        return;
+    }
+    if (!pick->found || (int32_t)(seq - pick->seq) > 0) {
+        pick->found = true;
+        pick->slot = slot;
+        pick->seq = seq;
+        pick->state = state;
+    }
+}
+
+static bool state_equal(const light_state_t *a, const light_state_t *b) {
+    return a->type == b->type && a->r == b->r && a->g == b->g && a->b == b->b && a->w == b->w &&
+           a->brightness == b->brightness && a->speed == b->speed && a->transition_ms == b->transition_ms &&
+           a->manual == b->manual;
+}
+
+void state_record_saver_init(state_record_saver_t *saver, const state_record_io_t *io,
+                             int64_t settle_us, int64_t interval_us) {
+    memset(saver, 0, sizeof(*saver));
+    saver->io = *io;
+    saver->settle_us = settle_us;
+    saver->interval_us = interval_us;
+    saver->restorable = EFFECT_SMOOTH_FADE;
+}
+
+bool state_record_saver_load(state_record_saver_t *saver, light_state_t *state) {
+    uint8_t record[STATE_RECORD_SIZE];
+    state_record_pick_t pick;
+
+    state_record_pick_init(&pick);
+    for (int i = 0; i < STATE_RECORD_SLOTS; i++) {
+        size_t len = saver->io.read(saver->io.ctx, i, record, sizeof(record));
+        state_record_pick_offer(&pick, i, record, len);
+    }
+    saver->have_stored = pick.found;
+    saver->seq = pick.seq;
+    saver->stored = pick.state;
+    *state = pick.state;
+    if (!state_record_restorable(state->type)) {
+        state->type = EFFECT_SMOOTH_FADE;
+    }
+    if (pick.found) {
+        saver->restorable = state->type;
+    }
+    return pick.found;
+}
+
+void state_record_saver_change(state_record_saver_t *saver, const light_state_t *state, int64_t now_us) {
+    if (!saver->pending) {
+        saver->pending = true;
+        saver->first_change_us = now_us;
+    }
+    saver->state = *state;
+    if (state_record_restorable(state->type)) {
+        saver->restorable = state->type;
+    } else {
+        saver->state.type = saver->restorable;
+    }
+    saver->last_change_us = now_us;
+}
+
+// The changes have settled, or have kept coming for a whole interval, and
+// the previous write is an interval back
+static int64_t saver_due(const state_record_saver_t *saver) {
+    int64_t due = saver->last_change_us + saver->settle_us;
+
+    if (due > saver->first_change_us + saver->interval_us) {
+        due = saver->first_change_us + saver->interval_us;
+    }
+    if (saver->have_written && due < saver->last_write_us + saver->interval_us) {
+        due = saver->last_write_us + saver->interval_us;
+    }
+    return due;
+}
+
+static void rate_count(state_record_saver_t *saver, int64_t now_us) {
+    uint32_t minute = (uint32_t)(now_us / STATE_RECORD_RATE_BUCKET_US);
+    uint32_t i = minute % STATE_RECORD_RATE_BUCKETS;
+
+    if (saver->rate[i].minute != minute) {
+        saver->rate[i].minute = minute;
+        saver->rate[i].writes = 0;
+    }
+    saver->rate[i].writes++;
+}
+
+int64_t state_record_saver_poll(state_record_saver_t *saver, int64_t now_us) {
+    uint8_t record[STATE_RECORD_SIZE];
+
+    if (!saver->pending) {
+        return STATE_RECORD_NOT_DUE;
+    }
+    int64_t due = saver_due(saver);
+    if (now_us < due) {
+        return due;
+    }
+
+    if (saver->have_stored && state_equal(&saver->state, &saver->stored)) {
+        saver->pending = false;
+        saver->stats.unchanged++;
+        return STATE_RECORD_NOT_DUE;
+    }
+
+    uint32_t seq = saver->seq + 1;
+    state_record_encode(record, seq, &saver->state);
+    bool ok = saver->io.write(saver->io.ctx, state_record_slot(seq), record, sizeof(record));
+
+    // Back off a full interval after a failure too; retrying at once would
+    // only wear the flash harder
+    saver->have_written = true;
+    saver->last_write_us = now_us;
+    if (!ok) {
+        saver->stats.errors++;
+        saver->first_change_us = now_us;
+        return saver_due(saver);
+    }
+
+    saver->pending = false;
+    saver->stored = saver->state;
+    saver->seq = seq;
+    saver->have_stored = true;
+    saver->stats.writes++;
+    rate_count(saver, now_us);
+    return STATE_RECORD_NOT_DUE;
+}
+
+uint32_t state_record_saver_writes_last_hour(const state_record_saver_t *saver, int64_t now_us) {
+    uint32_t minute = (uint32_t)(now_us / STATE_RECORD_RATE_BUCKET_US);
+    uint32_t writes = 0;
+
+    for (int i = 0; i < STATE_RECORD_RATE_BUCKETS; i++) {
+        if (saver->rate[i].writes != 0 && minute - saver->rate[i].minute < STATE_RECORD_RATE_BUCKETS) {
+            writes += saver->rate[i].writes;
+        }
+    }
+    return writes;
+}
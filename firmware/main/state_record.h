@@ -0,0 +1,132 @@
+#ifndef STATE_RECORD_H
+#define STATE_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "light_effects.h"
+
+// The saved light state as stored in NVS, and which record of the ring
+// wins at boot.
+//
+// Records go round a ring of STATE_RECORD_SLOTS keys, each with a
+// sequence number and a CRC. The newest record that checks out wins, so a
+// write cut short by power loss, or a record from another layout, falls
+// back to the one before it.
+//
+// Record, little-endian:
+//   seq:u32 version effect r:u16 g:u16 b:u16 w:u16 brightness:u16 speed
+//   transition_ms:u16 flags crc:u32
+// RGBW and brightness at driver resolution; flags bit 0 is manual mode
+// (RGBW raw duty); crc is CRC-32 of the rest
+//
+// When to write: changes are collected and written once they settle
+// (settle_us without a change), never more than once per interval_us, and
+// not at all if the state is the one already stored. A slider drag costs
+// one write, not one per step.
+//
+// This module is pure: no NVS, no tasks and no clock. The slots are read
+// and written through a state_record_io_t, NVS in the state store, and
+// time comes in as arguments.
+
+#define STATE_RECORD_SLOTS      4       // Divides 2^32, so the ring survives the sequence wrapping
+#define STATE_RECORD_VERSION    2
+#define STATE_RECORD_SIZE       24
+#define STATE_RECORD_FLAG_MANUAL 0x01
+
+#define STATE_RECORD_RATE_BUCKETS   60          // One per minute of the last hour
+#define STATE_RECORD_RATE_BUCKET_US 60000000LL
+#define STATE_RECORD_NOT_DUE        INT64_MAX
+
+// Newest valid record among the slots offered so far
+typedef struct {
+    bool found;
+    int slot;
+    uint32_t seq;
+    light_state_t state;
+} state_record_pick_t;
+
+void state_record_encode(uint8_t out[STATE_RECORD_SIZE], uint32_t seq, const light_state_t *state);
+bool state_record_decode(const uint8_t in[STATE_RECORD_SIZE], uint32_t *seq, light_state_t *state);
+
+// True if a record alone can bring the effect back. Shows, programs and
+// streams play data uploaded into RAM, which a reboot loses; a state with
+// one of them is saved with the last effect that can be restored, and a
+// record holding one restores as EFFECT_SMOOTH_FADE, the boot default.
+static inline bool state_record_restorable(light_effect_t type) {
+    return type != EFFECT_TIMELINE && type != EFFECT_USER_PROGRAM && type != EFFECT_STREAM;
+}
+
+// Slot that the record with this sequence goes in
+static inline int state_record_slot(uint32_t seq) {
+    return (int)(seq % STATE_RECORD_SLOTS);
+}
+
+void state_record_pick_init(state_record_pick_t *pick);
+
+// Offer what a slot holds (len bytes, 0 if nothing). It replaces the pick
+// if it decodes and its sequence is newer, in serial number order so the
+// sequence can wrap.
+void state_record_pick_offer(state_record_pick_t *pick, int slot, const uint8_t *data, size_t len);
+
+// Slot storage. read fills buf (size bytes) and returns the length of the
+// blob, 0 if the slot is empty; write returns false if the write failed.
+typedef struct {
+    size_t (*read)(void *ctx, int slot, uint8_t *buf, size_t size);
+    bool (*write)(void *ctx, int slot, const uint8_t *data, size_t len);
+    void *ctx;
+} state_record_io_t;
+
+typedef struct {
+    uint32_t writes;              // Records written
+    uint32_t unchanged;           // Saves skipped, the state was already stored
+    uint32_t errors;              // Writes that failed
+} state_record_stats_t;
+
+// Write side of the ring: the newest record, the change waiting to be
+// written, and the write history
+typedef struct {
+    state_record_io_t io;
+    int64_t settle_us;
+    int64_t interval_us;
+
+    bool have_stored;
+    uint32_t seq;                 // Sequence of the newest record
+    light_state_t stored;         // What the newest record holds
+
+    light_effect_t restorable;    // Last effect a record can bring back
+    bool pending;
+    light_state_t state;
+    int64_t first_change_us;      // First change since the last write
+    int64_t last_change_us;
+
+    bool have_written;
+    int64_t last_write_us;        // Successful or not
+
+    state_record_stats_t stats;
+    struct {
+        uint32_t minute;
+        uint32_t writes;
+    } rate[STATE_RECORD_RATE_BUCKETS];
+} state_record_saver_t;
+
+void state_record_saver_init(state_record_saver_t *saver, const state_record_io_t *io,
+                             int64_t settle_us, int64_t interval_us);
+
+// Pick the newest valid record from the slots. Returns false if there is
+// none; otherwise the state to restore is in *state.
+bool state_record_saver_load(state_record_saver_t *saver, light_state_t *state);
+
+// The light state changed at now_us. An effect that cannot be restored is
+// saved as the last one that can.
+void state_record_saver_change(state_record_saver_t *saver, const light_state_t *state, int64_t now_us);
+
+// Write the waiting change if it is due at now_us. Returns when the next
+// write falls due, or STATE_RECORD_NOT_DUE if nothing is waiting. A failed
+// write is tried again an interval later.
+int64_t state_record_saver_poll(state_record_saver_t *saver, int64_t now_us);
+
+// Records written in the hour up to now_us
+uint32_t state_record_saver_writes_last_hour(const state_record_saver_t *saver, int64_t now_us);
+
+#endif
@@ -0,0 +1,226 @@
+#include "state_store.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "STATE_STORE";
+
+#define SAVE_DELAY_US           ((int64_t)CONFIG_LIGHT_STATE_SAVE_DELAY_MS * 1000)
+#define SAVE_INTERVAL_US        ((int64_t)CONFIG_LIGHT_STATE_SAVE_INTERVAL_S * 1000000)
+#define GROUP_SEQ_RETRY_MS      1000
+
+static const char *const slot_keys[STATE_RECORD_SLOTS] = {"rec0", "rec1", "rec2", "rec3"};
+
+// Latest state from the effects task and group sequence from the BLE
+// server, waiting for the store task
+static portMUX_TYPE pending_mux = portMUX_INITIALIZER_UNLOCKED;
+static light_state_t pending;
+static bool state_pending = false;
+static uint32_t pending_group_seq;
+static bool group_seq_pending = false;
+
+// Store task side
+static TaskHandle_t store_task_handle = NULL;
+static state_record_saver_t saver;
+static uint32_t stored_group_seq;
+static bool have_group_seq = false;
+static uint32_t unsaved_group_seq;
+static bool group_seq_unsaved = false;     // Last write failed, retry soon
+static uint32_t group_seq_errors = 0;
+static bool restored = false;
+
+// Record slots in NVS, one blob per key
+static size_t slot_read(void *ctx, int slot, uint8_t *buf, size_t size) {
+    nvs_handle_t nvs;
+    size_t len = size;
+
+    if (nvs_open(STATE_STORE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return 0;
+    }
+    if (nvs_get_blob(nvs, slot_keys[slot], buf, &len) != ESP_OK) {
+        len = 0;
+    }
+    nvs_close(nvs);
+    return len;
+}
+
+static bool slot_write(void *ctx, int slot, const uint8_t *data, size_t len) {
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open(STATE_STORE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, slot_keys[slot], data, len);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "error saving state; err=0x%x", err);
+        return false;
+    }
+    return true;
+}
+
+// Restore and start may come in either order, or only start
+static void saver_setup(void) {
+    static bool ready = false;
+
+    if (!ready) {
+        state_record_saver_init(&saver, &(state_record_io_t){ .read = slot_read, .write = slot_write },
+                                SAVE_DELAY_US, SAVE_INTERVAL_US);
+        ready = true;
+    }
+}
+
+bool state_store_restore(void) {
+    light_state_t state;
+
+    saver_setup();
+    if (!state_record_saver_load(&saver, &state)) {
+        ESP_LOGI(TAG, "No valid stored state, starting with the default effect");
+        return false;
+    }
+    light_effects_apply(&state);
+    restored = true;
+    ESP_LOGI(TAG, "Restored effect %d, brightness %lu from record %lu", state.type,
+             (unsigned long)state.brightness, (unsigned long)saver.seq);
+    return true;
+}
+
+static bool store_group_seq(uint32_t seq) {
+    nvs_handle_t nvs;
+
+    if (have_group_seq && seq == stored_group_seq) {
+        return true;
+    }
+    esp_err_t err = nvs_open(STATE_STORE_GROUP_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(nvs, STATE_STORE_GROUP_SEQ_KEY, seq);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        group_seq_errors++;
+        ESP_LOGW(TAG, "error saving group sequence; err=0x%x", err);
+        return false;
+    }
+    stored_group_seq = seq;
+    have_group_seq = true;
+    return true;
+}
+
+// Sleep until a change or until the waiting change falls due; the saver
+// decides when a state write is due. A group sequence is written as soon
+// as it arrives, ahead of any state write, and a failed one is retried
+// every GROUP_SEQ_RETRY_MS.
+static void store_task(void *pvParameters) {
+    int64_t due_us = STATE_RECORD_NOT_DUE;
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (due_us != STATE_RECORD_NOT_DUE) {
+            int64_t wait_us = due_us - esp_timer_get_time();
+            wait = wait_us > 0 ? pdMS_TO_TICKS(wait_us / 1000) + 1 : 0;
+        }
+        if (group_seq_unsaved && wait > pdMS_TO_TICKS(GROUP_SEQ_RETRY_MS)) {
+            wait = pdMS_TO_TICKS(GROUP_SEQ_RETRY_MS);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        light_state_t state;
+        uint32_t group_seq;
+        bool save_state, save_group_seq;
+
+        portENTER_CRITICAL(&pending_mux);
+        state = pending;
+        save_state = state_pending;
+        group_seq = pending_group_seq;
+        save_group_seq = group_seq_pending;
+        state_pending = false;
+        group_seq_pending = false;
+        portEXIT_CRITICAL(&pending_mux);
+
+        if (save_group_seq) {
+            unsaved_group_seq = group_seq;
+            group_seq_unsaved = true;
+        }
+        if (group_seq_unsaved) {
+            group_seq_unsaved = !store_group_seq(unsaved_group_seq);
+        }
+        if (save_state) {
+            state_record_saver_change(&saver, &state, esp_timer_get_time());
+        }
+        uint32_t writes = saver.stats.writes;
+        due_us = state_record_saver_poll(&saver, esp_timer_get_time());
+        if (saver.stats.writes != writes) {
+            ESP_LOGI(TAG, "State saved as record %lu", (unsigned long)saver.seq);
+        }
+    }
+}
+
+#ifdef CONFIG_LIGHT_STATE_PERSIST
+// State listener: runs on the effects task, must not block
+static void state_changed(const light_state_t *state) {
+    portENTER_CRITICAL(&pending_mux);
+    pending = *state;
+    state_pending = true;
+    portEXIT_CRITICAL(&pending_mux);
+    xTaskNotifyGive(store_task_handle);
+}
+#endif
+
+void state_store_start(void) {
+    if (store_task_handle != NULL) {
+        return;
+    }
+    saver_setup();
+    xTaskCreate(store_task, "state_store", 3072, NULL, 1, &store_task_handle);
+#ifdef CONFIG_LIGHT_STATE_PERSIST
+    light_effects_add_state_listener(state_changed);
+#endif
+}
+
+bool state_store_load_group_seq(uint32_t *seq) {
+    nvs_handle_t nvs;
+    bool found = false;
+
+    if (nvs_open(STATE_STORE_GROUP_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    if (nvs_get_u32(nvs, STATE_STORE_GROUP_SEQ_KEY, seq) == ESP_OK) {
+        stored_group_seq = *seq;
+        have_group_seq = true;
+        found = true;
+    }
+    nvs_close(nvs);
+    return found;
+}
+
+// Runs on the NimBLE host task, must not block
+void state_store_save_group_seq(uint32_t seq) {
+    if (store_task_handle == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&pending_mux);
+    pending_group_seq = seq;
+    group_seq_pending = true;
+    portEXIT_CRITICAL(&pending_mux);
+    xTaskNotifyGive(store_task_handle);
+}
+
+void state_store_get_stats(state_store_stats_t *out) {
+    *out = (state_store_stats_t){
+        .writes = saver.stats.writes,
+        .writes_last_hour = state_record_saver_writes_last_hour(&saver, esp_timer_get_time()),
+        .unchanged = saver.stats.unchanged,
+        .errors = saver.stats.errors + group_seq_errors,
+        .restored = restored,
+        .seq = saver.seq,
+    };
+}
@@ -0,0 +1,54 @@
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "light_effects.h"
+#include "state_record.h"
+
+// Light state that survives a power cycle. Changes are collected in RAM
+// and written once they settle (CONFIG_LIGHT_STATE_SAVE_DELAY_MS without a
+// change), never more than once per CONFIG_LIGHT_STATE_SAVE_INTERVAL_S, and
+// not at all if the state is the one already stored. A slider drag costs
+// one write, not one per step.
+//
+// Records go round a ring of NVS keys; the format, which record wins and
+// when a write is due are in state_record.h. This is the NVS and task side.
+
+#define STATE_STORE_NAMESPACE   "light"
+
+// Last accepted group command sequence (CONFIG_LIGHT_GROUP_CONTROL), a u32
+// in its own namespace
+#define STATE_STORE_GROUP_NAMESPACE "group"
+#define STATE_STORE_GROUP_SEQ_KEY   "seq"
+
+typedef struct {
+    uint32_t writes;              // Records written since boot
+    uint32_t writes_last_hour;    // ...in the last 60 minutes
+    uint32_t unchanged;           // Saves skipped, the state was already stored
+    uint32_t errors;              // NVS writes that failed
+    bool restored;                // Boot state came from a record
+    uint32_t seq;                 // Sequence of the newest record
+} state_store_stats_t;
+
+// Read the newest valid record and apply it. Call after
+// light_effects_init() and before the effects task or BLE start; returns
+// false if there was nothing to restore.
+bool state_store_restore(void);
+
+// Start the store task, and with CONFIG_LIGHT_STATE_PERSIST, saving state
+// changes
+void state_store_start(void);
+
+// Group command sequence. The BLE server keeps the live value in RAM and
+// hands every applied sequence over here; the store task writes it at
+// once, with no settle time or spacing, so the NimBLE host task never
+// waits on flash and a replay after a power cut can only hit the command
+// whose write was in flight. Group commands are sent by hand, so this is
+// one write per command, not per slider step.
+bool state_store_load_group_seq(uint32_t *seq);
+void state_store_save_group_seq(uint32_t seq);
+
+void state_store_get_stats(state_store_stats_t *stats);
+
+#endif
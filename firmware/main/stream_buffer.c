@@ -0,0 +1,137 @@
+#include "stream_buffer.h"
+#include "fixed_math.h"
+#include "effect_luts.h"
+#include <string.h>
+
+void stream_buffer_init(stream_buffer_t *sb, uint32_t latency_ms) {
+    memset(sb, 0, sizeof(*sb));
+    sb->stats.latency_ms = latency_ms;
+}
+
+uint32_t stream_buffer_push(stream_buffer_t *sb, const light_stream_frame_t *frames, uint32_t count,
+                            int64_t now_us) {
+    int64_t latency_us = (int64_t)sb->stats.latency_ms * 1000;
+    uint32_t head = sb->head;
+    uint32_t tail = __atomic_load_n(&sb->tail, __ATOMIC_ACQUIRE);
+    uint32_t accepted = 0;
+
+    if (sb->in.anchored) {
+        sb->in.offset_us += (now_us - sb->in.last_arrival_us) / 1000;
+    }
+    sb->in.last_arrival_us = now_us;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const light_stream_frame_t *f = &frames[i];
+        int32_t gap_ms = (int32_t)(f->ts_ms - sb->in.last_ts_ms);
+
+        if (!sb->in.anchored || gap_ms > STREAM_RESYNC_MS || gap_ms < -STREAM_RESYNC_MS) {
+            // First frame, or the sender restarted its clock
+            sb->in.anchored = true;
+            sb->in.sender_us = (int64_t)f->ts_ms * 1000;
+            sb->in.offset_us = now_us - sb->in.sender_us;
+        } else if (gap_ms <= 0) {
+            sb->stats.dropped++;
+            continue;
+        } else {
+            sb->in.sender_us += (int64_t)gap_ms * 1000;
+        }
+        sb->in.last_ts_ms = f->ts_ms;
+
+        if (now_us - sb->in.sender_us < sb->in.offset_us) {
+            sb->in.offset_us = now_us - sb->in.sender_us;
+        }
+        int64_t due_us = sb->in.sender_us + sb->in.offset_us + latency_us;
+        if (due_us < sb->in.last_due_us) {
+            due_us = sb->in.last_due_us;  // The mapping moved; keep play order
+        }
+
+        if (head - tail >= LIGHT_STREAM_BUFFER_FRAMES) {
+            sb->stats.dropped++;
+            continue;
+        }
+        if (due_us < now_us) {
+            sb->stats.late++;
+        }
+
+        stream_slot_t *slot = &sb->slots[head % LIGHT_STREAM_BUFFER_FRAMES];
+        slot->due_us = due_us;
+        slot->frame = (effect_frame_t){f->r, f->g, f->b, f->w};
+        sb->in.last_due_us = due_us;
+        head++;
+        accepted++;
+    }
+
+    __atomic_store_n(&sb->head, head, __ATOMIC_RELEASE);
+    sb->stats.received += accepted;
+    return accepted;
+}
+
+// Continue the a -> b trend by ahead/span, clamped to the duty range
+static uint32_t extrapolate(uint32_t a, uint32_t b, int64_t ahead_us, int64_t span_us) {
+    int64_t v = (int64_t)b + ((int64_t)b - (int64_t)a) * ahead_us / span_us;
+    return v < 0 ? 0 : (v > (int64_t)EFFECT_LUT_MAX_DUTY ? EFFECT_LUT_MAX_DUTY : (uint32_t)v);
+}
+
+void stream_buffer_play(stream_buffer_t *sb, int64_t t_us, effect_frame_t *out) {
+    uint32_t head = __atomic_load_n(&sb->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = sb->tail;
+
+    while (tail != head && sb->slots[tail % LIGHT_STREAM_BUFFER_FRAMES].due_us <= t_us) {
+        sb->before = sb->from;
+        sb->from = sb->slots[tail % LIGHT_STREAM_BUFFER_FRAMES];
+        sb->played = (sb->played < 2) ? sb->played + 1 : 2;
+        tail++;
+    }
+    __atomic_store_n(&sb->tail, tail, __ATOMIC_RELEASE);
+
+    if (sb->played == 0) {
+        memset(out, 0, sizeof(*out));  // Nothing due yet
+        return;
+    }
+
+    const effect_frame_t *from = &sb->from.frame;
+    if (tail != head) {
+        // Normal case: between the last due frame and the next one
+        const stream_slot_t *next = &sb->slots[tail % LIGHT_STREAM_BUFFER_FRAMES];
+        int64_t span_us = next->due_us - sb->from.due_us;
+        uint32_t progress = span_us > 0 ? (uint32_t)(((t_us - sb->from.due_us) << 15) / span_us) : Q15_ONE;
+
+        out->r = fx_lerp_q15(from->r, next->frame.r, progress);
+        out->g = fx_lerp_q15(from->g, next->frame.g, progress);
+        out->b = fx_lerp_q15(from->b, next->frame.b, progress);
+        out->w = fx_lerp_q15(from->w, next->frame.w, progress);
+        sb->starved = false;
+        return;
+    }
+
+    // Underrun: continue the slope of the last two frames, bounded
+    if (!sb->starved) {
+        sb->starved = true;
+        sb->stats.underruns++;
+    }
+    int64_t span_us = sb->from.due_us - sb->before.due_us;
+    int64_t ahead_us = t_us - sb->from.due_us;
+    if (ahead_us > STREAM_EXTRAPOLATE_US) {
+        ahead_us = STREAM_EXTRAPOLATE_US;
+    }
+
+    *out = *from;
+    if (sb->played == 2 && span_us > 0) {
+        const effect_frame_t *before = &sb->before.frame;
+        out->r = extrapolate(before->r, from->r, ahead_us, span_us);
+        out->g = extrapolate(before->g, from->g, ahead_us, span_us);
+        out->b = extrapolate(before->b, from->b, ahead_us, span_us);
+        out->w = extrapolate(before->w, from->w, ahead_us, span_us);
+    }
+}
+
+void stream_buffer_restart(stream_buffer_t *sb) {
+    sb->played = 0;
+    sb->starved = false;
+}
+
+void stream_buffer_get_stats(const stream_buffer_t *sb, light_stream_stats_t *stats) {
+    *stats = sb->stats;
+    stats->buffered = __atomic_load_n(&sb->head, __ATOMIC_RELAXED) -
+                      __atomic_load_n(&sb->tail, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,74 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "light_effects.h"
+#include "effects_render.h"
+
+// Jitter buffer for streamed frames (EFFECT_STREAM).
+//
+// The producer stamps each frame with its local play time: the sender's
+// ts_ms, mapped to the local clock through the fastest delivery seen so
+// far, plus the latency target. The fastest delivery ages by 1 ms per
+// second, so a sender clock that runs slow does not pile up latency. A
+// frame not newer than the last one is dropped; a sender clock jump of
+// STREAM_RESYNC_MS or more starts the mapping over.
+//
+// The consumer plays the frames on the frame clock: it moves past every
+// frame that is due and interpolates towards the next one. When the buffer
+// runs dry the trend of the last two frames is extrapolated for up to
+// STREAM_EXTRAPOLATE_US, then held.
+//
+// One producer and one consumer, on different tasks: a single-producer
+// ring like the command queue. This module is pure: times come in as
+// arguments, frames go out at full level, before brightness.
+
+#define STREAM_RESYNC_MS        1000      // A sender clock jump this large starts over
+#define STREAM_EXTRAPOLATE_US   100000    // Keep the last trend going this long on underrun
+
+typedef struct {
+    int64_t due_us;                       // Local play time
+    effect_frame_t frame;
+} stream_slot_t;
+
+typedef struct {
+    stream_slot_t slots[LIGHT_STREAM_BUFFER_FRAMES];
+    uint32_t head;                        // Written by the producer
+    uint32_t tail;                        // Written by the consumer
+    light_stream_stats_t stats;           // buffered is filled in by stream_buffer_get_stats()
+
+    // Producer side: sender clock to local clock mapping
+    struct {
+        bool anchored;
+        uint32_t last_ts_ms;
+        int64_t sender_us;                // last_ts_ms unwrapped
+        int64_t offset_us;                // Fastest delivery seen, leaking upwards
+        int64_t last_arrival_us;
+        int64_t last_due_us;
+    } in;
+
+    // Consumer side: the two frames played most recently
+    stream_slot_t from;
+    stream_slot_t before;
+    uint32_t played;                      // 0, 1 or 2 valid frames above
+    bool starved;
+} stream_buffer_t;
+
+void stream_buffer_init(stream_buffer_t *sb, uint32_t latency_ms);
+
+// Producer: add a batch of frames in sender order, arrived at now_us.
+// Returns how many were accepted.
+uint32_t stream_buffer_push(stream_buffer_t *sb, const light_stream_frame_t *frames, uint32_t count,
+                            int64_t now_us);
+
+// Consumer: the stream at local time t_us. Black until the first frame is
+// due.
+void stream_buffer_play(stream_buffer_t *sb, int64_t t_us, effect_frame_t *out);
+
+// Consumer: start again from black, as for a new stream
+void stream_buffer_restart(stream_buffer_t *sb);
+
+void stream_buffer_get_stats(const stream_buffer_t *sb, light_stream_stats_t *stats);
+
+#endif
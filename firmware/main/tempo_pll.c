@@ -0,0 +1,142 @@
+#include "tempo_pll.h"
+#include <string.h>
+
+#define US_PER_MINUTE_X100      6000000000LL
+
+static int64_t period_from_bpm(uint32_t bpm_x100) {
+    if (bpm_x100 < TEMPO_MIN_BPM_X100) {
+        bpm_x100 = TEMPO_MIN_BPM_X100;
+    } else if (bpm_x100 > TEMPO_MAX_BPM_X100) {
+        bpm_x100 = TEMPO_MAX_BPM_X100;
+    }
+    return US_PER_MINUTE_X100 / bpm_x100;
+}
+
+static int64_t period_clamp(int64_t period_us) {
+    int64_t shortest = US_PER_MINUTE_X100 / TEMPO_MAX_BPM_X100;
+    int64_t longest = US_PER_MINUTE_X100 / TEMPO_MIN_BPM_X100;
+    return period_us < shortest ? shortest : period_us > longest ? longest : period_us;
+}
+
+// Beats between the reference beat and t, rounded down
+static int64_t beats_before(const tempo_pll_t *pll, int64_t t_us) {
+    int64_t dt = t_us - pll->beat_us;
+    int64_t n = dt / pll->period_us;
+    if (dt < 0 && n * pll->period_us != dt) {
+        n--;
+    }
+    return n;
+}
+
+void tempo_pll_reset(tempo_pll_t *pll) {
+    memset(pll, 0, sizeof(*pll));
+}
+
+void tempo_pll_set_bpm(tempo_pll_t *pll, uint32_t bpm_x100, int64_t now_us) {
+    if (bpm_x100 == 0) {
+        pll->running = false;
+        pll->have_beat = false;
+        return;
+    }
+
+    int64_t period_us = period_from_bpm(bpm_x100);
+    if (pll->running) {
+        // Move the reference to the last beat so the new period starts there
+        int64_t n = beats_before(pll, now_us);
+        pll->beat_us += n * pll->period_us;
+        pll->beat_index += (uint32_t)n;
+    } else {
+        pll->running = true;
+        pll->beat_us = now_us;
+        pll->beat_index = 0;
+        pll->outliers = 0;
+    }
+    pll->period_us = period_us;
+}
+
+// Sender time to local time through the fastest delivery seen. The
+// fastest delivery ages by TEMPO_LEAK_PPM, more than any phone crystal is
+// off, so the mapping follows a sender clock that runs slow instead of
+// piling up delay. Beats come far less often than streamed frames, so it
+// ages much slower than the stream's mapping.
+static int64_t beat_local_time(tempo_pll_t *pll, uint32_t sender_ms, int64_t arrival_us) {
+    int32_t gap_ms = (int32_t)(sender_ms - pll->last_ts_ms);
+
+    if (!pll->anchored || gap_ms > TEMPO_RESYNC_MS || gap_ms < -TEMPO_RESYNC_MS) {
+        pll->anchored = true;
+        pll->sender_us = (int64_t)sender_ms * 1000;
+        pll->offset_us = arrival_us - pll->sender_us;
+    } else {
+        pll->offset_us += (arrival_us - pll->last_arrival_us) * TEMPO_LEAK_PPM / 1000000;
+        pll->sender_us += (int64_t)gap_ms * 1000;
+    }
+    pll->last_ts_ms = sender_ms;
+    pll->last_arrival_us = arrival_us;
+
+    if (arrival_us - pll->sender_us < pll->offset_us) {
+        pll->offset_us = arrival_us - pll->sender_us;
+    }
+    return pll->sender_us + pll->offset_us;
+}
+
+void tempo_pll_beat(tempo_pll_t *pll, uint32_t sender_ms, int64_t arrival_us) {
+    int64_t beat_us = beat_local_time(pll, sender_ms, arrival_us);
+
+    if (!pll->running) {
+        // Tap tempo: the first interval in range starts the grid
+        int64_t interval_us = beat_us - pll->last_beat_us;
+        if (pll->have_beat && interval_us == period_clamp(interval_us)) {
+            pll->running = true;
+            pll->period_us = interval_us;
+            pll->beat_us = beat_us;
+            pll->beat_index = 0;
+            pll->outliers = 0;
+        }
+        pll->have_beat = true;
+        pll->last_beat_us = beat_us;
+        return;
+    }
+
+    // Error against the nearest predicted beat, within half a period
+    int64_t n = beats_before(pll, beat_us + pll->period_us / 2);
+    int64_t predicted_us = pll->beat_us + n * pll->period_us;
+    int64_t error_us = beat_us - predicted_us;
+
+    if (error_us > pll->period_us / 4 || error_us < -pll->period_us / 4) {
+        // One stray tap is ignored; a run of them is a new beat
+        if (++pll->outliers >= TEMPO_OUTLIERS) {
+            int64_t interval_us = beat_us - pll->last_beat_us;
+            if (interval_us == period_clamp(interval_us)) {
+                pll->period_us = interval_us;
+            }
+            pll->beat_us = beat_us;
+            pll->beat_index += (uint32_t)n;
+            pll->outliers = 0;
+        }
+        pll->last_beat_us = beat_us;
+        return;
+    }
+
+    pll->outliers = 0;
+    pll->last_error_us = (int32_t)error_us;
+    pll->beat_us = predicted_us + (error_us >> TEMPO_PHASE_SHIFT);
+    pll->beat_index += (uint32_t)n;
+    pll->period_us = period_clamp(pll->period_us + (error_us >> TEMPO_PERIOD_SHIFT));
+    pll->last_beat_us = beat_us;
+}
+
+bool tempo_pll_position(const tempo_pll_t *pll, int64_t t_us, uint32_t *count, uint32_t *phase) {
+    if (!pll->running) {
+        return false;
+    }
+    int64_t n = beats_before(pll, t_us);
+    int64_t into_us = t_us - pll->beat_us - n * pll->period_us;
+
+    *count = pll->beat_index + (uint32_t)n;
+    *phase = (uint32_t)(((uint64_t)into_us << 32) / (uint64_t)pll->period_us);
+    return true;
+}
+
+uint32_t tempo_pll_bpm_x100(const tempo_pll_t *pll) {
+    return pll->running ? (uint32_t)(US_PER_MINUTE_X100 / pll->period_us) : 0;
+}
@@ -0,0 +1,63 @@
+#ifndef TEMPO_PLL_H
+#define TEMPO_PLL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Beat tracking for music-locked effects. The app sends a tempo, beat
+// timestamps, or both; a second-order phase-locked loop turns them into a
+// beat grid that predicts the next beats, so the light can land on a beat
+// instead of reacting to it.
+//
+// Beat timestamps are in the sender's clock (ms). They are mapped to local
+// time through the fastest delivery seen, the same way streamed frames
+// are, so BLE delay that varies from message to message does not move the
+// beat; only the shortest delivery delay remains.
+//
+// This module is pure: no clock of its own and no BLE, so it can be fed
+// synthetic beat trains off-device.
+
+#define TEMPO_MIN_BPM_X100      3000    // 30 BPM
+#define TEMPO_MAX_BPM_X100      30000   // 300 BPM
+#define TEMPO_PHASE_SHIFT       2       // Each beat corrects a quarter of its phase error
+#define TEMPO_PERIOD_SHIFT      4       // ...and a sixteenth of it into the period
+#define TEMPO_OUTLIERS          3       // Beats this far off in a row restart the grid
+#define TEMPO_RESYNC_MS         10000   // Sender clock jump that restarts the mapping
+#define TEMPO_LEAK_PPM          200     // Fastest delivery ages 0.2 ms per second
+
+typedef struct {
+    bool running;                       // Beat grid valid
+    int64_t period_us;
+    int64_t beat_us;                    // Local time of beat number beat_index
+    uint32_t beat_index;
+    int32_t last_error_us;              // Observed minus predicted, last beat
+    uint32_t outliers;                  // Consecutive beats more than a quarter off
+
+    // Sender clock to local clock
+    bool anchored;
+    uint32_t last_ts_ms;
+    int64_t sender_us;                  // last_ts_ms unwrapped
+    int64_t offset_us;                  // Fastest delivery seen, leaking upwards
+    int64_t last_arrival_us;
+    bool have_beat;                     // A beat is known while the grid is not running
+    int64_t last_beat_us;               // Local time of the previous observed beat
+} tempo_pll_t;
+
+void tempo_pll_reset(tempo_pll_t *pll);
+
+// Set the tempo. Keeps the phase if the grid is running, otherwise starts a
+// grid with a beat at now_us. 0 stops.
+void tempo_pll_set_bpm(tempo_pll_t *pll, uint32_t bpm_x100, int64_t now_us);
+
+// A beat happened at sender_ms on the sender's clock; the message arrived
+// at arrival_us. Two beats are enough to start a grid without a tempo.
+void tempo_pll_beat(tempo_pll_t *pll, uint32_t sender_ms, int64_t arrival_us);
+
+// Beat number and position in the beat (turns, Q32, 0 on the beat) at
+// local time t_us. Returns false while there is no grid.
+bool tempo_pll_position(const tempo_pll_t *pll, int64_t t_us, uint32_t *count, uint32_t *phase);
+
+// Current tempo estimate, 0 while stopped
+uint32_t tempo_pll_bpm_x100(const tempo_pll_t *pll);
+
+#endif
@@ -0,0 +1,131 @@
+#include "timeline.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "TIMELINE";
+
+// Two buffers: uploads fill the one that is not playing, commit swaps them.
+// The effects task fetches the active timeline once per frame, and a new
+// upload can only start a connection event after the commit, so the frame
+// that was still reading the old buffer has long finished by then.
+static uint8_t buffers[2][TIMELINE_MAX_BYTES];
+static timeline_t timelines[2];
+static int active_index = -1;  // -1 until the first commit
+static uint32_t next_serial = 1;
+
+static timeline_status_t status = {0};
+
+static uint8_t *staging_buffer(void) {
+    return buffers[active_index == 0 ? 1 : 0];
+}
+
+static uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+bool timeline_upload_begin(uint16_t length) {
+    if (length < TIMELINE_HEADER_SIZE || length > TIMELINE_MAX_BYTES) {
+        ESP_LOGW(TAG, "Upload of %u bytes rejected (max %u)", length, TIMELINE_MAX_BYTES);
+        status.state = TIMELINE_UPLOAD_ERROR;
+        return false;
+    }
+
+    status.state = TIMELINE_UPLOAD_RECEIVING;
+    status.length = length;
+    status.received = 0;
+    ESP_LOGI(TAG, "Receiving timeline: %u bytes", length);
+    return true;
+}
+
+bool timeline_upload_data(uint16_t offset, const uint8_t *data, uint16_t len) {
+    if (status.state != TIMELINE_UPLOAD_RECEIVING) {
+        return false;
+    }
+    if (offset != status.received || len > status.length - status.received) {
+        ESP_LOGW(TAG, "Chunk at %u+%u out of order (have %u of %u)",
+                 offset, len, status.received, status.length);
+        status.state = TIMELINE_UPLOAD_ERROR;
+        return false;
+    }
+
+    memcpy(staging_buffer() + offset, data, len);
+    status.received += len;
+    return true;
+}
+
+bool timeline_upload_commit(void) {
+    if (status.state != TIMELINE_UPLOAD_RECEIVING || status.received != status.length) {
+        ESP_LOGW(TAG, "Commit with %u of %u bytes", status.received, status.length);
+        status.state = TIMELINE_UPLOAD_ERROR;
+        return false;
+    }
+
+    int index = (active_index == 0) ? 1 : 0;
+    const uint8_t *data = buffers[index];
+    uint16_t count = read_u16(data + 4);
+    uint16_t loop_index = read_u16(data + 6);
+
+    if (data[0] != 'T' || data[1] != 'L' || data[2] != TIMELINE_VERSION ||
+        count == 0 || status.length != TIMELINE_HEADER_SIZE + count * TIMELINE_KEYFRAME_SIZE ||
+        (loop_index != TIMELINE_NO_LOOP && loop_index >= count)) {
+        ESP_LOGW(TAG, "Invalid timeline header (%u keyframes, loop %u, %u bytes)",
+                 count, loop_index, status.length);
+        status.state = TIMELINE_UPLOAD_ERROR;
+        return false;
+    }
+
+    // Validate every keyframe once, so playback never has to
+    timeline_t *tl = &timelines[index];
+    uint32_t time_ms = 0;
+    tl->data = data;
+    tl->count = count;
+    tl->loop_index = TIMELINE_NO_LOOP;
+    tl->loop_ms = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        timeline_keyframe_t kf;
+        timeline_get_keyframe(tl, i, &kf);
+        if (kf.mode >= TIMELINE_INTERP_MAX) {
+            ESP_LOGW(TAG, "Keyframe %lu: unknown interpolation %d", (unsigned long)i, kf.mode);
+            status.state = TIMELINE_UPLOAD_ERROR;
+            return false;
+        }
+        time_ms += kf.delta_ms;
+        if (i == loop_index) {
+            tl->loop_ms = time_ms;
+        }
+    }
+    tl->length_ms = time_ms;
+
+    // A loop needs some length to repeat
+    if (loop_index != TIMELINE_NO_LOOP && tl->length_ms > tl->loop_ms) {
+        tl->loop_index = loop_index;
+    }
+    tl->serial = next_serial++;
+
+    __atomic_store_n(&active_index, index, __ATOMIC_RELEASE);
+    status.state = TIMELINE_UPLOAD_READY;
+    status.count = count;
+    ESP_LOGI(TAG, "Timeline committed: %u keyframes, %lums%s", count,
+             (unsigned long)tl->length_ms, tl->loop_index != TIMELINE_NO_LOOP ? ", looping" : "");
+    return true;
+}
+
+void timeline_get_status(timeline_status_t *out) {
+    *out = status;
+}
+
+const timeline_t *timeline_get_active(void) {
+    int index = __atomic_load_n(&active_index, __ATOMIC_ACQUIRE);
+    return index < 0 ? NULL : &timelines[index];
+}
+
+void timeline_get_keyframe(const timeline_t *tl, uint32_t index, timeline_keyframe_t *kf) {
+    const uint8_t *p = tl->data + TIMELINE_HEADER_SIZE + index * TIMELINE_KEYFRAME_SIZE;
+
+    kf->delta_ms = read_u16(p);
+    kf->r = p[2];
+    kf->g = p[3];
+    kf->b = p[4];
+    kf->w = p[5];
+    kf->mode = (timeline_interp_t)p[6];
+}
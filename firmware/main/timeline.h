@@ -0,0 +1,74 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+// Timeline shows: RGBW keyframes uploaded once over BLE and played back by
+// effects_task on the frame clock, so BLE latency cannot disturb the show.
+//
+// Binary format, little-endian:
+//   header    8 bytes  'T' 'L' version flags count:u16 loop_index:u16
+//   keyframe  7 bytes  delta_ms:u16 r g b w mode
+//
+// delta_ms is the time since the previous keyframe (since the start for the
+// first one) and mode is how the segment arriving at that keyframe is
+// interpolated. After the last keyframe playback jumps back to loop_index,
+// or holds the last color if loop_index is TIMELINE_NO_LOOP. At 7 bytes per
+// keyframe a 5-minute show with a keyframe every half second is ~4 KB.
+
+#define TIMELINE_VERSION         1
+#define TIMELINE_HEADER_SIZE     8
+#define TIMELINE_KEYFRAME_SIZE   7
+#define TIMELINE_NO_LOOP         0xFFFF
+#define TIMELINE_MAX_BYTES       CONFIG_LIGHT_TIMELINE_MAX_BYTES
+
+typedef enum {
+    TIMELINE_INTERP_STEP = 0,   // Jump to the keyframe color when it is reached
+    TIMELINE_INTERP_LINEAR,     // Straight line from the previous keyframe
+    TIMELINE_INTERP_SMOOTH,     // Smoothstep ease in and out
+    TIMELINE_INTERP_MAX
+} timeline_interp_t;
+
+typedef struct {
+    uint32_t delta_ms;
+    uint8_t r, g, b, w;         // 8-bit, scaled to driver resolution on playback
+    timeline_interp_t mode;
+} timeline_keyframe_t;
+
+// A validated timeline ready for playback
+typedef struct {
+    const uint8_t *data;
+    uint16_t count;
+    uint16_t loop_index;
+    uint32_t loop_ms;           // Time of the loop keyframe
+    uint32_t length_ms;         // Time of the last keyframe
+    uint32_t serial;            // Changes with every committed upload
+} timeline_t;
+
+typedef enum {
+    TIMELINE_UPLOAD_IDLE = 0,
+    TIMELINE_UPLOAD_RECEIVING,
+    TIMELINE_UPLOAD_READY,      // Last upload committed and playing
+    TIMELINE_UPLOAD_ERROR,
+} timeline_upload_state_t;
+
+typedef struct {
+    timeline_upload_state_t state;
+    uint16_t received;          // Bytes of the current upload so far
+    uint16_t length;            // Announced size of the current upload
+    uint16_t count;             // Keyframes in the active timeline
+} timeline_status_t;
+
+// Upload, called from the BLE host task. Chunks must arrive in order.
+bool timeline_upload_begin(uint16_t length);
+bool timeline_upload_data(uint16_t offset, const uint8_t *data, uint16_t len);
+bool timeline_upload_commit(void);
+void timeline_get_status(timeline_status_t *status);
+
+// Playback side: the committed timeline, or NULL if none was uploaded
+const timeline_t *timeline_get_active(void);
+void timeline_get_keyframe(const timeline_t *tl, uint32_t index, timeline_keyframe_t *kf);
+
+#endif
@@ -0,0 +1,269 @@
+#include "host_test.h"
+#include "effects_render.h"
+#include "effect_luts.h"
+#include "effect_vm.h"
+#include "timeline.h"
+#include <stdlib.h>
+
+// Render cost per effect frame on the build machine. Absolute numbers say
+// little about the ESP32-C3; the ratios between effects, and between runs
+// before and after a change, are what to look at.
+//
+// Heap use is not relative: a frame must never allocate, since the effects
+// task has no way to fail a frame. The bench is linked with the heap calls
+// wrapped (CMakeLists.txt) and checks that every effect makes none.
+
+#define BENCH_FRAMES 200000
+#define SHOW_CHUNK   180    // Upload chunk, about one BLE write at a large MTU
+
+// Heap calls made by the firmware code and the bench since the last reset
+static uint32_t heap_calls;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    heap_calls++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    heap_calls++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    heap_calls++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    heap_calls += (ptr != NULL);
+    __real_free(ptr);
+}
+
+// OUT(sin(time), time frac, 0.5, 0): a small program with a table lookup
+static const uint8_t bench_program[] = {
+    'F', 'X', EFFECT_VM_VERSION, 0,
+    VM_OP_TIME, VM_OP_SIN, VM_OP_TIME, VM_OP_FRAC,
+    VM_OP_PUSH, 0x00, 0x40, VM_OP_PUSH, 0x00, 0x00,
+    VM_OP_OUT, VM_OP_END,
+};
+
+// Q15 immediates
+#define IMM16(x) (uint8_t)(Q15_IMM(x) & 0xFF), (uint8_t)((Q15_IMM(x) >> 8) & 0xFF)
+#define IMM32(x) (uint8_t)(Q15_IMM(x) & 0xFF), (uint8_t)((Q15_IMM(x) >> 8) & 0xFF), \
+                 (uint8_t)((Q15_IMM(x) >> 16) & 0xFF), (uint8_t)((Q15_IMM(x) >> 24) & 0xFF)
+#define Q15_IMM(x) ((uint32_t)(int32_t)((x) * 32768.0 + 0.5))
+
+// Breathing turns per second of effect time at full speed: the native
+// effect steps 0.02 rad per frame at speed 255
+#define BREATH_TURNS_PER_S (0.02 / 6.283185307179586 / (EFFECT_FRAME_US / 1e6))
+
+// The built-in breathing as a program: color * (sin(time * speed * rate) + 1) / 2
+static const uint8_t breathing_program[] = {
+    'F', 'X', EFFECT_VM_VERSION, 0,
+    VM_OP_TIME, VM_OP_SPEED, VM_OP_MUL, VM_OP_PUSH32, IMM32(BREATH_TURNS_PER_S), VM_OP_MUL,
+    VM_OP_SIN, VM_OP_PUSH32, IMM32(1.0), VM_OP_ADD, VM_OP_PUSH, IMM16(0.5), VM_OP_MUL,
+    VM_OP_DUP, VM_OP_PARAM, 0, VM_OP_MUL, VM_OP_SWAP,
+    VM_OP_DUP, VM_OP_PARAM, 1, VM_OP_MUL, VM_OP_SWAP,
+    VM_OP_DUP, VM_OP_PARAM, 2, VM_OP_MUL, VM_OP_SWAP,
+    VM_OP_PARAM, 3, VM_OP_MUL,
+    VM_OP_OUT, VM_OP_END,
+};
+
+// The built-in candle flicker as a program. The flame (variable 0) takes
+// a random step of up to 0.1 each frame, from noise sampled once per
+// frame period, and stays within 0.3..1; the warm color is the native
+// one.
+static const uint8_t candle_program[] = {
+    'F', 'X', EFFECT_VM_VERSION, 0,
+    VM_OP_LOAD, 0,
+    VM_OP_TIME, VM_OP_PUSH32, IMM32(1e6 / EFFECT_FRAME_US), VM_OP_MUL, VM_OP_NOISE,
+    VM_OP_PUSH, IMM16(0.5), VM_OP_SUB, VM_OP_PUSH, IMM16(0.2), VM_OP_MUL, VM_OP_ADD,
+    VM_OP_PUSH, IMM16(0.3), VM_OP_MAX, VM_OP_PUSH32, IMM32(1.0), VM_OP_MIN,
+    VM_OP_DUP, VM_OP_STORE, 0,
+    VM_OP_PUSH, IMM16(0.3), VM_OP_MUL, VM_OP_PUSH, IMM16(0.7), VM_OP_ADD,
+    VM_OP_DUP, VM_OP_STORE, 1,
+    VM_OP_LOAD, 1, VM_OP_PUSH, IMM16(0.4), VM_OP_MUL,
+    VM_OP_PUSH, IMM16(0.0),
+    VM_OP_LOAD, 1, VM_OP_PUSH, IMM16(0.8), VM_OP_MUL,
+    VM_OP_OUT, VM_OP_END,
+};
+
+// The largest show that fits, a keyframe every 100 ms cycling through the
+// interpolation modes, looping back to the start
+static bool load_show(void) {
+    static uint8_t show[TIMELINE_MAX_BYTES];
+    uint16_t count = (TIMELINE_MAX_BYTES - TIMELINE_HEADER_SIZE) / TIMELINE_KEYFRAME_SIZE;
+    uint16_t len = TIMELINE_HEADER_SIZE + count * TIMELINE_KEYFRAME_SIZE;
+    uint8_t *kf = show + TIMELINE_HEADER_SIZE;
+
+    show[0] = 'T';
+    show[1] = 'L';
+    show[2] = TIMELINE_VERSION;
+    show[3] = 0;
+    show[4] = (uint8_t)count;
+    show[5] = (uint8_t)(count >> 8);
+    show[6] = 0;
+    show[7] = 0;
+    for (uint16_t i = 0; i < count; i++, kf += TIMELINE_KEYFRAME_SIZE) {
+        kf[0] = 100;
+        kf[1] = 0;
+        kf[2] = (uint8_t)(i * 37);
+        kf[3] = (uint8_t)(i * 91);
+        kf[4] = (uint8_t)(255 - i * 53);
+        kf[5] = (uint8_t)(i * 13);
+        kf[6] = (uint8_t)(i % TIMELINE_INTERP_MAX);
+    }
+
+    if (!timeline_upload_begin(len)) {
+        return false;
+    }
+    for (uint16_t offset = 0; offset < len; offset += SHOW_CHUNK) {
+        uint16_t chunk = (len - offset < SHOW_CHUNK) ? len - offset : SHOW_CHUNK;
+        if (!timeline_upload_data(offset, show + offset, chunk)) {
+            return false;
+        }
+    }
+    return timeline_upload_commit();
+}
+
+static bool load_program(const uint8_t *bytes, uint16_t len) {
+    return effect_vm_upload_begin(len) && effect_vm_upload_data(0, bytes, len) &&
+           effect_vm_upload_commit();
+}
+
+// Average cost of one frame of an effect, in ns. heap_calls is left at the
+// heap calls the frames made.
+static double bench_effect(light_effect_t type, const effect_config_t *p, uint32_t *sink) {
+    effect_state_t s;
+    effect_frame_t f;
+
+    effect_state_init(&s, type, 1);
+    heap_calls = 0;
+    int64_t start = host_time_ns();
+    for (uint32_t frame = 0; frame < BENCH_FRAMES; frame++) {
+        effect_render(type, &s, p, (int64_t)frame * EFFECT_FRAME_US, &f);
+        *sink += f.r ^ f.g ^ f.b ^ f.w;
+    }
+    return (double)(host_time_ns() - start) / BENCH_FRAMES;
+}
+
+static const char *effect_name(light_effect_t type) {
+    switch (type) {
+        case EFFECT_OFF: return "off";
+        case EFFECT_STATIC: return "static";
+        case EFFECT_SMOOTH_FADE: return "smooth_fade";
+        case EFFECT_RGB_CYCLE: return "rgb_cycle";
+        case EFFECT_BREATHING: return "breathing";
+        case EFFECT_TWINKLE_PULSE: return "twinkle_pulse";
+        case EFFECT_LIGHTNING_FLASH: return "lightning_flash";
+        case EFFECT_CANDLE_FLICKER: return "candle_flicker";
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+        case EFFECT_PULSE_WAVE: return "pulse_wave";
+        case EFFECT_SOFT_TRANSITION: return "soft_transition";
+#else
+        case EFFECT_PRECISION_FADE: return "precision_fade";
+        case EFFECT_FAST_STROBE: return "fast_strobe";
+#endif
+        case EFFECT_TIMELINE: return "timeline";
+        case EFFECT_USER_PROGRAM: return "user_program";
+        default: return "?";
+    }
+}
+
+int main(void) {
+    effect_config_t p = {
+        .brightness = EFFECT_LUT_MAX_DUTY,
+        .speed = 180,
+        .r = EFFECT_LUT_MAX_DUTY, .g = EFFECT_LUT_MAX_DUTY / 3, .b = 0, .w = 0,
+        .max_duty = EFFECT_LUT_MAX_DUTY,
+    };
+    uint32_t sink = 0;
+
+    CHECK(load_program(bench_program, sizeof(bench_program)));
+    CHECK(load_show());
+
+    printf("%-16s %10s %12s\n", "effect", "ns/frame", "allocs/frame");
+    for (int type = EFFECT_OFF; type < EFFECT_STREAM; type++) {
+        double ns = bench_effect((light_effect_t)type, &p, &sink);
+        printf("%-16s %10.1f %12.2f\n", effect_name((light_effect_t)type), ns,
+               (double)heap_calls / BENCH_FRAMES);
+        CHECK_EQ(heap_calls, 0);
+    }
+
+    // Built-in effects against the same effect written as a program
+    static const struct {
+        light_effect_t type;
+        const uint8_t *program;
+        uint16_t length;
+    } ports[] = {
+        { EFFECT_BREATHING, breathing_program, sizeof(breathing_program) },
+        { EFFECT_CANDLE_FLICKER, candle_program, sizeof(candle_program) },
+    };
+    printf("\n%-16s %10s %10s\n", "effect", "native", "program");
+    for (size_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+        CHECK(load_program(ports[i].program, ports[i].length));
+        double native = bench_effect(ports[i].type, &p, &sink);
+        double program = bench_effect(EFFECT_USER_PROGRAM, &p, &sink);
+        CHECK_EQ(heap_calls, 0);
+        printf("%-16s %10.1f %10.1f\n", effect_name(ports[i].type), native, program);
+    }
+
+    // The breathing program is the built-in effect to within rounding
+    effect_state_t native, program;
+    uint32_t worst = 0;
+    CHECK(load_program(breathing_program, sizeof(breathing_program)));
+    effect_state_init(&native, EFFECT_BREATHING, 1);
+    effect_state_init(&program, EFFECT_USER_PROGRAM, 1);
+    for (uint32_t frame = 0; frame < 1000; frame++) {
+        effect_frame_t a, b;
+        effect_render(EFFECT_BREATHING, &native, &p, (int64_t)frame * EFFECT_FRAME_US, &a);
+        effect_render(EFFECT_USER_PROGRAM, &program, &p, (int64_t)frame * EFFECT_FRAME_US, &b);
+        uint32_t diff = a.r > b.r ? a.r - b.r : b.r - a.r;
+        worst = diff > worst ? diff : worst;
+    }
+    CHECK(worst <= 2);
+    printf("\n");
+
+    // Base effect plus all four overlay layers, one blend mode each: the
+    // heaviest frame the effects task composes, against its frame period
+    const effect_layer_t layers[LIGHT_OVERLAY_LAYERS] = {
+        { .type = EFFECT_CANDLE_FLICKER, .opacity = 255, .blend = LAYER_BLEND_ADD },
+        { .type = EFFECT_TWINKLE_PULSE, .opacity = 192, .blend = LAYER_BLEND_MAX },
+        { .type = EFFECT_BREATHING, .opacity = 255, .blend = LAYER_BLEND_MULTIPLY },
+        { .type = EFFECT_RGB_CYCLE, .opacity = 128, .blend = LAYER_BLEND_ALPHA },
+    };
+    effect_state_t base, layer_states[LIGHT_OVERLAY_LAYERS];
+    int64_t layer_t_us[LIGHT_OVERLAY_LAYERS];
+
+    effect_state_init(&base, EFFECT_SMOOTH_FADE, 1);
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        effect_state_init(&layer_states[i], layers[i].type, 2 + i);
+    }
+    heap_calls = 0;
+    int64_t start = host_time_ns();
+    for (uint32_t frame = 0; frame < BENCH_FRAMES; frame++) {
+        effect_frame_t f;
+        int64_t t_us = (int64_t)frame * EFFECT_FRAME_US;
+
+        effect_render(EFFECT_SMOOTH_FADE, &base, &p, t_us, &f);
+        for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+            layer_t_us[i] = t_us;
+        }
+        effect_composite(&f, layers, layer_states, &p, layer_t_us, NULL);
+        sink += f.r ^ f.g ^ f.b ^ f.w;
+    }
+    double layered_ns = (double)(host_time_ns() - start) / BENCH_FRAMES;
+    printf("%-16s %10.1f  (%.4f%% of the %d ms frame)\n", "base+4 layers", layered_ns,
+           layered_ns / (EFFECT_FRAME_US * 1000.0) * 100.0, EFFECT_UPDATE_INTERVAL_MS);
+    CHECK(layered_ns < EFFECT_FRAME_US * 1000.0);
+    CHECK_EQ(heap_calls, 0);
+
+    // Keep the renders from being optimized away
+    printf("(checksum %u)\n", (unsigned)sink);
+    return host_test_result();
+}
@@ -0,0 +1,58 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Minimal checks for the host tests: a failed check is reported and
+// counted, and the test's exit code is the number of failures.
+
+static int host_test_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long a_ = (long long)(a), b_ = (long long)(b); \
+    if (a_ != b_) { \
+        fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld != %lld)\n", \
+                __FILE__, __LINE__, #a, #b, a_, b_); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_NEAR(a, b, tol) do { \
+    long long a_ = (long long)(a), b_ = (long long)(b); \
+    long long d_ = a_ > b_ ? a_ - b_ : b_ - a_; \
+    if (d_ > (long long)(tol)) { \
+        fprintf(stderr, "%s:%d: CHECK_NEAR failed: %s ~ %s (%lld vs %lld, tolerance %lld)\n", \
+                __FILE__, __LINE__, #a, #b, a_, b_, (long long)(tol)); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define RUN_TEST(fn) do { \
+    int before_ = host_test_failures; \
+    fn(); \
+    printf("%s %s\n", host_test_failures == before_ ? "PASS" : "FAIL", #fn); \
+} while (0)
+
+static inline int host_test_result(void) {
+    if (host_test_failures) {
+        fprintf(stderr, "%d check(s) failed\n", host_test_failures);
+    }
+    return host_test_failures ? 1 : 0;
+}
+
+static inline int64_t host_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef ESP_ROM_CRC_H
+#define ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+// Host build stand-in for the ROM CRC: CRC-32 (IEEE, reflected), with the
+// ROM's convention that the running value is passed and returned
+// uninverted, so esp_rom_crc32_le(0, buf, len) is the usual CRC-32
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+#endif
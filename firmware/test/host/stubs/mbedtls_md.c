@@ -0,0 +1,149 @@
+#include "mbedtls/md.h"
+#include <stdint.h>
+#include <string.h>
+
+// SHA-256 (FIPS 180-4) and HMAC (RFC 2104), just enough for group_control.c
+
+struct mbedtls_md_info_t {
+    mbedtls_md_type_t type;
+};
+
+static const mbedtls_md_info_t sha256_info = { MBEDTLS_MD_SHA256 };
+
+#define SHA256_BLOCK    64
+#define SHA256_DIGEST   32
+
+typedef struct {
+    uint32_t h[8];
+    uint8_t block[SHA256_BLOCK];
+    size_t used;
+    uint64_t total;
+} sha256_t;
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t ror(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(sha256_t *s, const uint8_t *p) {
+    uint32_t w[64], v[8];
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(v, s->h, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = v[7] + (ror(v[4], 6) ^ ror(v[4], 11) ^ ror(v[4], 25)) +
+                      ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+        uint32_t t2 = (ror(v[0], 2) ^ ror(v[0], 13) ^ ror(v[0], 22)) +
+                      ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(&v[1], &v[0], 7 * sizeof(v[0]));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++) {
+        s->h[i] += v[i];
+    }
+}
+
+static void sha256_init(sha256_t *s) {
+    static const uint32_t h0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s->h, h0, sizeof(h0));
+    s->used = 0;
+    s->total = 0;
+}
+
+static void sha256_update(sha256_t *s, const uint8_t *p, size_t len) {
+    s->total += len;
+    while (len > 0) {
+        size_t n = SHA256_BLOCK - s->used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(s->block + s->used, p, n);
+        s->used += n;
+        p += n;
+        len -= n;
+        if (s->used == SHA256_BLOCK) {
+            sha256_block(s, s->block);
+            s->used = 0;
+        }
+    }
+}
+
+static void sha256_final(sha256_t *s, uint8_t out[SHA256_DIGEST]) {
+    uint64_t bits = s->total * 8;
+    uint8_t pad = 0x80;
+
+    sha256_update(s, &pad, 1);
+    pad = 0;
+    while (s->used != SHA256_BLOCK - 8) {
+        sha256_update(s, &pad, 1);
+    }
+    for (int i = 7; i >= 0; i--) {
+        uint8_t b = (uint8_t)(bits >> (8 * i));
+        sha256_update(s, &b, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t)(s->h[i] >> 24);
+        out[4 * i + 1] = (uint8_t)(s->h[i] >> 16);
+        out[4 * i + 2] = (uint8_t)(s->h[i] >> 8);
+        out[4 * i + 3] = (uint8_t)s->h[i];
+    }
+}
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t md_type) {
+    return md_type == MBEDTLS_MD_SHA256 ? &sha256_info : NULL;
+}
+
+int mbedtls_md_hmac(const mbedtls_md_info_t *md_info, const unsigned char *key, size_t keylen,
+                    const unsigned char *input, size_t ilen, unsigned char *output) {
+    uint8_t k0[SHA256_BLOCK] = {0}, pad[SHA256_BLOCK], inner[SHA256_DIGEST];
+    sha256_t s;
+
+    if (md_info != &sha256_info) {
+        return -1;
+    }
+    if (keylen > SHA256_BLOCK) {
+        sha256_init(&s);
+        sha256_update(&s, key, keylen);
+        sha256_final(&s, k0);
+    } else {
+        memcpy(k0, key, keylen);
+    }
+
+    for (int i = 0; i < SHA256_BLOCK; i++) {
+        pad[i] = k0[i] ^ 0x36;
+    }
+    sha256_init(&s);
+    sha256_update(&s, pad, SHA256_BLOCK);
+    sha256_update(&s, input, ilen);
+    sha256_final(&s, inner);
+
+    for (int i = 0; i < SHA256_BLOCK; i++) {
+        pad[i] = k0[i] ^ 0x5c;
+    }
+    sha256_init(&s);
+    sha256_update(&s, pad, SHA256_BLOCK);
+    sha256_update(&s, inner, SHA256_DIGEST);
+    sha256_final(&s, output);
+    return 0;
+}
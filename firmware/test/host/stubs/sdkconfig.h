@@ -0,0 +1,15 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Host build stand-in for the generated sdkconfig.h. The board is chosen by
+// the CMake HOST_BOARD option; everything else is the Kconfig default.
+
+#define CONFIG_DEVICE_NAME                  "RGBW_LED_001"
+#define CONFIG_LIGHT_TIMELINE_MAX_BYTES     4096
+#define CONFIG_LIGHT_STREAM_LATENCY_MS      80
+#define CONFIG_LIGHT_TEMPO_LEAD_MS          10
+#define CONFIG_LIGHT_STATE_SAVE_DELAY_MS    2000
+#define CONFIG_LIGHT_STATE_SAVE_INTERVAL_S  10
+#define CONFIG_BLE_CONTROL_HOLD_MS          0
+
+#endif
@@ -0,0 +1,332 @@
+#include "host_test.h"
+#include "clock_sync.h"
+#include "effects_render.h"
+#include "effect_luts.h"
+#include <string.h>
+
+// Effect clock sync: the fit against recorded block points, and beacon
+// streams replayed through clock_sync_sample() the way the BLE server
+// feeds it
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    rng_state = rng_state * 1103515245 + 12345;
+    return rng_state >> 8;
+}
+
+// One sample per block: each sample opens a block and closes the one before
+static void sync_init(clock_sync_t *sync) {
+    memset(sync, 0, sizeof(*sync));
+    clock_sync_reset(sync);
+}
+
+static void feed_block(clock_sync_t *sync, int64_t local_us, int64_t offset_us) {
+    clock_sync_sample(sync, (uint32_t)(local_us + offset_us), local_us);
+}
+
+// The line the fit must find, by brute force over every pair of points:
+// no point above it, lowest at the points' mean time
+static bool reference_fit(const clock_sync_t *sync, double *slope, double *at_mean, double *mean) {
+    uint32_t n = sync->count;
+    const clock_sync_point_t *p = sync->points;
+    bool found = false;
+
+    *mean = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        *mean += (double)p[i].local_us;
+    }
+    *mean /= n;
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t j = 0; j < n; j++) {
+            if (!(p[i].local_us <= *mean && p[j].local_us > *mean)) {
+                continue;
+            }
+            double s = (double)(p[j].offset_us - p[i].offset_us) / (double)(p[j].local_us - p[i].local_us);
+            double y = p[i].offset_us + s * (*mean - p[i].local_us);
+            bool above_all = true;
+            for (uint32_t k = 0; k < n && above_all; k++) {
+                above_all = p[i].offset_us + s * (p[k].local_us - p[i].local_us) >= p[k].offset_us - 0.5;
+            }
+            if (above_all && (!found || y < *at_mean)) {
+                found = true;
+                *slope = s;
+                *at_mean = y;
+            }
+        }
+    }
+    return found;
+}
+
+// Points exactly on a line give that line back, and late points below it
+// change nothing
+static void test_fit_line(void) {
+    clock_sync_t sync;
+    const int64_t start_us = 2000000000;
+    const int64_t offset_us = -123456789;
+    const int64_t drift_ppb = 37000;
+
+    sync_init(&sync);
+    for (int k = 0; k <= 40; k++) {
+        int64_t local_us = start_us + (int64_t)k * CLOCK_SYNC_BLOCK_US;
+        int64_t on_line = offset_us + (local_us - start_us) * drift_ppb / 1000000000;
+        int64_t late = (k % 3 == 1) ? 2000 + rng() % 3000 : 0;
+        feed_block(&sync, local_us, on_line - late);
+    }
+    CHECK(sync.model.locked);
+    CHECK_NEAR(sync.model.drift_ppb, drift_ppb, 30);
+    int64_t at = start_us + 38 * (int64_t)CLOCK_SYNC_BLOCK_US;
+    CHECK_NEAR(clock_sync_to_master(&sync.model, at) - at,
+               offset_us + (at - start_us) * drift_ppb / 1000000000, 2);
+    CHECK_EQ(sync.resets, 0);
+}
+
+static void test_fit_single_point(void) {
+    clock_sync_t sync;
+
+    sync_init(&sync);
+    feed_block(&sync, 1000, 500);
+    CHECK(!sync.model.locked);                           // Block still open
+    feed_block(&sync, 1000 + CLOCK_SYNC_BLOCK_US, 400);
+    CHECK(sync.model.locked);
+    CHECK_EQ(sync.model.drift_ppb, 0);
+    CHECK_EQ(sync.model.offset_us, 500);
+}
+
+// Random late deliveries against the brute-force fit, through many turns
+// of the ring
+static void test_fit_matches_reference(void) {
+    clock_sync_t sync;
+    int64_t local_us = 77000000;
+    int compared = 0;
+
+    sync_init(&sync);
+    for (int k = 0; k < 400; k++) {
+        int64_t offset_us = 1000000 + (local_us * 45) / 1000000 - (int64_t)(rng() % 4000);
+        feed_block(&sync, local_us, offset_us);
+        local_us += CLOCK_SYNC_BLOCK_US + rng() % 500000;
+
+        double slope = 0, at_mean = 0, mean = 0;
+        if (sync.count < 2 || !reference_fit(&sync, &slope, &at_mean, &mean)) {
+            continue;
+        }
+        double ref_ppb = slope * 1e9;
+        if (ref_ppb > CLOCK_SYNC_MAX_DRIFT_PPB) {
+            ref_ppb = CLOCK_SYNC_MAX_DRIFT_PPB;
+        } else if (ref_ppb < -CLOCK_SYNC_MAX_DRIFT_PPB) {
+            ref_ppb = -CLOCK_SYNC_MAX_DRIFT_PPB;
+        }
+        CHECK_NEAR(sync.model.drift_ppb, (int64_t)ref_ppb, 1);
+        double ref_offset = at_mean + slope * ((double)sync.model.local_ref_us - mean);
+        CHECK_NEAR(sync.model.offset_us, (int64_t)ref_offset, 2);
+        compared++;
+    }
+    CHECK(compared > 300);
+    CHECK_EQ(sync.resets, 0);
+}
+
+// A master that has been up for hours, its 32-bit beacon time wrapping
+// while three followers listen. They join at different times, one of them
+// after the wrap; each has its own crystal error, and every beacon is late
+// by a constant part plus a random wait. Each of them, and the master,
+// counts effect time on through the wrap; the one that joined after it is
+// 2^32 us behind the others, and otherwise all agree.
+
+#define MINUTE_US       60000000LL
+#define WRAP_AT_US      (20 * MINUTE_US)            // True time of the master's wrap
+#define RUN_US          (40 * MINUTE_US)
+#define FOLLOWERS       3
+#define DELAY_MIN_US    150                         // Constant part of delivery
+
+typedef struct {
+    int64_t join_us;
+    int64_t local0_us;
+    int32_t drift_ppm;
+    int64_t behind_us;                              // Wraps the master's effect time is ahead
+    clock_sync_t sync;
+    clock_sync_effect_t effect;
+    int64_t last_effect_us, last_check_us;
+    int32_t max_error_us;
+    uint32_t checks;
+} follower_t;
+
+static int64_t master_local(int64_t t) {
+    return 3 * (1LL << 32) - WRAP_AT_US + t;
+}
+
+static int64_t follower_local(const follower_t *f, int64_t t) {
+    return f->local0_us + t + t * f->drift_ppm / 1000000;
+}
+
+static void check_at(follower_t *fs, clock_sync_effect_t *master_effect, int64_t t, int32_t *max_spread) {
+    static const clock_sync_model_t master = { .locked = true };
+    int64_t master_us = clock_sync_effect_time(master_effect, &master, master_local(t));
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+
+    for (int i = 0; i < FOLLOWERS; i++) {
+        follower_t *f = &fs[i];
+        if (!f->sync.model.locked || t < f->join_us + 2 * MINUTE_US) {
+            continue;
+        }
+        int64_t effect = clock_sync_effect_time(&f->effect, &f->sync.model, follower_local(f, t));
+        if (f->checks > 0) {
+            // Never back, never a leap: the wrap is one more step forward
+            CHECK(effect >= f->last_effect_us);
+            CHECK(effect - f->last_effect_us <= t - f->last_check_us + 1000);
+        }
+        f->last_effect_us = effect;
+        f->last_check_us = t;
+
+        int64_t error = effect + f->behind_us - master_us;
+        CHECK(error > -1000000 && error < 1000000);
+        int32_t mag = (int32_t)(error < 0 ? -error : error);
+        if (mag > f->max_error_us) {
+            f->max_error_us = mag;
+        }
+        lo = error < lo ? (int32_t)error : lo;
+        hi = error > hi ? (int32_t)error : hi;
+        f->checks++;
+    }
+    if (hi >= lo && hi - lo > *max_spread) {
+        *max_spread = hi - lo;
+    }
+}
+
+// Once a second, and millisecond by millisecond through the wrap
+static int64_t next_check(int64_t t) {
+    const int64_t dense_from = WRAP_AT_US - 50000, dense_to = WRAP_AT_US + 50000;
+
+    if (t >= dense_from && t < dense_to) {
+        return t + 1000;
+    }
+    if (t < dense_from && t + 1000000 > dense_from) {
+        return dense_from;
+    }
+    return t + 1000000;
+}
+
+static void test_beacon_wrap(void) {
+    follower_t fs[FOLLOWERS] = {
+        { .join_us = 0,                .local0_us = 11000000000LL, .drift_ppm = 30 },
+        { .join_us = 15 * MINUTE_US,   .local0_us = 4000000,       .drift_ppm = -45 },
+        { .join_us = 25 * MINUTE_US,   .local0_us = 987654321,     .drift_ppm = 10,
+          .behind_us = 1LL << 32 },
+    };
+    clock_sync_effect_t master_effect = {0};
+    int32_t max_spread = 0;
+    int64_t check_us = 0;
+
+    for (int i = 0; i < FOLLOWERS; i++) {
+        sync_init(&fs[i].sync);
+    }
+    for (int64_t t = 0; t < RUN_US; t += 80000 + rng() % 40000) {
+        uint32_t beacon = (uint32_t)master_local(t);
+        for (int i = 0; i < FOLLOWERS; i++) {
+            follower_t *f = &fs[i];
+            if (t < f->join_us || rng() % 5 == 0) {
+                continue;
+            }
+            int64_t arrival = t + DELAY_MIN_US + rng() % 6000;
+            clock_sync_sample(&f->sync, beacon, follower_local(f, arrival));
+        }
+        for (; check_us <= t; check_us = next_check(check_us)) {
+            check_at(fs, &master_effect, check_us, &max_spread);
+        }
+    }
+
+    for (int i = 0; i < FOLLOWERS; i++) {
+        printf("follower %d: %lu checks, max error %ld us, drift %ld ppb\n", i,
+               (unsigned long)fs[i].checks, (long)fs[i].max_error_us, (long)fs[i].sync.model.drift_ppb);
+        CHECK(fs[i].checks > 700);
+        CHECK_EQ(fs[i].sync.resets, 0);
+        CHECK(fs[i].max_error_us < 750);
+        CHECK_NEAR(fs[i].sync.model.drift_ppb, -fs[i].drift_ppm * 1000, 5000);
+    }
+    printf("max spread between followers %ld us\n", (long)max_spread);
+    CHECK(max_spread < 400);
+
+    // The master and the first follower started before the wrap and have
+    // counted through it; the last one started after
+    CHECK(master_effect.effect_us > (1LL << 32));
+    CHECK_NEAR(fs[0].effect.effect_us - fs[2].effect.effect_us, 1LL << 32, 1000);
+}
+
+// A follower that first hears the master just before the wrap
+static void test_join_at_wrap(void) {
+    clock_sync_t sync;
+    const clock_sync_model_t master = { .locked = true };
+    clock_sync_effect_t effect = {0}, master_effect = {0};
+    int64_t local0 = 123456789;
+    int64_t worst = 0;
+
+    sync_init(&sync);
+    for (int64_t t = 0; t < 5 * MINUTE_US; t += 100000) {
+        int64_t m = (1LL << 32) - 2000000 + t;          // Wraps 2 s in
+        clock_sync_sample(&sync, (uint32_t)m, local0 + t + DELAY_MIN_US + rng() % 3000);
+        if (sync.model.locked && t > 30000000) {
+            int64_t error = clock_sync_effect_time(&effect, &sync.model, local0 + t) -
+                            clock_sync_effect_time(&master_effect, &master, m);
+            worst = error < 0 ? (-error > worst ? -error : worst) : (error > worst ? error : worst);
+        }
+    }
+    CHECK(sync.model.locked);
+    CHECK_EQ(sync.resets, 0);
+    CHECK(worst < 1000);
+}
+
+// Effect time from the unwrapped clock, rendered frame by frame through the
+// master's wrap: every effect steps one frame at a time, so nothing jumps
+static void test_render_across_wrap(void) {
+    static const light_effect_t types[] = {
+        EFFECT_SMOOTH_FADE, EFFECT_RGB_CYCLE, EFFECT_BREATHING, EFFECT_LIGHTNING_FLASH,
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+        EFFECT_PULSE_WAVE, EFFECT_SOFT_TRANSITION,
+#else
+        EFFECT_PRECISION_FADE, EFFECT_FAST_STROBE,
+#endif
+    };
+    const clock_sync_model_t master = { .locked = true };
+    const effect_config_t p = {
+        .brightness = EFFECT_LUT_MAX_DUTY, .speed = 200,
+        .r = EFFECT_LUT_MAX_DUTY, .g = EFFECT_LUT_MAX_DUTY / 2, .max_duty = EFFECT_LUT_MAX_DUTY,
+    };
+
+    for (size_t k = 0; k < sizeof(types) / sizeof(types[0]); k++) {
+        clock_sync_effect_t effect = {0};
+        effect_state_t s;
+        effect_frame_t f;
+        int64_t local = 5 * (1LL << 32) - 300 * EFFECT_FRAME_US;
+        uint32_t hue_step = 0;
+        bool hue_fade = types[k] == EFFECT_SMOOTH_FADE;
+#ifdef CONFIG_BOARD_ESP32C3_NO_OLED
+        hue_fade |= types[k] == EFFECT_PRECISION_FADE;
+#endif
+
+        effect_state_init(&s, types[k], 1);
+        for (int i = 0; i < 600; i++, local += EFFECT_FRAME_US) {
+            uint32_t frame = s.frame, hue = s.fade.hue;
+            effect_render(types[k], &s, &p, clock_sync_effect_time(&effect, &master, local), &f);
+            if (i == 0) {
+                continue;
+            }
+            CHECK_EQ(s.frame - frame, 1);
+            if (hue_fade) {
+                if (i == 1) {
+                    hue_step = s.fade.hue - hue;
+                }
+                CHECK_EQ(s.fade.hue - hue, hue_step);
+            }
+        }
+        CHECK(effect.effect_us > (1LL << 32));          // Counted through the wrap
+    }
+}
+
+int main(void) {
+    RUN_TEST(test_fit_line);
+    RUN_TEST(test_fit_single_point);
+    RUN_TEST(test_fit_matches_reference);
+    RUN_TEST(test_beacon_wrap);
+    RUN_TEST(test_join_at_wrap);
+    RUN_TEST(test_render_across_wrap);
+    return host_test_result();
+}
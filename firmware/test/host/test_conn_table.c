@@ -0,0 +1,210 @@
+#include "host_test.h"
+#include "conn_table.h"
+
+// Several centrals against the connection table, driven the way the BLE
+// server drives it from GAP events. The simulated controller stops
+// advertising on every connect, as NimBLE does, and the server restarts it
+// while a slot is free.
+
+#define SLOTS 3
+
+typedef struct {
+    conn_table_t table;
+    bool advertising;
+    int connected_calls;      // light_effects_set_ble_connected(true)
+    int disconnected_calls;   // light_effects_set_ble_connected(false)
+    bool light_connected;
+} gap_sim_t;
+
+static void sim_init(gap_sim_t *sim, uint32_t hold_ms) {
+    *sim = (gap_sim_t){0};
+    conn_table_init(&sim->table, SLOTS, hold_ms);
+    sim->advertising = true;
+}
+
+// ble_advertise()
+static void sim_advertise(gap_sim_t *sim) {
+    if (conn_table_should_advertise(&sim->table, sim->advertising)) {
+        sim->advertising = true;
+    }
+}
+
+// BLE_GAP_EVENT_CONNECT with conn_added()
+static int sim_connect(gap_sim_t *sim, uint16_t handle) {
+    uint32_t count = sim->table.count;
+
+    sim->advertising = false;
+    int slot = conn_table_add(&sim->table, handle);
+    if (slot >= 0 && sim->table.count != count && sim->table.count == 1) {
+        sim->connected_calls++;
+        sim->light_connected = true;
+    }
+    sim_advertise(sim);
+    return slot;
+}
+
+// BLE_GAP_EVENT_DISCONNECT with conn_removed()
+static int sim_disconnect(gap_sim_t *sim, uint16_t handle) {
+    int slot = conn_table_remove(&sim->table, handle);
+    if (slot >= 0 && sim->table.count == 0) {
+        sim->disconnected_calls++;
+        sim->light_connected = false;
+    }
+    sim_advertise(sim);
+    return slot;
+}
+
+static void test_fill_and_drain(void) {
+    gap_sim_t sim;
+    sim_init(&sim, 0);
+
+    CHECK_EQ(sim_connect(&sim, 10), 0);
+    CHECK(sim.advertising);                   // Two slots left
+    CHECK(sim.light_connected);
+    CHECK_EQ(sim_connect(&sim, 11), 1);
+    CHECK(sim.advertising);
+    CHECK_EQ(sim_connect(&sim, 12), 2);
+    CHECK(!sim.advertising);                  // Full: stay quiet
+    CHECK_EQ(sim.table.count, 3);
+    CHECK_EQ(sim.connected_calls, 1);         // Only the first connect counts
+
+    // Advertising completing while full does not restart it
+    sim_advertise(&sim);
+    CHECK(!sim.advertising);
+
+    // The middle one leaves: its slot is free and advertising resumes
+    CHECK_EQ(sim_disconnect(&sim, 11), 1);
+    CHECK(sim.advertising);
+    CHECK_EQ(sim.table.count, 2);
+    CHECK(sim.light_connected);
+    CHECK_EQ(conn_table_find(&sim.table, 11), -1);
+    CHECK_EQ(conn_table_find(&sim.table, 12), 2);
+
+    // The next central takes the freed slot
+    CHECK_EQ(sim_connect(&sim, 13), 1);
+    CHECK(!sim.advertising);
+
+    CHECK_EQ(sim_disconnect(&sim, 10), 0);
+    CHECK(sim.advertising);
+    CHECK_EQ(sim_disconnect(&sim, 13), 1);
+    CHECK(sim.light_connected);
+    CHECK_EQ(sim.disconnected_calls, 0);
+    CHECK_EQ(sim_disconnect(&sim, 12), 2);
+    CHECK(!sim.light_connected);              // Last one out hands the light back
+    CHECK_EQ(sim.disconnected_calls, 1);
+    CHECK_EQ(sim.table.count, 0);
+    CHECK(sim.advertising);
+}
+
+// Repeated and stray events leave the count alone
+static void test_refcount_balance(void) {
+    gap_sim_t sim;
+    sim_init(&sim, 0);
+
+    CHECK_EQ(sim_connect(&sim, 5), 0);
+    CHECK_EQ(sim_connect(&sim, 5), 0);
+    CHECK_EQ(sim.table.count, 1);
+    CHECK_EQ(sim_disconnect(&sim, 6), -1);
+    CHECK_EQ(sim.table.count, 1);
+    CHECK_EQ(sim_connect(&sim, CONN_TABLE_NONE), -1);
+    CHECK_EQ(sim.table.count, 1);
+
+    CHECK_EQ(sim_disconnect(&sim, 5), 0);
+    CHECK_EQ(sim_disconnect(&sim, 5), -1);
+    CHECK_EQ(sim.table.count, 0);
+    CHECK_EQ(sim.connected_calls, 1);
+    CHECK_EQ(sim.disconnected_calls, 1);
+
+    // A connect beyond the slots is refused and changes nothing
+    for (uint16_t h = 1; h <= SLOTS; h++) {
+        CHECK(sim_connect(&sim, h) >= 0);
+    }
+    CHECK_EQ(sim_connect(&sim, 99), -1);
+    CHECK_EQ(sim.table.count, SLOTS);
+    CHECK_EQ(conn_table_find(&sim.table, 99), -1);
+}
+
+// Connect and disconnect storms in every order keep the table consistent
+static void test_churn(void) {
+    gap_sim_t sim;
+    bool present[8] = {0};
+    uint32_t rng = 12345;
+
+    sim_init(&sim, 0);
+    for (int step = 0; step < 20000; step++) {
+        rng = rng * 1103515245 + 12345;
+        uint16_t handle = (rng >> 16) % 8;
+        uint32_t in_use = 0;
+
+        if ((rng >> 8) & 1) {
+            int slot = sim_connect(&sim, handle);
+            for (int i = 0; i < 8; i++) in_use += present[i];
+            if (!present[handle] && in_use < SLOTS) {
+                CHECK(slot >= 0);
+                present[handle] = true;
+            } else if (!present[handle]) {
+                CHECK_EQ(slot, -1);
+            }
+        } else {
+            int slot = sim_disconnect(&sim, handle);
+            CHECK_EQ(slot >= 0, present[handle]);
+            present[handle] = false;
+        }
+
+        in_use = 0;
+        for (int i = 0; i < 8; i++) {
+            in_use += present[i];
+            CHECK_EQ(conn_table_find(&sim.table, i) >= 0, present[i]);
+        }
+        CHECK_EQ(sim.table.count, in_use);
+        CHECK_EQ(sim.light_connected, in_use > 0);
+        CHECK_EQ(sim.advertising, in_use < SLOTS);
+    }
+    CHECK_EQ(sim.connected_calls - sim.disconnected_calls, sim.light_connected ? 1 : 0);
+}
+
+static void test_control_last_writer_wins(void) {
+    gap_sim_t sim;
+    sim_init(&sim, 0);
+    sim_connect(&sim, 1);
+    sim_connect(&sim, 2);
+
+    CHECK(conn_table_claim_control(&sim.table, 1, 1000));
+    CHECK(conn_table_claim_control(&sim.table, 2, 1001));
+    CHECK(conn_table_claim_control(&sim.table, 1, 1002));
+    CHECK_EQ(sim.table.control_owner, 1);
+}
+
+static void test_control_hold(void) {
+    gap_sim_t sim;
+    sim_init(&sim, 500);
+    sim_connect(&sim, 1);
+    sim_connect(&sim, 2);
+
+    CHECK(conn_table_claim_control(&sim.table, 1, 1000));
+    CHECK(!conn_table_claim_control(&sim.table, 2, 1200));
+    CHECK(conn_table_claim_control(&sim.table, 1, 1400));   // Owner keeps writing
+    CHECK(!conn_table_claim_control(&sim.table, 2, 1899));
+    CHECK(conn_table_claim_control(&sim.table, 2, 1900));   // Quiet for 500 ms
+    CHECK_EQ(sim.table.control_owner, 2);
+
+    // The owner leaving frees control at once
+    CHECK(!conn_table_claim_control(&sim.table, 1, 2000));
+    sim_disconnect(&sim, 2);
+    CHECK(conn_table_claim_control(&sim.table, 1, 2001));
+
+    // Across the millisecond clock wrapping
+    CHECK(conn_table_claim_control(&sim.table, 1, 0xFFFFFF00u));
+    sim_connect(&sim, 3);
+    CHECK(!conn_table_claim_control(&sim.table, 3, 0x00000010u));
+    CHECK(conn_table_claim_control(&sim.table, 3, 0x00000200u));
+}
+
+int main(void) {
+    RUN_TEST(test_fill_and_drain);
+    RUN_TEST(test_refcount_balance);
+    RUN_TEST(test_churn);
+    RUN_TEST(test_control_last_writer_wins);
+    RUN_TEST(test_control_hold);
+    return host_test_result();
+}
@@ -0,0 +1,90 @@
+#include <math.h>
+#include "host_test.h"
+#include "dimming.h"
+#include "effect_luts.h"
+
+// The dimming curve and quantizer for the board this is built for, judged
+// in CIE L*: logical levels are lightness, so one level up should look
+// like one even step, and the duty that comes out should never go down.
+
+#define MAX_DUTY EFFECT_LUT_MAX_DUTY
+
+// CIE 1931 lightness (0..100) of a duty
+static double lightness(double duty) {
+    double y = duty / MAX_DUTY;
+    return y <= 0.008856 ? 903.3 * y : 116.0 * cbrt(y) - 16.0;
+}
+
+static void test_monotonic(void) {
+    CHECK_EQ(dimming_duty_q16(0), 0);
+    CHECK_EQ(dimming_duty_q16(MAX_DUTY), MAX_DUTY << 16);
+    CHECK_EQ(dimming_duty_q16(MAX_DUTY + 100), MAX_DUTY << 16);   // Clamped
+
+    for (uint32_t k = 0; k < MAX_DUTY; k++) {
+        uint32_t a = dimming_duty_q16(k), b = dimming_duty_q16(k + 1);
+        CHECK(b >= a);
+        CHECK(dimming_round(b) >= dimming_round(a));
+    }
+}
+
+// Each logical step is 100 / MAX_DUTY in L*. The curve itself follows that
+// closely. After rounding to a whole duty a step can be up to one duty LSB
+// more, which is largest just above black, where the driver has nothing
+// finer to give.
+static void test_lightness_steps(void) {
+    const double ideal = 100.0 / MAX_DUTY;
+    const double lsb = lightness(1);
+    double worst_curve = 0, worst_step = 0;
+    uint32_t worst_at = 0;
+
+    for (uint32_t k = 0; k <= MAX_DUTY; k++) {
+        double exact = lightness(dimming_duty_q16(k) / 65536.0);
+        double error = fabs(exact - k * ideal);
+        worst_curve = error > worst_curve ? error : worst_curve;
+        if (k < MAX_DUTY) {
+            uint32_t d0 = dimming_round(dimming_duty_q16(k));
+            uint32_t d1 = dimming_round(dimming_duty_q16(k + 1));
+            double step = lightness(d1) - lightness(d0);
+            CHECK(d1 == d0 || step <= 2 * ideal + lightness(d1) - lightness(d1 - 1));
+            if (step > worst_step) {
+                worst_step = step;
+                worst_at = k;
+            }
+        }
+    }
+    printf("duty 0..%u: L* per level %.4f, curve error %.4f, worst step %.4f at level %u (1 LSB %.4f)\n",
+           (unsigned)MAX_DUTY, ideal, worst_curve, worst_step, (unsigned)worst_at, lsb);
+    CHECK(worst_curve < ideal);
+    CHECK(worst_step <= lsb + ideal);
+}
+
+// Dithered, a held level averages to its fractional duty; rounded, it is
+// one fixed duty and the carry is dropped
+static void test_dither_average(void) {
+    const uint32_t frames = 4096;
+    const uint32_t levels[] = {1, 7, MAX_DUTY / 10, MAX_DUTY / 2, MAX_DUTY - 1};
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        uint32_t duty_q16 = dimming_duty_q16(levels[i]);
+        uint32_t residue = 0, lo = duty_q16 >> 16;
+        uint64_t sum = 0;
+
+        for (uint32_t f = 0; f < frames; f++) {
+            uint32_t duty = dimming_quantize(&residue, duty_q16, true);
+            CHECK(duty == lo || duty == lo + 1);
+            sum += duty;
+        }
+        uint64_t exact = (uint64_t)duty_q16 * frames;
+        CHECK(sum * 65536 <= exact && exact - sum * 65536 < 65536);
+
+        CHECK_EQ(dimming_quantize(&residue, duty_q16, false), dimming_round(duty_q16));
+        CHECK_EQ(residue, 0);
+    }
+}
+
+int main(void) {
+    RUN_TEST(test_monotonic);
+    RUN_TEST(test_lightness_steps);
+    RUN_TEST(test_dither_average);
+    return host_test_result();
+}
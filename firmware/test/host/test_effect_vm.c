@@ -0,0 +1,196 @@
+#include "host_test.h"
+#include "effect_vm.h"
+#include <string.h>
+
+// Verifier and interpreter checks for uploaded effect programs
+
+#define HEADER 'F', 'X', EFFECT_VM_VERSION, 0
+
+static effect_vm_program_t prog;
+
+#define COMPILES(...) compiles((const uint8_t[]){HEADER, __VA_ARGS__}, \
+                               sizeof((const uint8_t[]){HEADER, __VA_ARGS__}))
+
+static bool compiles(const uint8_t *bytes, uint16_t len) {
+    memset(&prog, 0, sizeof(prog));
+    return effect_vm_compile(bytes, len, &prog);
+}
+
+static bool run(int32_t vars[EFFECT_VM_VARS], effect_vm_output_t *out) {
+    effect_vm_input_t in = {
+        .t_us = 1500000,
+        .speed = 16384,
+        .param = {32768, 0, 8192, 0},
+    };
+    memset(out, 0, sizeof(*out));
+    return effect_vm_run(&prog, vars, &in, out);
+}
+
+static void test_header(void) {
+    static const uint8_t bad_magic[] = {'F', 'Y', EFFECT_VM_VERSION, 0, VM_OP_END};
+    static const uint8_t bad_version[] = {'F', 'X', EFFECT_VM_VERSION + 1, 0, VM_OP_END};
+    uint8_t too_long[EFFECT_VM_HEADER_SIZE + EFFECT_VM_MAX_CODE + 1] = {HEADER};
+
+    CHECK(!compiles(bad_magic, sizeof(bad_magic)));
+    CHECK(!compiles(bad_version, sizeof(bad_version)));
+    CHECK(!compiles(bad_magic, 3));
+    CHECK(!compiles(too_long, sizeof(too_long)));
+    CHECK(compiles(too_long, sizeof(too_long) - 1));  // All END
+    CHECK(COMPILES());                                  // Empty: dark frame
+}
+
+static void test_bad_opcodes(void) {
+    CHECK(!COMPILES(0x07));                  // Gap in the opcode table
+    CHECK(!COMPILES(0x3F));
+    CHECK(!COMPILES(0x40));                  // Past the table
+    CHECK(!COMPILES(0xFF));
+    CHECK(!COMPILES(VM_OP_PUSH, 0x00));      // Immediate cut off
+    CHECK(!COMPILES(VM_OP_PUSH32, 1, 2, 3));
+    CHECK(!COMPILES(VM_OP_LOAD));
+}
+
+static void test_operand_range(void) {
+    CHECK(COMPILES(VM_OP_LOAD, EFFECT_VM_VARS - 1, VM_OP_DROP));
+    CHECK(!COMPILES(VM_OP_LOAD, EFFECT_VM_VARS, VM_OP_DROP));
+    CHECK(!COMPILES(VM_OP_PUSH, 0, 0, VM_OP_STORE, EFFECT_VM_VARS));
+    CHECK(COMPILES(VM_OP_PARAM, 3, VM_OP_DROP));
+    CHECK(!COMPILES(VM_OP_PARAM, 4, VM_OP_DROP));
+}
+
+static void test_jumps(void) {
+    // Targets are code offsets: 0 is the first byte after the header
+    CHECK(COMPILES(VM_OP_JMP, 3, 0, VM_OP_END));        // To the next instruction
+    CHECK(COMPILES(VM_OP_JMP, 3, 0));                   // To the end of the code
+    CHECK(!COMPILES(VM_OP_JMP, 4, 0));                  // Past the end
+    CHECK(!COMPILES(VM_OP_JMP, 0xFF, 0xFF));
+    CHECK(!COMPILES(VM_OP_PUSH, 0, 0, VM_OP_JMP, 1, 0)); // Into an immediate
+    CHECK(!COMPILES(VM_OP_PUSH, 1, 0, VM_OP_JZ, 200, 0));
+    CHECK(COMPILES(VM_OP_JMP, 0, 0));                    // Loops are legal
+}
+
+static void test_stack_depth(void) {
+    CHECK(!COMPILES(VM_OP_DROP));                                      // Underflow
+    CHECK(!COMPILES(VM_OP_PUSH, 0, 0, VM_OP_ADD));
+    CHECK(!COMPILES(VM_OP_PUSH, 0, 0, VM_OP_PUSH, 0, 0, VM_OP_PUSH, 0, 0, VM_OP_OUT));
+    CHECK(!COMPILES(VM_OP_JZ, 3, 0));                                  // JZ pops its condition
+
+    // Exactly full is fine, one more overflows
+    uint8_t code[EFFECT_VM_HEADER_SIZE + 3 * (EFFECT_VM_STACK_SIZE + 1)] = {HEADER};
+    for (int i = 0; i <= EFFECT_VM_STACK_SIZE; i++) {
+        code[EFFECT_VM_HEADER_SIZE + 3 * i] = VM_OP_PUSH;
+    }
+    CHECK(compiles(code, sizeof(code) - 3));
+    CHECK(!compiles(code, sizeof(code)));
+
+    // A loop that grows the stack every pass overflows on some pass
+    CHECK(!COMPILES(VM_OP_PUSH, 0, 0, VM_OP_JMP, 0, 0));
+
+    // Paths that meet with different depths
+    CHECK(!COMPILES(VM_OP_PUSH, 0, 0,          // 0: c
+                    VM_OP_JZ, 9, 0,            // 3: -> 9 with depth 0
+                    VM_OP_PUSH, 1, 0,          // 6: depth 1 at 9
+                    VM_OP_END));               // 9
+    CHECK(COMPILES(VM_OP_PUSH, 0, 0,
+                   VM_OP_JZ, 10, 0,
+                   VM_OP_PUSH, 1, 0, VM_OP_DROP,
+                   VM_OP_END));                // 10: depth 0 both ways
+}
+
+static void test_run(void) {
+    int32_t vars[EFFECT_VM_VARS] = {0};
+    effect_vm_output_t out;
+
+    // OUT(0.5 + 0.25, param R, time frac, speed)
+    CHECK(COMPILES(VM_OP_PUSH, 0x00, 0x40, VM_OP_PUSH, 0x00, 0x20, VM_OP_ADD,
+                   VM_OP_PARAM, 0,
+                   VM_OP_TIME, VM_OP_FRAC,
+                   VM_OP_SPEED,
+                   VM_OP_OUT));
+    CHECK(run(vars, &out));
+    CHECK_EQ(out.r, 24576);
+    CHECK_EQ(out.g, 32768);
+    CHECK_EQ(out.b, 16384);   // 1.5 s
+    CHECK_EQ(out.w, 16384);
+
+    // A counter in a variable survives between frames
+    CHECK(COMPILES(VM_OP_LOAD, 0, VM_OP_PUSH, 1, 0, VM_OP_ADD, VM_OP_STORE, 0));
+    memset(vars, 0, sizeof(vars));
+    for (int i = 0; i < 5; i++) {
+        CHECK(run(vars, &out));
+    }
+    CHECK_EQ(vars[0], 5);
+
+    // Division by zero gives zero instead of trapping
+    CHECK(COMPILES(VM_OP_PUSH, 0x00, 0x40, VM_OP_PUSH, 0, 0, VM_OP_DIV,
+                   VM_OP_DUP, VM_OP_DUP, VM_OP_DUP, VM_OP_OUT));
+    CHECK(run(vars, &out));
+    CHECK_EQ(out.r, 0);
+}
+
+static void test_budget(void) {
+    int32_t vars[EFFECT_VM_VARS] = {0};
+    effect_vm_output_t out;
+    effect_vm_status_t before, after;
+
+    effect_vm_get_status(&before);
+
+    // Set a color, then spin: the frame stops at the budget with the color
+    CHECK(COMPILES(VM_OP_PUSH, 0x00, 0x40, VM_OP_DUP, VM_OP_DUP, VM_OP_DUP, VM_OP_OUT,
+                   VM_OP_JMP, 7, 0));
+    CHECK(!run(vars, &out));
+    CHECK_EQ(out.r, 16384);
+    CHECK(!run(vars, &out));
+
+    effect_vm_get_status(&after);
+    CHECK_EQ(after.budget_overruns - before.budget_overruns, 2);
+
+    // A long but bounded loop stays within it: count down from 50
+    CHECK(COMPILES(VM_OP_PUSH, 50, 0, VM_OP_STORE, 0,         // 0
+                   VM_OP_LOAD, 0, VM_OP_JZ, 21, 0,            // 5: done at 0
+                   VM_OP_LOAD, 0, VM_OP_PUSH, 1, 0, VM_OP_SUB,
+                   VM_OP_STORE, 0, VM_OP_JMP, 5, 0,           // 18
+                   VM_OP_END));                               // 21
+    CHECK(run(vars, &out));
+    CHECK_EQ(vars[0], 0);
+    effect_vm_get_status(&before);
+    CHECK_EQ(before.budget_overruns, after.budget_overruns);
+}
+
+static void test_upload(void) {
+    static const uint8_t good[] = {HEADER, VM_OP_END};
+    static const uint8_t bad[] = {HEADER, VM_OP_DROP};
+    effect_vm_status_t status;
+
+    CHECK(effect_vm_upload_begin(sizeof(good)));
+    CHECK(effect_vm_upload_data(0, good, sizeof(good)));
+    CHECK(effect_vm_upload_commit());
+    const effect_vm_program_t *active = effect_vm_get_active();
+    CHECK(active != NULL);
+    uint32_t serial = active ? active->serial : 0;
+
+    // A program that fails verification leaves the running one in place
+    CHECK(effect_vm_upload_begin(sizeof(bad)));
+    CHECK(effect_vm_upload_data(0, bad, sizeof(bad)));
+    CHECK(!effect_vm_upload_commit());
+    effect_vm_get_status(&status);
+    CHECK_EQ(status.state, EFFECT_VM_UPLOAD_ERROR);
+    CHECK(effect_vm_get_active() == active);
+    CHECK_EQ(effect_vm_get_active()->serial, serial);
+
+    // Chunks out of order are refused
+    CHECK(effect_vm_upload_begin(sizeof(good)));
+    CHECK(!effect_vm_upload_data(1, good + 1, sizeof(good) - 1));
+    CHECK(!effect_vm_upload_commit());
+}
+
+int main(void) {
+    RUN_TEST(test_header);
+    RUN_TEST(test_bad_opcodes);
+    RUN_TEST(test_operand_range);
+    RUN_TEST(test_jumps);
+    RUN_TEST(test_stack_depth);
+    RUN_TEST(test_run);
+    RUN_TEST(test_budget);
+    RUN_TEST(test_upload);
+    return host_test_result();
+}
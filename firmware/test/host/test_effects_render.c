@@ -0,0 +1,343 @@
+#include "host_test.h"
+#include "effects_render.h"
+#include "effect_luts.h"
+#include "timeline.h"
+#include <string.h>
+
+// Renderer checks against the generated LUTs of the selected board
+
+static effect_config_t params(uint8_t speed) {
+    return (effect_config_t){
+        .type = EFFECT_STATIC,
+        .brightness = EFFECT_LUT_MAX_DUTY,
+        .speed = speed,
+        .r = EFFECT_LUT_MAX_DUTY, .g = EFFECT_LUT_MAX_DUTY / 2, .b = 0, .w = EFFECT_LUT_MAX_DUTY / 4,
+        .enabled = true,
+        .max_duty = EFFECT_LUT_MAX_DUTY,
+    };
+}
+
+static int64_t frame_us(uint32_t frame) {
+    return (int64_t)frame * EFFECT_FRAME_US;
+}
+
+static bool frame_in_range(const effect_frame_t *f) {
+    return f->r <= EFFECT_LUT_MAX_DUTY && f->g <= EFFECT_LUT_MAX_DUTY &&
+           f->b <= EFFECT_LUT_MAX_DUTY && f->w <= EFFECT_LUT_MAX_DUTY;
+}
+
+static bool frame_equal(const effect_frame_t *a, const effect_frame_t *b) {
+    return a->r == b->r && a->g == b->g && a->b == b->b && a->w == b->w;
+}
+
+static void test_static_scaling(void) {
+    effect_config_t p = params(0);
+    effect_state_t s;
+    effect_frame_t f;
+
+    effect_state_init(&s, EFFECT_STATIC, 1);
+    CHECK(effect_render(EFFECT_STATIC, &s, &p, 0, &f));
+    CHECK_EQ(f.r, EFFECT_LUT_MAX_DUTY);
+    CHECK_EQ(f.g, EFFECT_LUT_MAX_DUTY / 2);
+    CHECK_EQ(f.b, 0);
+
+    p.brightness = EFFECT_LUT_MAX_DUTY / 2;
+    CHECK(effect_render(EFFECT_STATIC, &s, &p, frame_us(1), &f));
+    CHECK_NEAR(f.r, EFFECT_LUT_MAX_DUTY / 2, 1);
+
+    p.brightness = 0;
+    CHECK(effect_render(EFFECT_STATIC, &s, &p, frame_us(2), &f));
+    CHECK(f.r == 0 && f.g == 0 && f.b == 0 && f.w == 0);
+
+    CHECK(effect_render(EFFECT_OFF, &s, &p, frame_us(3), &f));
+    CHECK(f.r == 0 && f.g == 0 && f.b == 0 && f.w == 0);
+}
+
+// Every built-in effect stays within the duty range at any speed
+static void test_output_range(void) {
+    static const uint8_t speeds[] = {0, 1, 128, 254, 255};
+
+    for (int type = EFFECT_OFF; type < EFFECT_TIMELINE; type++) {
+        for (size_t i = 0; i < sizeof(speeds); i++) {
+            effect_config_t p = params(speeds[i]);
+            effect_state_t s;
+            effect_frame_t f;
+            bool in_range = true;
+
+            effect_state_init(&s, (light_effect_t)type, 7);
+            for (uint32_t frame = 0; frame < 3000; frame++) {
+                CHECK(effect_render((light_effect_t)type, &s, &p, frame_us(frame), &f));
+                in_range &= frame_in_range(&f);
+            }
+            CHECK(in_range);
+        }
+    }
+}
+
+static void test_unknown_effect(void) {
+    effect_config_t p = params(128);
+    effect_state_t s;
+    effect_frame_t f;
+
+    effect_state_init(&s, EFFECT_STREAM, 1);
+    CHECK(!effect_render(EFFECT_STREAM, &s, &p, 0, &f));
+    CHECK(!effect_render(EFFECT_MAX, &s, &p, 0, &f));
+}
+
+// Random effects replay the same frames for the same seed
+static void test_seed_replay(void) {
+    static const light_effect_t random_effects[] = {
+        EFFECT_TWINKLE_PULSE, EFFECT_LIGHTNING_FLASH, EFFECT_CANDLE_FLICKER,
+    };
+
+    for (size_t i = 0; i < sizeof(random_effects) / sizeof(random_effects[0]); i++) {
+        light_effect_t type = random_effects[i];
+        effect_config_t p = params(200);
+        effect_state_t a, b, c;
+        bool same = true, differs = false;
+
+        effect_state_init(&a, type, 1234);
+        effect_state_init(&b, type, 1234);
+        effect_state_init(&c, type, 1235);
+        for (uint32_t frame = 0; frame < 5000; frame++) {
+            effect_frame_t fa, fb, fc;
+            effect_render(type, &a, &p, frame_us(frame), &fa);
+            effect_render(type, &b, &p, frame_us(frame), &fb);
+            effect_render(type, &c, &p, frame_us(frame), &fc);
+            same &= frame_equal(&fa, &fb);
+            differs |= !frame_equal(&fa, &fc);
+        }
+        CHECK(same);
+        CHECK(differs);
+    }
+}
+
+// Phase effects advance by effect time, not by how often they are rendered
+static void test_frame_skipping(void) {
+    static const light_effect_t phase_effects[] = {
+        EFFECT_SMOOTH_FADE, EFFECT_BREATHING,
+#ifdef CONFIG_BOARD_ESP32C3_OLED
+        EFFECT_PULSE_WAVE,
+#else
+        EFFECT_PRECISION_FADE,
+#endif
+    };
+
+    for (size_t i = 0; i < sizeof(phase_effects) / sizeof(phase_effects[0]); i++) {
+        light_effect_t type = phase_effects[i];
+        effect_config_t p = params(200);
+        effect_state_t every, skipping;
+        bool same = true;
+
+        effect_state_init(&every, type, 1);
+        effect_state_init(&skipping, type, 1);
+        for (uint32_t frame = 0; frame < 3000; frame++) {
+            effect_frame_t fe, fs;
+            effect_render(type, &every, &p, frame_us(frame), &fe);
+            if (frame % 3 == 0) {
+                effect_render(type, &skipping, &p, frame_us(frame) + EFFECT_FRAME_US / 2, &fs);
+                same &= frame_equal(&fe, &fs);
+            }
+        }
+        CHECK(same);
+    }
+}
+
+// A keyframe lands where frame-by-frame rendering would be at its end
+static void test_keyframe_endpoints(void) {
+    effect_config_t p = params(100);
+    effect_state_t s;
+    effect_frame_t f;
+    effect_keyframe_t kf;
+
+    effect_state_init(&s, EFFECT_BREATHING, 1);
+    uint32_t frame = 0;
+    for (int i = 0; i < 64; i++) {
+        CHECK(effect_render(EFFECT_BREATHING, &s, &p, frame_us(frame), &f));
+        CHECK(effect_next_keyframe(EFFECT_BREATHING, &s, &p, &kf));
+        CHECK(kf.frames > 0);
+        frame += kf.frames;
+
+        effect_state_t probe = s;
+        CHECK(effect_render(EFFECT_BREATHING, &probe, &p, frame_us(frame), &f));
+        CHECK(frame_equal(&f, &kf.to));
+    }
+
+    // Smooth fade keyframes end on a hue sextant boundary, so the endpoint
+    // is a hue table corner: one channel full, one off
+    effect_state_init(&s, EFFECT_SMOOTH_FADE, 1);
+    frame = 0;
+    for (int i = 0; i < 24; i++) {
+        CHECK(effect_render(EFFECT_SMOOTH_FADE, &s, &p, frame_us(frame), &f));
+        CHECK(effect_next_keyframe(EFFECT_SMOOTH_FADE, &s, &p, &kf));
+        CHECK(kf.frames > 0);
+        CHECK(frame_in_range(&kf.to));
+        uint32_t full = (kf.to.r == EFFECT_LUT_MAX_DUTY) + (kf.to.g == EFFECT_LUT_MAX_DUTY) +
+                        (kf.to.b == EFFECT_LUT_MAX_DUTY);
+        uint32_t off = (kf.to.r == 0) + (kf.to.g == 0) + (kf.to.b == 0);
+        CHECK(full >= 1 && off >= 1);
+        frame += kf.frames;
+    }
+}
+
+static effect_frame_t blended(effect_frame_t below, effect_frame_t layer, layer_blend_t mode,
+                              uint8_t opacity) {
+    effect_blend(&below, &layer, mode, opacity);
+    return below;
+}
+
+// Where an opacity puts a value between the layers below and the blend
+#define PART(from, to, opacity) ((int32_t)(from) + ((int32_t)(to) - (int32_t)(from)) * (opacity) / 255)
+
+static void test_layer_blend(void) {
+    const uint32_t full = EFFECT_LUT_MAX_DUTY, half = EFFECT_LUT_MAX_DUTY / 2;
+    const effect_frame_t below = { .r = full, .g = half, .b = 0, .w = full / 4 };
+    const effect_frame_t layer = { .r = half, .g = full, .b = half, .w = 0 };
+    effect_frame_t f;
+
+    f = blended(below, layer, LAYER_BLEND_ALPHA, 255);
+    CHECK(frame_equal(&f, &layer));
+    f = blended(below, layer, LAYER_BLEND_ADD, 255);
+    CHECK(f.r == full && f.g == full && f.b == half && f.w == full / 4);   // Clamped at full
+    f = blended(below, layer, LAYER_BLEND_MAX, 255);
+    CHECK(f.r == full && f.g == full && f.b == half && f.w == full / 4);
+    f = blended(below, layer, LAYER_BLEND_MULTIPLY, 255);
+    CHECK_NEAR(f.r, half, 1);
+    CHECK_EQ(f.g, half);
+    CHECK_EQ(f.b, 0);
+    CHECK_EQ(f.w, 0);
+
+    // A full layer multiplies to no change, a black one to black
+    const effect_frame_t white = { .r = full, .g = full, .b = full, .w = full };
+    const effect_frame_t black = {0};
+    f = blended(below, white, LAYER_BLEND_MULTIPLY, 255);
+    CHECK(frame_equal(&f, &below));
+    f = blended(below, black, LAYER_BLEND_MULTIPLY, 255);
+    CHECK(frame_equal(&f, &black));
+
+    // Opacity: nothing at 0, in proportion in between
+    for (int mode = LAYER_BLEND_ALPHA; mode < LAYER_BLEND_MAX_MODE; mode++) {
+        f = blended(below, layer, (layer_blend_t)mode, 0);
+        CHECK(frame_equal(&f, &below));
+    }
+    f = blended(below, layer, LAYER_BLEND_ALPHA, 128);
+    CHECK_NEAR(f.r, PART(full, half, 128), 1);
+    CHECK_NEAR(f.g, PART(half, full, 128), 1);
+    CHECK_NEAR(f.b, PART(0, half, 128), 1);
+    CHECK_NEAR(f.w, PART(full / 4, 0, 128), 1);
+    f = blended(below, layer, LAYER_BLEND_ADD, 64);
+    CHECK_NEAR(f.r, full, 0);
+    CHECK_NEAR(f.g, PART(half, full, 64), 1);
+    CHECK_NEAR(f.b, PART(0, half, 64), 1);
+
+    // Every mode and opacity stays in range and moves monotonically from
+    // the layers below to the full blend
+    static const uint32_t levels[] = {0, 1, EFFECT_LUT_MAX_DUTY / 3, EFFECT_LUT_MAX_DUTY - 1, EFFECT_LUT_MAX_DUTY};
+    bool in_range = true, monotonic = true;
+    for (int mode = LAYER_BLEND_ALPHA; mode < LAYER_BLEND_MAX_MODE; mode++) {
+        for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+            for (size_t j = 0; j < sizeof(levels) / sizeof(levels[0]); j++) {
+                effect_frame_t d = { .r = levels[i] }, l = { .r = levels[j] };
+                uint32_t end = blended(d, l, (layer_blend_t)mode, 255).r;
+                uint32_t prev = levels[i];
+                for (int opacity = 0; opacity <= 255; opacity++) {
+                    uint32_t v = blended(d, l, (layer_blend_t)mode, (uint8_t)opacity).r;
+                    in_range &= v <= EFFECT_LUT_MAX_DUTY;
+                    monotonic &= end >= levels[i] ? (v >= prev && v <= end) : (v <= prev && v >= end);
+                    prev = v;
+                }
+            }
+        }
+    }
+    CHECK(in_range);
+    CHECK(monotonic);
+}
+
+// Layers go on bottom to top, hidden ones are skipped, and a stream layer
+// takes the frame it is given
+static void test_layer_composite(void) {
+    const uint32_t full = EFFECT_LUT_MAX_DUTY, half = EFFECT_LUT_MAX_DUTY / 2;
+    const effect_frame_t base = { .r = full, .g = full, .b = full, .w = 0 };
+    const effect_frame_t stream = { .r = 0, .g = half, .b = 0, .w = full };
+    effect_config_t p = params(50);
+    effect_state_t states[LIGHT_OVERLAY_LAYERS];
+    const int64_t t_us[LIGHT_OVERLAY_LAYERS] = {0};
+    effect_frame_t f;
+
+    // Static covers the base, then the stream is multiplied in
+    const effect_layer_t layers[LIGHT_OVERLAY_LAYERS] = {
+        { .type = EFFECT_STATIC, .opacity = 255, .blend = LAYER_BLEND_ALPHA },
+        { .type = EFFECT_STREAM, .opacity = 255, .blend = LAYER_BLEND_MULTIPLY },
+        { .type = EFFECT_OFF, .opacity = 255, .blend = LAYER_BLEND_ALPHA },
+        { .type = EFFECT_STATIC, .opacity = 0, .blend = LAYER_BLEND_ALPHA },
+    };
+    for (int i = 0; i < LIGHT_OVERLAY_LAYERS; i++) {
+        effect_state_init(&states[i], layers[i].type, 1);
+    }
+    f = base;
+    effect_composite(&f, layers, states, &p, t_us, &stream);
+    CHECK_EQ(f.r, 0);
+    CHECK_NEAR(f.g, half / 2, 1);
+    CHECK_EQ(f.b, 0);
+    CHECK_EQ(f.w, full / 4);
+
+    // Without a stream frame that layer is left out
+    f = base;
+    effect_composite(&f, layers, states, &p, t_us, NULL);
+    CHECK_EQ(f.r, p.r);
+    CHECK_EQ(f.g, p.g);
+    CHECK_EQ(f.b, p.b);
+    CHECK_EQ(f.w, p.w);
+}
+
+static bool upload_timeline(const uint8_t *bytes, uint16_t len) {
+    return timeline_upload_begin(len) && timeline_upload_data(0, bytes, len) &&
+           timeline_upload_commit();
+}
+
+// Two linear segments, looping back to the second keyframe
+static void test_timeline_playback(void) {
+    static const uint8_t show[] = {
+        'T', 'L', TIMELINE_VERSION, 0, 3, 0, 1, 0,
+        0, 0,     0, 0, 0, 0, TIMELINE_INTERP_STEP,      // t=0 black
+        232, 3,   255, 0, 0, 0, TIMELINE_INTERP_LINEAR,  // t=1000 red
+        232, 3,   0, 0, 255, 0, TIMELINE_INTERP_LINEAR,  // t=2000 blue
+    };
+    effect_config_t p = params(0);
+    effect_state_t s;
+    effect_frame_t f;
+
+    CHECK(upload_timeline(show, sizeof(show)));
+    CHECK(timeline_get_active() != NULL);
+
+    effect_state_init(&s, EFFECT_TIMELINE, 1);
+    CHECK(effect_render(EFFECT_TIMELINE, &s, &p, 500000, &f));
+    CHECK_NEAR(f.r, EFFECT_LUT_MAX_DUTY / 2, 1);
+    CHECK_EQ(f.b, 0);
+
+    CHECK(effect_render(EFFECT_TIMELINE, &s, &p, 1500000, &f));
+    CHECK_NEAR(f.r, EFFECT_LUT_MAX_DUTY / 2, 1);
+    CHECK_NEAR(f.b, EFFECT_LUT_MAX_DUTY / 2, 1);
+
+    // Past the end: back to the loop keyframe (red at 1000 ms)
+    CHECK(effect_render(EFFECT_TIMELINE, &s, &p, 2000000 + 500000, &f));
+    CHECK_NEAR(f.r, EFFECT_LUT_MAX_DUTY / 2, 1);
+    CHECK_NEAR(f.b, EFFECT_LUT_MAX_DUTY / 2, 1);
+
+    // A truncated upload is refused and the running show stays
+    CHECK(!upload_timeline(show, sizeof(show) - 1));
+    CHECK(timeline_get_active() != NULL);
+}
+
+int main(void) {
+    RUN_TEST(test_static_scaling);
+    RUN_TEST(test_output_range);
+    RUN_TEST(test_unknown_effect);
+    RUN_TEST(test_seed_replay);
+    RUN_TEST(test_frame_skipping);
+    RUN_TEST(test_keyframe_endpoints);
+    RUN_TEST(test_layer_blend);
+    RUN_TEST(test_layer_composite);
+    RUN_TEST(test_timeline_playback);
+    return host_test_result();
+}
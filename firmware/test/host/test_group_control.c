@@ -0,0 +1,268 @@
+#include "host_test.h"
+#include "group_control.h"
+#include "mbedtls/md.h"
+#include <string.h>
+
+// Group command packet vectors: what the BLE server's scan callback would
+// hand to group_control_check(), and the verdict each one must get
+
+#define OUR_GROUP   1
+
+static const uint8_t key[GROUP_KEY_SIZE] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+#define KEY_HEX "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+
+static group_packet_t packet(uint16_t group, uint32_t seq, uint8_t brightness) {
+    group_packet_t pkt = {
+        .group = group, .seq = seq,
+        .effect = 2, .brightness = brightness,
+        .r = 255, .g = 128, .b = 0, .w = 64,
+        .speed = 100, .transition = 5,
+    };
+    group_packet_sign(key, &pkt);
+    return pkt;
+}
+
+static void ctx_init(group_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    memcpy(ctx->key, key, sizeof(key));
+    ctx->group = OUR_GROUP;
+}
+
+// The host HMAC stand-in against RFC 4231, and a packet signed by an
+// independent implementation (Python hmac), so the wire format is pinned
+static void test_known_answers(void) {
+    static const uint8_t rfc4231_2[32] = {
+        0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+        0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43,
+    };
+    static const uint8_t rfc4231_6[32] = {
+        0x60, 0xe4, 0x31, 0x59, 0x1e, 0xe0, 0xb6, 0x7f, 0x0d, 0x8a, 0x26, 0xaa, 0xcb, 0xf5, 0xb7, 0x7f,
+        0x8e, 0x0b, 0xc6, 0x21, 0x37, 0x28, 0xc5, 0x14, 0x05, 0x46, 0x04, 0x0f, 0x0e, 0xe3, 0x7f, 0x54,
+    };
+    static const char msg6[] = "Test Using Larger Than Block-Size Key - Hash Key First";
+    static const uint8_t mac[GROUP_MAC_SIZE] = {0xa8, 0x07, 0x86, 0x79, 0x76, 0xb3, 0x15, 0x3b};
+    const mbedtls_md_info_t *info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    uint8_t long_key[131], digest[32];
+
+    CHECK(mbedtls_md_hmac(info, (const uint8_t *)"Jefe", 4,
+                          (const uint8_t *)"what do ya want for nothing?", 28, digest) == 0);
+    CHECK(memcmp(digest, rfc4231_2, sizeof(digest)) == 0);
+    memset(long_key, 0xaa, sizeof(long_key));
+    CHECK(mbedtls_md_hmac(info, long_key, sizeof(long_key), (const uint8_t *)msg6,
+                          sizeof(msg6) - 1, digest) == 0);
+    CHECK(memcmp(digest, rfc4231_6, sizeof(digest)) == 0);
+
+    group_packet_t pkt = packet(OUR_GROUP, 0x01020304, 200);
+    static const uint8_t head[] = {0xFF, 0xFF, 'G', GROUP_VERSION, 0x01, 0x00, 0x04, 0x03, 0x02, 0x01};
+    CHECK(memcmp(pkt.raw, head, sizeof(head)) == 0);
+    CHECK(memcmp(pkt.raw + GROUP_MAC_OFFSET, mac, sizeof(mac)) == 0);
+}
+
+static void test_key_parse(void) {
+    uint8_t parsed[GROUP_KEY_SIZE];
+
+    CHECK(group_key_parse(KEY_HEX, parsed));
+    CHECK(memcmp(parsed, key, sizeof(key)) == 0);
+    CHECK(group_key_parse("000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F", parsed));
+    CHECK(memcmp(parsed, key, sizeof(key)) == 0);
+    CHECK(!group_key_parse("", parsed));
+    CHECK(!group_key_parse(NULL, parsed));
+    CHECK(!group_key_parse(KEY_HEX "0", parsed));
+    CHECK(!group_key_parse("0g0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", parsed));
+}
+
+// The packet is found among other AD structures, and malformed data is not
+// read past its end
+static void test_packet_find(void) {
+    group_packet_t sent = packet(OUR_GROUP, 42, 10), found;
+    uint8_t adv[31] = {
+        2, 0x01, 0x06,                                  // Flags
+        GROUP_PACKET_SIZE + 1, 0xFF,                    // Manufacturer data
+    };
+    memcpy(adv + 5, sent.raw, GROUP_PACKET_SIZE);
+
+    CHECK(group_packet_find(adv, sizeof(adv), &found));
+    CHECK_EQ(found.group, OUR_GROUP);
+    CHECK_EQ(found.seq, 42);
+    CHECK_EQ(found.brightness, 10);
+    CHECK_EQ(found.transition, 5);
+    CHECK(memcmp(found.raw, sent.raw, GROUP_PACKET_SIZE) == 0);
+
+    CHECK(!group_packet_find(adv, sizeof(adv) - 1, &found));   // Cut short
+    adv[3] = GROUP_PACKET_SIZE;                                 // Wrong length
+    CHECK(!group_packet_find(adv, sizeof(adv), &found));
+    adv[3] = GROUP_PACKET_SIZE + 1;
+    adv[7] = 'S';                                               // Another beacon
+    CHECK(!group_packet_find(adv, sizeof(adv), &found));
+    adv[7] = GROUP_MAGIC;
+    adv[0] = 200;                                               // Length past the end
+    CHECK(!group_packet_find(adv, sizeof(adv), &found));
+}
+
+static void test_forged_mac(void) {
+    group_ctx_t ctx;
+    group_packet_t pkt;
+    uint8_t wrong_key[GROUP_KEY_SIZE];
+
+    ctx_init(&ctx);
+
+    // A flipped MAC bit
+    pkt = packet(OUR_GROUP, 100, 200);
+    pkt.raw[GROUP_MAC_OFFSET + 3] ^= 0x10;
+    CHECK_EQ(group_control_check(&ctx, &pkt), GROUP_BAD_MAC);
+
+    // A field changed after signing
+    pkt = packet(OUR_GROUP, 100, 200);
+    pkt.raw[11] = 255;
+    CHECK_EQ(group_control_check(&ctx, &pkt), GROUP_BAD_MAC);
+
+    // Another group rewritten into ours
+    pkt = packet(2, 100, 200);
+    pkt.raw[4] = OUR_GROUP;
+    CHECK_EQ(group_control_check(&ctx, &pkt), GROUP_BAD_MAC);
+
+    // Signed with another key
+    memcpy(wrong_key, key, sizeof(key));
+    wrong_key[31] ^= 1;
+    pkt = (group_packet_t){ .group = OUR_GROUP, .seq = 100, .brightness = 200 };
+    group_packet_sign(wrong_key, &pkt);
+    CHECK_EQ(group_control_check(&ctx, &pkt), GROUP_BAD_MAC);
+
+    // None of them moved the sequence
+    CHECK(!ctx.have_seq);
+    CHECK_EQ(ctx.stats.bad_mac, 4);
+    pkt = packet(OUR_GROUP, 1, 200);
+    CHECK_EQ(group_control_check(&ctx, &pkt), GROUP_APPLY);
+}
+
+static void test_replay(void) {
+    group_ctx_t ctx;
+    group_packet_t old = packet(OUR_GROUP, 9, 50);
+    group_packet_t cur = packet(OUR_GROUP, 10, 60);
+
+    ctx_init(&ctx);
+    CHECK_EQ(group_control_check(&ctx, &old), GROUP_APPLY);
+    CHECK_EQ(group_control_check(&ctx, &cur), GROUP_APPLY);
+
+    // A recorded older command, and another command reusing the sequence
+    CHECK_EQ(group_control_check(&ctx, &old), GROUP_REPLAY);
+    group_packet_t same_seq = packet(OUR_GROUP, 10, 70);
+    CHECK_EQ(group_control_check(&ctx, &same_seq), GROUP_REPLAY);
+    CHECK_EQ(ctx.last_seq, 10);
+    CHECK_EQ(ctx.stats.replays, 2);
+
+    // After a reboot the stored sequence keeps refusing both
+    group_ctx_t rebooted;
+    ctx_init(&rebooted);
+    rebooted.have_seq = true;
+    rebooted.last_seq = 10;
+    CHECK_EQ(group_control_check(&rebooted, &old), GROUP_REPLAY);
+    CHECK_EQ(group_control_check(&rebooted, &cur), GROUP_REPLAY);
+    group_packet_t next = packet(OUR_GROUP, 11, 80);
+    CHECK_EQ(group_control_check(&rebooted, &next), GROUP_APPLY);
+}
+
+// A broadcaster repeats each command; the copies are dropped before the
+// MAC check, and forgeries mixed into the burst are still caught
+static void test_duplicate_burst(void) {
+    group_ctx_t ctx;
+    group_packet_t pkt = packet(OUR_GROUP, 500, 128);
+    group_packet_t forged = pkt;
+    int applied = 0, duplicates = 0, bad = 0;
+
+    forged.raw[GROUP_MAC_OFFSET] ^= 1;
+    ctx_init(&ctx);
+    for (int i = 0; i < 40; i++) {
+        switch (group_control_check(&ctx, i % 10 == 5 ? &forged : &pkt)) {
+            case GROUP_APPLY: applied++; break;
+            case GROUP_DUPLICATE: duplicates++; break;
+            case GROUP_BAD_MAC: bad++; break;
+            default: CHECK(false); break;
+        }
+    }
+    CHECK_EQ(applied, 1);
+    CHECK_EQ(duplicates, 35);
+    CHECK_EQ(bad, 4);
+    CHECK_EQ(ctx.stats.duplicates, 35);
+
+    // The next command goes through, then its own repeats are dropped
+    group_packet_t next = packet(OUR_GROUP, 501, 129);
+    CHECK_EQ(group_control_check(&ctx, &next), GROUP_APPLY);
+    CHECK_EQ(group_control_check(&ctx, &next), GROUP_DUPLICATE);
+    CHECK_EQ(group_control_check(&ctx, &pkt), GROUP_REPLAY);
+}
+
+// Sequences are per key: another group's command moves the sequence but
+// is not applied, and anything older for our group is then a replay
+static void test_other_group(void) {
+    group_ctx_t ctx;
+
+    ctx_init(&ctx);
+    group_packet_t ours = packet(OUR_GROUP, 20, 1);
+    group_packet_t theirs = packet(2, 21, 2);
+    group_packet_t all = packet(GROUP_ALL, 22, 3);
+    group_packet_t late = packet(OUR_GROUP, 21, 4);
+
+    CHECK_EQ(group_control_check(&ctx, &ours), GROUP_APPLY);
+    CHECK_EQ(group_control_check(&ctx, &theirs), GROUP_OTHER_GROUP);
+    CHECK_EQ(ctx.last_seq, 21);
+    CHECK_EQ(group_control_check(&ctx, &theirs), GROUP_DUPLICATE);
+    CHECK_EQ(group_control_check(&ctx, &late), GROUP_REPLAY);
+    CHECK_EQ(group_control_check(&ctx, &all), GROUP_APPLY);
+    CHECK_EQ(ctx.stats.applied, 2);
+    CHECK_EQ(ctx.stats.other_group, 1);
+
+    // Only applied sequences are stored; after a reboot the other group's
+    // packet is new again but still not applied here
+    group_ctx_t rebooted;
+    ctx_init(&rebooted);
+    rebooted.have_seq = true;
+    rebooted.last_seq = 20;
+    CHECK_EQ(group_control_check(&rebooted, &theirs), GROUP_OTHER_GROUP);
+    CHECK_EQ(group_control_check(&rebooted, &ours), GROUP_REPLAY);
+}
+
+// Serial number order: a sequence up to 2^31 - 1 ahead is newer, even
+// across the u32 wrap
+static void test_sequence_wrap(void) {
+    group_ctx_t ctx;
+
+    ctx_init(&ctx);
+    ctx.have_seq = true;
+    ctx.last_seq = 0xFFFFFFF0u;
+
+    group_packet_t before_wrap = packet(OUR_GROUP, 0xFFFFFFFEu, 1);
+    group_packet_t after_wrap = packet(OUR_GROUP, 0x00000005u, 2);
+    group_packet_t behind = packet(OUR_GROUP, 0xFFFFFFFFu, 3);
+    CHECK_EQ(group_control_check(&ctx, &before_wrap), GROUP_APPLY);
+    CHECK_EQ(group_control_check(&ctx, &after_wrap), GROUP_APPLY);
+    CHECK_EQ(ctx.last_seq, 5);
+    CHECK_EQ(group_control_check(&ctx, &behind), GROUP_REPLAY);
+
+    // Half the space ahead is the limit; from there on it counts as behind
+    group_packet_t far = packet(OUR_GROUP, 5 + 0x7FFFFFFFu, 4);
+    group_packet_t too_far = packet(OUR_GROUP, 5 + 0x80000000u, 5);
+    CHECK_EQ(group_control_check(&ctx, &too_far), GROUP_REPLAY);
+    CHECK_EQ(group_control_check(&ctx, &far), GROUP_APPLY);
+
+    // A fresh fixture takes whatever it hears first, zero included
+    ctx_init(&ctx);
+    group_packet_t zero = packet(OUR_GROUP, 0, 6);
+    CHECK_EQ(group_control_check(&ctx, &zero), GROUP_APPLY);
+    CHECK(ctx.have_seq);
+}
+
+int main(void) {
+    RUN_TEST(test_known_answers);
+    RUN_TEST(test_key_parse);
+    RUN_TEST(test_packet_find);
+    RUN_TEST(test_forged_mac);
+    RUN_TEST(test_replay);
+    RUN_TEST(test_duplicate_burst);
+    RUN_TEST(test_other_group);
+    RUN_TEST(test_sequence_wrap);
+    return host_test_result();
+}
@@ -0,0 +1,127 @@
+#include "host_test.h"
+#include "seqlock.h"
+#include <pthread.h>
+#include <string.h>
+
+// Writers publish a struct whose words all hold the same value while
+// readers copy it out; a copy with mixed words is a torn read. Writers are
+// serialized by a mutex, as the firmware serializes them with a critical
+// section. Sized like the effects task's snapshot so a copy takes a while.
+
+#define WORDS          64
+#define WRITES         2000000
+#define WRITERS        2
+#define READERS        2
+
+typedef struct {
+    uint32_t word[WORDS];
+} payload_t;
+
+static payload_t shared;
+static uint32_t shared_seq = 0;
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int writers_done = 0;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t torn;
+    uint64_t backwards;
+} reader_result_t;
+
+static void *writer(void *arg) {
+    for (uint32_t i = 0; i < WRITES / WRITERS; i++) {
+        pthread_mutex_lock(&write_mutex);
+        seqlock_write_begin(&shared_seq);
+        uint32_t value = shared.word[0] + 1;
+        for (int w = 0; w < WORDS; w++) {
+            __atomic_store_n(&shared.word[w], value, __ATOMIC_RELAXED);
+        }
+        seqlock_write_end(&shared_seq);
+        pthread_mutex_unlock(&write_mutex);
+    }
+    __atomic_add_fetch(&writers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *reader(void *arg) {
+    reader_result_t *result = arg;
+    uint32_t last = 0;
+
+    while (__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE) < WRITERS) {
+        payload_t copy;
+        uint32_t start;
+        do {
+            start = seqlock_read_begin(&shared_seq);
+            for (int w = 0; w < WORDS; w++) {
+                copy.word[w] = __atomic_load_n(&shared.word[w], __ATOMIC_RELAXED);
+            }
+        } while (seqlock_read_retry(&shared_seq, start));
+
+        for (int w = 1; w < WORDS; w++) {
+            if (copy.word[w] != copy.word[0]) {
+                result->torn++;
+                break;
+            }
+        }
+        if (copy.word[0] < last) {
+            result->backwards++;
+        }
+        last = copy.word[0];
+        result->reads++;
+    }
+    return NULL;
+}
+
+static void test_no_torn_reads(void) {
+    pthread_t writers[WRITERS], readers[READERS];
+    reader_result_t results[READERS];
+
+    memset(results, 0, sizeof(results));
+    for (int i = 0; i < READERS; i++) {
+        CHECK(pthread_create(&readers[i], NULL, reader, &results[i]) == 0);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        CHECK(pthread_create(&writers[i], NULL, writer, NULL) == 0);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    CHECK_EQ(shared.word[0], WRITES);
+    CHECK_EQ(shared.word[WORDS - 1], WRITES);
+    CHECK_EQ(shared_seq, 2 * WRITES);
+    for (int i = 0; i < READERS; i++) {
+        printf("reader %d: %llu reads\n", i, (unsigned long long)results[i].reads);
+        CHECK(results[i].reads > 0);
+        CHECK_EQ(results[i].torn, 0);
+        CHECK_EQ(results[i].backwards, 0);
+    }
+}
+
+// Without writers a read goes through on the first try, and a read that
+// overlaps a write is retried
+static void test_retry(void) {
+    uint32_t seq = 0;
+    uint32_t start = seqlock_read_begin(&seq);
+
+    CHECK(!seqlock_read_retry(&seq, start));
+
+    seqlock_write_begin(&seq);
+    CHECK(seqlock_read_retry(&seq, start));
+    uint32_t during = seqlock_read_begin(&seq);
+    CHECK(seqlock_read_retry(&seq, during));  // Odd: writer in progress
+    seqlock_write_end(&seq);
+    CHECK(seqlock_read_retry(&seq, start));   // Moved since the read began
+
+    start = seqlock_read_begin(&seq);
+    CHECK(!seqlock_read_retry(&seq, start));
+}
+
+int main(void) {
+    RUN_TEST(test_retry);
+    RUN_TEST(test_no_torn_reads);
+    return host_test_result();
+}
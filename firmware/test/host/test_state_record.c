@@ -0,0 +1,434 @@
+#include "host_test.h"
+#include "state_record.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+// Saved light state records: the byte format, what decoding refuses,
+// which record wins at boot as the ring goes round, across the sequence
+// wrapping, and after a write cut short; and the saver against a simulated
+// NVS partition, counting the writes a burst of changes costs
+
+static const light_state_t sample = {
+    .type = (light_effect_t)2,
+    .r = 4095, .g = 2048, .b = 0, .w = 1024,
+    .brightness = 3000,
+    .speed = 128,
+    .transition_ms = 500,
+};
+
+static bool state_equal(const light_state_t *a, const light_state_t *b) {
+    return a->type == b->type && a->r == b->r && a->g == b->g && a->b == b->b && a->w == b->w &&
+           a->brightness == b->brightness && a->speed == b->speed && a->transition_ms == b->transition_ms &&
+           a->manual == b->manual;
+}
+
+static light_state_t state_for(uint32_t seq) {
+    light_state_t state = sample;
+    state.r = seq & 0xFFF;
+    state.speed = (uint8_t)(seq >> 4);
+    return state;
+}
+
+// NVS as the store sees it: what each slot holds
+typedef struct {
+    uint8_t data[STATE_RECORD_SLOTS][STATE_RECORD_SIZE];
+    size_t len[STATE_RECORD_SLOTS];
+    uint32_t writes;                    // Through the saver's interface
+    uint32_t fail_writes;               // Fail this many writes from now
+} ring_t;
+
+static void ring_write(ring_t *ring, uint32_t seq) {
+    int slot = state_record_slot(seq);
+    light_state_t state = state_for(seq);
+    state_record_encode(ring->data[slot], seq, &state);
+    ring->len[slot] = STATE_RECORD_SIZE;
+}
+
+static state_record_pick_t ring_pick(const ring_t *ring) {
+    state_record_pick_t pick;
+    state_record_pick_init(&pick);
+    for (int i = 0; i < STATE_RECORD_SLOTS; i++) {
+        state_record_pick_offer(&pick, i, ring->data[i], ring->len[i]);
+    }
+    return pick;
+}
+
+// The format pinned against an independent encoder (Python struct and
+// zlib.crc32), so a layout change cannot slip through unversioned
+static void test_known_record(void) {
+    static const uint8_t expected[STATE_RECORD_SIZE] = {
+        0x04, 0x03, 0x02, 0x01, 0x02, 0x02, 0xff, 0x0f, 0x00, 0x08, 0x00, 0x00,
+        0x00, 0x04, 0xb8, 0x0b, 0x80, 0xf4, 0x01, 0x00, 0x02, 0xc6, 0x88, 0xde,
+    };
+    static const uint8_t expected_manual[STATE_RECORD_SIZE] = {
+        0x04, 0x03, 0x02, 0x01, 0x02, 0x01, 0xff, 0x0f, 0x00, 0x08, 0x00, 0x00,
+        0x00, 0x04, 0xb8, 0x0b, 0x80, 0xf4, 0x01, 0x01, 0xed, 0x9c, 0xf2, 0xb8,
+    };
+    uint8_t record[STATE_RECORD_SIZE];
+    light_state_t state;
+    uint32_t seq;
+
+    CHECK_EQ(esp_rom_crc32_le(0, (const uint8_t *)"123456789", 9), 0xCBF43926u);
+
+    state_record_encode(record, 0x01020304, &sample);
+    CHECK(memcmp(record, expected, sizeof(record)) == 0);
+    CHECK(state_record_decode(expected, &seq, &state));
+    CHECK_EQ(seq, 0x01020304);
+    CHECK(state_equal(&state, &sample));
+
+    // A color set channel by channel is raw duty and comes back as such
+    light_state_t manual = sample;
+    manual.type = EFFECT_STATIC;
+    manual.manual = true;
+    state_record_encode(record, 0x01020304, &manual);
+    CHECK(memcmp(record, expected_manual, sizeof(record)) == 0);
+    CHECK(state_record_decode(expected_manual, &seq, &state));
+    CHECK(state.manual);
+    CHECK(state_equal(&state, &manual));
+}
+
+static void test_decode_rejects(void) {
+    uint8_t record[STATE_RECORD_SIZE], bad[STATE_RECORD_SIZE];
+    light_state_t state;
+    uint32_t seq;
+    bool any_flip_accepted = false;
+
+    state_record_encode(record, 77, &sample);
+
+    // Every single bit flip, CRC included
+    for (int byte = 0; byte < STATE_RECORD_SIZE; byte++) {
+        for (int bit = 0; bit < 8; bit++) {
+            memcpy(bad, record, sizeof(bad));
+            bad[byte] ^= 1 << bit;
+            any_flip_accepted |= state_record_decode(bad, &seq, &state);
+        }
+    }
+    CHECK(!any_flip_accepted);
+
+    // Another layout version, or an effect this build does not have, even
+    // with a good CRC
+    memcpy(bad, record, sizeof(bad));
+    bad[4] = STATE_RECORD_VERSION + 1;
+    uint32_t crc = esp_rom_crc32_le(0, bad, STATE_RECORD_SIZE - 4);
+    memcpy(&bad[20], &(uint8_t[4]){crc, crc >> 8, crc >> 16, crc >> 24}, 4);
+    CHECK(!state_record_decode(bad, &seq, &state));
+
+    memcpy(bad, record, sizeof(bad));
+    bad[5] = EFFECT_MAX;
+    crc = esp_rom_crc32_le(0, bad, STATE_RECORD_SIZE - 4);
+    memcpy(&bad[20], &(uint8_t[4]){crc, crc >> 8, crc >> 16, crc >> 24}, 4);
+    CHECK(!state_record_decode(bad, &seq, &state));
+
+    // Blank and erased flash
+    memset(bad, 0, sizeof(bad));
+    CHECK(!state_record_decode(bad, &seq, &state));
+    memset(bad, 0xFF, sizeof(bad));
+    CHECK(!state_record_decode(bad, &seq, &state));
+
+    // A blob of the wrong size is not even decoded
+    state_record_pick_t pick;
+    state_record_pick_init(&pick);
+    state_record_pick_offer(&pick, 0, record, STATE_RECORD_SIZE - 1);
+    state_record_pick_offer(&pick, 1, record, 0);
+    CHECK(!pick.found);
+    CHECK_EQ(pick.slot, -1);
+    state_record_pick_offer(&pick, 2, record, STATE_RECORD_SIZE);
+    CHECK(pick.found);
+    CHECK_EQ(pick.slot, 2);
+}
+
+// Write after write, from an empty ring and through the sequence wrapping:
+// the record just written always wins, and never overwrites the one before
+static void test_ring_across_wrap(void) {
+    ring_t ring = {0};
+    bool newest_wins = true, previous_kept = true;
+
+    CHECK(!ring_pick(&ring).found);
+    for (uint32_t n = 0, seq = 0xFFFFFFF0u; n < 40; n++, seq++) {
+        ring_write(&ring, seq);
+        state_record_pick_t pick = ring_pick(&ring);
+        light_state_t expected = state_for(seq);
+        newest_wins &= pick.found && pick.seq == seq && pick.slot == state_record_slot(seq) &&
+                       state_equal(&pick.state, &expected);
+        previous_kept &= n == 0 || state_record_slot(seq - 1) != state_record_slot(seq);
+    }
+    CHECK(newest_wins);
+    CHECK(previous_kept);
+
+    // The slots straddle the wrap: 0xFFFFFFFE, 0xFFFFFFFF, 0, 1
+    memset(&ring, 0, sizeof(ring));
+    for (uint32_t seq = 0xFFFFFFFEu; seq != 2; seq++) {
+        ring_write(&ring, seq);
+    }
+    state_record_pick_t pick = ring_pick(&ring);
+    CHECK_EQ(pick.seq, 1);
+    CHECK_EQ(pick.slot, state_record_slot(1));
+}
+
+// Power lost part way through writing the next record: whatever mix of
+// old and new bytes the slot is left with, the pick is the new record if
+// it is complete and the previous one otherwise
+static void test_torn_write(void) {
+    bool ok = true;
+
+    for (uint32_t base = 0xFFFFFFF8u; base != 8; base++) {
+        ring_t ring = {0};
+        for (uint32_t seq = base; seq != base + STATE_RECORD_SLOTS + 1; seq++) {
+            ring_write(&ring, seq);
+        }
+        uint32_t newest = base + STATE_RECORD_SLOTS;
+        uint32_t next = newest + 1;
+        int slot = state_record_slot(next);
+        uint8_t record[STATE_RECORD_SIZE], old[STATE_RECORD_SIZE];
+        light_state_t state = state_for(next);
+
+        state_record_encode(record, next, &state);
+        memcpy(old, ring.data[slot], sizeof(old));
+        for (int written = 0; written <= STATE_RECORD_SIZE; written++) {
+            memcpy(ring.data[slot], old, sizeof(old));
+            memcpy(ring.data[slot], record, written);
+            state_record_pick_t pick = ring_pick(&ring);
+            uint32_t want = written == STATE_RECORD_SIZE ? next : newest;
+            light_state_t expected = state_for(want);
+            ok &= pick.found && pick.seq == want && state_equal(&pick.state, &expected);
+        }
+
+        // Or the slot was erased and nothing landed
+        ring.len[slot] = 0;
+        ok &= ring_pick(&ring).seq == newest;
+    }
+    CHECK(ok);
+}
+
+// The saver on the simulated partition, woken the way the store task
+// wakes it: on every change, and when the last poll said a write is due
+
+#define SECOND_US       1000000LL
+#define MINUTE_US       (60 * SECOND_US)
+#define SETTLE_US       ((int64_t)CONFIG_LIGHT_STATE_SAVE_DELAY_MS * 1000)
+#define INTERVAL_US     ((int64_t)CONFIG_LIGHT_STATE_SAVE_INTERVAL_S * SECOND_US)
+
+static size_t ring_io_read(void *ctx, int slot, uint8_t *buf, size_t size) {
+    ring_t *ring = ctx;
+    memcpy(buf, ring->data[slot], ring->len[slot] < size ? ring->len[slot] : size);
+    return ring->len[slot];
+}
+
+static bool ring_io_write(void *ctx, int slot, const uint8_t *data, size_t len) {
+    ring_t *ring = ctx;
+    if (ring->fail_writes > 0) {
+        ring->fail_writes--;
+        return false;
+    }
+    memcpy(ring->data[slot], data, len);
+    ring->len[slot] = len;
+    ring->writes++;
+    return true;
+}
+
+typedef struct {
+    ring_t ring;
+    state_record_saver_t saver;
+    int64_t due_us;
+} sim_t;
+
+static void sim_init(sim_t *sim) {
+    memset(sim, 0, sizeof(*sim));
+    state_record_saver_init(&sim->saver,
+                            &(state_record_io_t){ .read = ring_io_read, .write = ring_io_write, .ctx = &sim->ring },
+                            SETTLE_US, INTERVAL_US);
+    sim->due_us = STATE_RECORD_NOT_DUE;
+}
+
+// Serve every wakeup up to t
+static void sim_run(sim_t *sim, int64_t t) {
+    while (sim->due_us <= t) {
+        sim->due_us = state_record_saver_poll(&sim->saver, sim->due_us);
+    }
+}
+
+static void sim_change(sim_t *sim, const light_state_t *state, int64_t t) {
+    sim_run(sim, t);
+    state_record_saver_change(&sim->saver, state, t);
+    sim->due_us = state_record_saver_poll(&sim->saver, t);
+}
+
+static light_state_t brightness_state(uint32_t brightness) {
+    light_state_t state = sample;
+    state.brightness = brightness;
+    return state;
+}
+
+// A brightness slider dragged for three seconds, one change per 20 ms
+// frame: a single write, of the value it ended on, once it has settled
+static void test_saver_slider_burst(void) {
+    sim_t sim;
+    int64_t t = 5 * SECOND_US;
+
+    sim_init(&sim);
+    for (int i = 0; i < 150; i++, t += 20000) {
+        light_state_t state = brightness_state(100 + i * 20);
+        sim_change(&sim, &state, t);
+    }
+    int64_t last_change = t - 20000;
+    sim_run(&sim, last_change + SETTLE_US - 1);
+    CHECK_EQ(sim.ring.writes, 0);
+    sim_run(&sim, last_change + SETTLE_US);
+    CHECK_EQ(sim.ring.writes, 1);
+    sim_run(&sim, last_change + 10 * MINUTE_US);
+    CHECK_EQ(sim.ring.writes, 1);
+    CHECK_EQ(sim.saver.stats.writes, 1);
+    CHECK_EQ(state_record_saver_writes_last_hour(&sim.saver, last_change + MINUTE_US), 1);
+
+    // What a reboot reads back
+    state_record_saver_t fresh;
+    light_state_t restored, expected = brightness_state(100 + 149 * 20);
+    state_record_saver_init(&fresh, &sim.saver.io, SETTLE_US, INTERVAL_US);
+    CHECK(state_record_saver_load(&fresh, &restored));
+    CHECK(state_equal(&restored, &expected));
+    CHECK_EQ(fresh.seq, 1);
+
+    // Dragged back to where it was: nothing to write
+    sim_change(&sim, &expected, t + MINUTE_US);
+    sim_run(&sim, t + 10 * MINUTE_US);
+    CHECK_EQ(sim.ring.writes, 1);
+    CHECK_EQ(sim.saver.stats.unchanged, 1);
+
+    // The same values written channel by channel are another state
+    light_state_t manual = expected;
+    manual.manual = true;
+    sim_change(&sim, &manual, t + 20 * MINUTE_US);
+    sim_run(&sim, t + 30 * MINUTE_US);
+    CHECK_EQ(sim.ring.writes, 2);
+    CHECK(ring_pick(&sim.ring).state.manual);
+}
+
+// Changes that never settle are written once per interval, not once per
+// change, and the last one is written after they stop
+static void test_saver_interval(void) {
+    sim_t sim;
+    int64_t t = 0;
+    uint32_t n = 0;
+
+    sim_init(&sim);
+    for (; t < MINUTE_US; t += 40000, n++) {
+        light_state_t state = brightness_state(n % 4000);
+        sim_change(&sim, &state, t);
+    }
+    CHECK_EQ(sim.ring.writes, MINUTE_US / INTERVAL_US - 1);
+    sim_run(&sim, t + MINUTE_US);
+    CHECK_EQ(sim.ring.writes, MINUTE_US / INTERVAL_US);
+
+    // Writes never closer than an interval, even for changes that settle
+    // right after one
+    sim_init(&sim);
+    for (int i = 0; i < 20; i++) {
+        light_state_t state = brightness_state(i);
+        sim_change(&sim, &state, i * (SETTLE_US + 1));
+    }
+    sim_run(&sim, 20 * (SETTLE_US + 1) - 1);
+    CHECK(sim.ring.writes <= 20 * (SETTLE_US + 1) / INTERVAL_US + 1);
+    sim_run(&sim, 10 * MINUTE_US);
+    state_record_pick_t pick = ring_pick(&sim.ring);
+    light_state_t last = brightness_state(19);
+    CHECK(state_equal(&pick.state, &last));
+}
+
+// The metric counts the last 60 minutes only
+static void test_saver_writes_last_hour(void) {
+    sim_t sim;
+
+    sim_init(&sim);
+    for (int k = 0; k < 18; k++) {
+        light_state_t state = brightness_state(k + 1);
+        sim_change(&sim, &state, k * 5 * MINUTE_US);
+    }
+    sim_run(&sim, 90 * MINUTE_US);
+    CHECK_EQ(sim.ring.writes, 18);
+    // Written in minutes 0, 5 .. 85; minutes 31 to 90 are the last hour
+    CHECK_EQ(state_record_saver_writes_last_hour(&sim.saver, 90 * MINUTE_US), 11);
+    CHECK_EQ(state_record_saver_writes_last_hour(&sim.saver, 200 * MINUTE_US), 0);
+}
+
+// A failed write is not lost: it is tried again an interval later
+static void test_saver_write_error(void) {
+    sim_t sim;
+    light_state_t state = brightness_state(1234);
+
+    sim_init(&sim);
+    sim.ring.fail_writes = 1;
+    sim_change(&sim, &state, 0);
+    sim_run(&sim, SETTLE_US);
+    CHECK_EQ(sim.saver.stats.errors, 1);
+    CHECK_EQ(sim.ring.writes, 0);
+    sim_run(&sim, SETTLE_US + INTERVAL_US - 1);
+    CHECK_EQ(sim.ring.writes, 0);
+    sim_run(&sim, SETTLE_US + INTERVAL_US);
+    CHECK_EQ(sim.ring.writes, 1);
+    CHECK_EQ(sim.saver.stats.writes, 1);
+    state_record_pick_t pick = ring_pick(&sim.ring);
+    CHECK(state_equal(&pick.state, &state));
+}
+
+// Shows, programs and streams need data a reboot loses. Running one saves
+// the effect before it with the new settings, and a record that holds one
+// anyway restores the default effect instead of a dark fixture.
+static void test_saver_ram_only_effects(void) {
+    static const light_effect_t ram_only[] = {EFFECT_TIMELINE, EFFECT_USER_PROGRAM, EFFECT_STREAM};
+    sim_t sim;
+    int64_t t = 0;
+
+    sim_init(&sim);
+    light_state_t breathing = sample;
+    breathing.type = EFFECT_BREATHING;
+    sim_change(&sim, &breathing, t);
+    for (size_t i = 0; i < sizeof(ram_only) / sizeof(ram_only[0]); i++) {
+        t += MINUTE_US;
+        light_state_t show = breathing;
+        show.type = ram_only[i];
+        show.brightness = 1000 + i;
+        sim_change(&sim, &show, t);
+        sim_run(&sim, t + MINUTE_US - 1);
+
+        state_record_pick_t pick = ring_pick(&sim.ring);
+        light_state_t expected = breathing;
+        expected.brightness = 1000 + i;
+        CHECK(state_equal(&pick.state, &expected));
+    }
+
+    // Nothing restorable seen since boot: the boot default
+    sim_init(&sim);
+    light_state_t stream = sample;
+    stream.type = EFFECT_STREAM;
+    sim_change(&sim, &stream, 0);
+    sim_run(&sim, MINUTE_US);
+    CHECK_EQ(ring_pick(&sim.ring).state.type, EFFECT_SMOOTH_FADE);
+
+    // A record written before this check existed
+    for (size_t i = 0; i < sizeof(ram_only) / sizeof(ram_only[0]); i++) {
+        ring_t ring = {0};
+        state_record_saver_t saver;
+        light_state_t state = sample, restored;
+        state.type = ram_only[i];
+        state_record_encode(ring.data[1], 1, &state);
+        ring.len[1] = STATE_RECORD_SIZE;
+        state_record_saver_init(&saver, &(state_record_io_t){ .read = ring_io_read, .write = ring_io_write, .ctx = &ring },
+                                SETTLE_US, INTERVAL_US);
+        CHECK(state_record_saver_load(&saver, &restored));
+        CHECK_EQ(restored.type, EFFECT_SMOOTH_FADE);
+        CHECK_EQ(restored.brightness, sample.brightness);
+    }
+}
+
+int main(void) {
+    RUN_TEST(test_known_record);
+    RUN_TEST(test_decode_rejects);
+    RUN_TEST(test_ring_across_wrap);
+    RUN_TEST(test_torn_write);
+    RUN_TEST(test_saver_slider_burst);
+    RUN_TEST(test_saver_interval);
+    RUN_TEST(test_saver_writes_last_hour);
+    RUN_TEST(test_saver_write_error);
+    RUN_TEST(test_saver_ram_only_effects);
+    return host_test_result();
+}
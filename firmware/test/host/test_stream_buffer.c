@@ -0,0 +1,202 @@
+#include "host_test.h"
+#include "stream_buffer.h"
+#include "effect_luts.h"
+
+// The jitter buffer on a simulated link: frames sent every 20 ms on the
+// sender's clock, each delivered after its own delay, and played on a
+// 20 ms frame clock. Frame k carries the ramp value LEVEL(k) in red, so
+// what plays shows which frames made it and when.
+
+#define SEND_US     20000
+#define LATENCY_MS  80
+#define T0_US       1000000
+#define LEVEL(k)    ((uint32_t)(k) * (EFFECT_LUT_MAX_DUTY / 64))
+
+typedef struct {
+    stream_buffer_t sb;
+    uint32_t sent;                     // Frames handed to the link
+    int64_t arrival_us[64];            // Per frame
+    uint32_t order[64];                // Frames in arrival order
+    uint32_t delivered;
+} link_t;
+
+// Frames 0..count-1, frame k delayed by delay_us[k]
+static void link_init(link_t *l, uint32_t count, const int32_t *delay_us) {
+    stream_buffer_init(&l->sb, LATENCY_MS);
+    l->sent = count;
+    l->delivered = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        l->arrival_us[k] = T0_US + (int64_t)k * SEND_US + delay_us[k];
+        l->order[k] = k;
+    }
+    // Stable sort by arrival
+    for (uint32_t i = 1; i < count; i++) {
+        for (uint32_t j = i; j > 0 && l->arrival_us[l->order[j]] < l->arrival_us[l->order[j - 1]]; j--) {
+            uint32_t tmp = l->order[j];
+            l->order[j] = l->order[j - 1];
+            l->order[j - 1] = tmp;
+        }
+    }
+}
+
+// Deliver every frame that has arrived by now_us, one BLE write each
+static void link_deliver(link_t *l, int64_t now_us) {
+    while (l->delivered < l->sent && l->arrival_us[l->order[l->delivered]] <= now_us) {
+        uint32_t k = l->order[l->delivered++];
+        light_stream_frame_t f = { .ts_ms = 5000 + k * (SEND_US / 1000), .r = LEVEL(k) };
+        stream_buffer_push(&l->sb, &f, 1, now_us);
+    }
+}
+
+// Run the link to end_us, playing a frame every SEND_US from first_play_us
+static uint32_t link_run(link_t *l, int64_t first_play_us, int64_t end_us, uint32_t *played, uint32_t max) {
+    uint32_t n = 0;
+
+    for (int64_t t = T0_US; t < end_us; t += 1000) {
+        link_deliver(l, t);
+        if (t >= first_play_us && (t - first_play_us) % SEND_US == 0 && n < max) {
+            effect_frame_t out;
+            stream_buffer_play(&l->sb, t, &out);
+            played[n++] = out.r;
+        }
+    }
+    return n;
+}
+
+// No delay: every frame plays LATENCY_MS after it arrived, and between
+// frames the output is interpolated
+static void test_steady(void) {
+    static link_t l;
+    int32_t delay[40] = {0};
+    uint32_t played[64];
+
+    link_init(&l, 40, delay);
+    uint32_t n = link_run(&l, T0_US + LATENCY_MS * 1000 - SEND_US / 2, T0_US + 900000, played, 64);
+
+    CHECK_EQ(played[0], 0);                                       // Nothing due yet: black
+    for (uint32_t i = 1; i < 39; i++) {
+        CHECK_NEAR(played[i], (LEVEL(i - 1) + LEVEL(i)) / 2, 1);  // Halfway between frames
+    }
+    CHECK(n > 40);
+    CHECK_EQ(l.sb.stats.received, 40);
+    CHECK_EQ(l.sb.stats.late, 0);
+    CHECK_EQ(l.sb.stats.dropped, 0);
+    CHECK_EQ(l.sb.stats.underruns, 1);                            // Only at the end of the stream
+}
+
+// Delivery jitter within the latency, swapping some neighbours: a frame
+// that arrives after a newer one is dropped, and play never goes back
+static void test_reordering(void) {
+    static link_t l;
+    int32_t delay[40];
+    uint32_t played[64], swapped = 0;
+
+    for (uint32_t k = 0; k < 40; k++) {
+        delay[k] = (k % 5 == 2) ? 30000 : (int32_t)(k % 3) * 4000;
+    }
+    for (uint32_t k = 1; k < 40; k++) {
+        swapped += (T0_US + k * SEND_US + delay[k]) < (T0_US + (k - 1) * SEND_US + delay[k - 1]);
+    }
+    link_init(&l, 40, delay);
+    uint32_t n = link_run(&l, T0_US + LATENCY_MS * 1000, T0_US + 900000, played, 64);
+
+    CHECK(swapped > 0);
+    CHECK_EQ(l.sb.stats.dropped, swapped);
+    CHECK_EQ(l.sb.stats.received, 40 - swapped);
+    CHECK_EQ(l.sb.stats.late, 0);
+    bool monotonic = true;
+    for (uint32_t i = 1; i < n; i++) {
+        monotonic &= played[i] >= played[i - 1];
+    }
+    CHECK(monotonic);
+    CHECK_EQ(played[39], LEVEL(39));
+
+    // Repeats in one batch are dropped too
+    light_stream_frame_t batch[3] = { { .ts_ms = 9000 }, { .ts_ms = 9000 }, { .ts_ms = 9020 } };
+    stream_buffer_init(&l.sb, LATENCY_MS);
+    CHECK_EQ(stream_buffer_push(&l.sb, batch, 3, T0_US), 2);
+    CHECK_EQ(l.sb.stats.dropped, 1);
+}
+
+// The link stalls for 200 ms and then delivers the backlog at once. The
+// buffer runs dry once: the ramp goes on for STREAM_EXTRAPOLATE_US and then
+// holds. The backlog counts as late, and play jumps to where it should be.
+static void test_stall(void) {
+    static link_t l;
+    int32_t delay[40] = {0};
+    uint32_t played[64];
+    const uint32_t stall_from = 10, stall_to = 20;
+
+    for (uint32_t k = stall_from; k < stall_to; k++) {
+        delay[k] = (int32_t)((stall_to - k) * SEND_US);           // All arrive with frame stall_to
+    }
+    link_init(&l, 40, delay);
+    uint32_t n = link_run(&l, T0_US + LATENCY_MS * 1000, T0_US + 900000, played, 64);
+
+    CHECK(n > 30);
+    CHECK_EQ(l.sb.stats.received, 40);
+    CHECK_EQ(l.sb.stats.dropped, 0);
+    CHECK(l.sb.stats.late >= (stall_to - stall_from) - LATENCY_MS * 1000 / SEND_US);
+    CHECK_EQ(l.sb.stats.underruns, 2);                            // The stall, and the end
+
+    // Frames before the stall play on time
+    for (uint32_t i = 0; i < stall_from; i++) {
+        CHECK_EQ(played[i], LEVEL(i));
+    }
+    // Dry until the backlog arrives with frame stall_to: the ramp continues
+    // for STREAM_EXTRAPOLATE_US past the last frame, then holds
+    const uint32_t extrapolated = STREAM_EXTRAPOLATE_US / SEND_US;
+    const uint32_t last = stall_from - 1;
+    const uint32_t dry_end = stall_to - LATENCY_MS * 1000 / SEND_US;
+    for (uint32_t i = stall_from; i < dry_end; i++) {
+        uint32_t ahead = (i - last) < extrapolated ? (i - last) : extrapolated;
+        CHECK_NEAR(played[i], LEVEL(last) + ahead * (LEVEL(1) - LEVEL(0)), 1);
+    }
+    CHECK(dry_end - stall_from > extrapolated);                   // Long enough to hold
+    // Then play is back on the sender's schedule. The backlog is stamped
+    // with the mapping as it leaked during the stall, a fraction of a
+    // millisecond late, until frame stall_to pulls it back.
+    for (uint32_t i = dry_end; i < 40; i++) {
+        CHECK_NEAR(played[i], LEVEL(i), 1);
+    }
+}
+
+// A buffer that is full drops what does not fit; a restart plays black
+// until the next frame is due; a sender clock jump starts the mapping over
+static void test_overflow_and_restart(void) {
+    static stream_buffer_t sb;
+    light_stream_frame_t f = { .r = EFFECT_LUT_MAX_DUTY };
+    light_stream_stats_t stats;
+    effect_frame_t out;
+
+    stream_buffer_init(&sb, LATENCY_MS);
+    for (uint32_t k = 0; k < LIGHT_STREAM_BUFFER_FRAMES + 4; k++) {
+        f.ts_ms = k * 20;
+        stream_buffer_push(&sb, &f, 1, T0_US);
+    }
+    stream_buffer_get_stats(&sb, &stats);
+    CHECK_EQ(stats.buffered, LIGHT_STREAM_BUFFER_FRAMES);
+    CHECK_EQ(stats.dropped, 4);
+
+    stream_buffer_play(&sb, T0_US + LATENCY_MS * 1000, &out);
+    CHECK_EQ(out.r, EFFECT_LUT_MAX_DUTY);
+    stream_buffer_restart(&sb);
+    stream_buffer_play(&sb, T0_US + LATENCY_MS * 1000, &out);
+    CHECK_EQ(out.r, 0);
+
+    // The sender restarts its clock: its frames play LATENCY_MS after arrival
+    stream_buffer_init(&sb, LATENCY_MS);
+    f.ts_ms = 100000;
+    stream_buffer_push(&sb, &f, 1, T0_US);
+    f.ts_ms = 20;
+    CHECK_EQ(stream_buffer_push(&sb, &f, 1, T0_US + 20000), 1);
+    CHECK_EQ(sb.slots[1].due_us, T0_US + 20000 + LATENCY_MS * 1000);
+}
+
+int main(void) {
+    RUN_TEST(test_steady);
+    RUN_TEST(test_reordering);
+    RUN_TEST(test_stall);
+    RUN_TEST(test_overflow_and_restart);
+    return host_test_result();
+}
@@ -0,0 +1,258 @@
+#include "host_test.h"
+#include "tempo_pll.h"
+
+// Beat trains fed through tempo_pll_beat() the way the effects task feeds
+// it, with the timing faults the app and the radio add: tap jitter on the
+// sender's clock, varying BLE delivery, stray taps, and a song that jumps.
+// The grid is checked against the true beats.
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    rng_state = rng_state * 1103515245 + 12345;
+    return rng_state >> 8;
+}
+
+static int32_t rng_range(int32_t lo, int32_t hi) {
+    return lo + (int32_t)(rng() % (uint32_t)(hi - lo + 1));
+}
+
+// The phone: its clock against local time, and how late its messages land
+typedef struct {
+    int64_t clock_offset_us;            // Sender clock minus local clock
+    int32_t clock_ppm;                  // Sender crystal error
+    int32_t jitter_us;                  // Tap or onset detector error, +-
+    int32_t delay_min_us, delay_max_us; // BLE delivery
+} sender_t;
+
+static void send_beat(tempo_pll_t *pll, const sender_t *s, int64_t true_us) {
+    int64_t tap_us = true_us + rng_range(-s->jitter_us, s->jitter_us);
+    int64_t sender_us = tap_us + s->clock_offset_us + tap_us * s->clock_ppm / 1000000;
+    int64_t arrival_us = tap_us + rng_range(s->delay_min_us, s->delay_max_us);
+    tempo_pll_beat(pll, (uint32_t)(sender_us / 1000), arrival_us);
+}
+
+// Grid beat nearest t minus t: positive if the grid is late
+static int64_t grid_error_us(const tempo_pll_t *pll, int64_t t_us) {
+    uint32_t count, phase;
+    if (!tempo_pll_position(pll, t_us, &count, &phase)) {
+        return INT64_MAX;
+    }
+    return -(((int64_t)(int32_t)phase * pll->period_us) >> 32);
+}
+
+static int64_t abs64(int64_t v) {
+    return v < 0 ? -v : v;
+}
+
+static const sender_t clean = {
+    .clock_offset_us = 1000000000, .delay_min_us = 0, .delay_max_us = 0,
+};
+
+static const sender_t phone = {
+    .clock_offset_us = 1700000000000LL, .clock_ppm = 40, .jitter_us = 8000,
+    .delay_min_us = 4000, .delay_max_us = 60000,
+};
+
+static void test_tap_tempo(void) {
+    tempo_pll_t pll;
+    const int64_t period = 500000;                        // 120 BPM
+
+    tempo_pll_reset(&pll);
+    send_beat(&pll, &clean, 10000000);
+    CHECK(!pll.running);
+    CHECK_EQ(tempo_pll_bpm_x100(&pll), 0);
+    send_beat(&pll, &clean, 10000000 + period);
+    CHECK(pll.running);
+    CHECK_EQ(tempo_pll_bpm_x100(&pll), 12000);
+
+    // Beats land on phase 0 and count up
+    uint32_t count, phase;
+    CHECK(tempo_pll_position(&pll, 10000000 + 3 * period, &count, &phase));
+    CHECK_EQ(count, 2);
+    CHECK_EQ(phase, 0);
+    CHECK(tempo_pll_position(&pll, 10000000 + 3 * period + period / 2, &count, &phase));
+    CHECK_EQ(phase, 1u << 31);
+
+    // An interval out of range does not start a grid
+    tempo_pll_reset(&pll);
+    send_beat(&pll, &clean, 10000000);
+    send_beat(&pll, &clean, 10000000 + 100000);           // 600 BPM
+    CHECK(!pll.running);
+    send_beat(&pll, &clean, 10000000 + 100000 + period);
+    CHECK(pll.running);
+}
+
+// A jittery phone at 128 BPM: after settling, every true beat is within
+// the tap jitter plus the shortest delivery of a grid beat, and the tempo
+// within a fraction of a BPM
+static void test_jitter(void) {
+    tempo_pll_t pll;
+    const int64_t period = 468750;                        // 128 BPM
+    int64_t worst = 0, sum = 0;
+    int checked = 0;
+
+    rng_state = 7;
+    tempo_pll_reset(&pll);
+    for (int k = 0; k < 400; k++) {
+        int64_t beat = 5000000 + k * period;
+        send_beat(&pll, &phone, beat);
+        if (k >= 24) {
+            int64_t next = beat + period;
+            int64_t error = grid_error_us(&pll, next);
+            worst = abs64(error) > worst ? abs64(error) : worst;
+            sum += error;
+            checked++;
+        }
+    }
+    printf("jitter: worst %lld us, mean %lld us, %lu bpm_x100\n", (long long)worst,
+           (long long)(sum / checked), (unsigned long)tempo_pll_bpm_x100(&pll));
+    CHECK(worst < 20000);
+    CHECK(abs64(sum / checked) < 10000);                  // Late by about the shortest delivery
+    CHECK_NEAR(tempo_pll_bpm_x100(&pll), 12800, 20);
+}
+
+// Single stray taps, off by more than a quarter beat, leave the grid alone
+static void test_outliers(void) {
+    tempo_pll_t pll;
+    const int64_t period = 500000;
+
+    rng_state = 11;
+    tempo_pll_reset(&pll);
+    for (int k = 0; k < 32; k++) {
+        send_beat(&pll, &clean, 1000000 + k * period);
+    }
+    int64_t before = grid_error_us(&pll, 1000000 + 40 * period);
+    uint32_t bpm = tempo_pll_bpm_x100(&pll);
+
+    for (int k = 32; k < 96; k++) {
+        int64_t beat = 1000000 + k * period;
+        send_beat(&pll, &clean, beat);
+        if (k % 4 == 1) {
+            send_beat(&pll, &clean, beat + period / 2);   // Off-beat tap
+        }
+        if (k % 8 == 3) {
+            send_beat(&pll, &clean, beat + period / 3);   // And its neighbour
+            send_beat(&pll, &clean, beat + period * 2 / 3);
+        }
+    }
+    CHECK_EQ(pll.outliers, 0);
+    CHECK_EQ(tempo_pll_bpm_x100(&pll), bpm);
+    CHECK_NEAR(grid_error_us(&pll, 1000000 + 100 * period), before, 1000);
+    CHECK(abs64(grid_error_us(&pll, 1000000 + 100 * period)) < 2000);
+}
+
+// The song jumps: a run of beats off the grid moves it, at the old tempo
+// and at a new one, and the error settles again
+static void test_reanchor(void) {
+    tempo_pll_t pll;
+    int64_t period = 500000;
+    int64_t t = 2000000;
+    uint32_t count, phase;
+
+    rng_state = 3;
+    tempo_pll_reset(&pll);
+    for (int k = 0; k < 40; k++, t += period) {
+        send_beat(&pll, &phone, t);
+    }
+
+    // Phase jump of 40% of a beat at the same tempo
+    t += period * 2 / 5;
+    for (int k = 0; k < TEMPO_OUTLIERS - 1; k++, t += period) {
+        send_beat(&pll, &phone, t);
+        CHECK(abs64(grid_error_us(&pll, t + period)) > period / 4);   // Not yet
+    }
+    CHECK(tempo_pll_position(&pll, t, &count, &phase));
+    uint32_t count_before = count;
+    for (int k = 0; k < 32; k++, t += period) {
+        send_beat(&pll, &phone, t);
+    }
+    CHECK(abs64(grid_error_us(&pll, t)) < 20000);
+    CHECK(tempo_pll_position(&pll, t, &count, &phase));
+    CHECK_NEAR(count - count_before, 32, 1);              // Counting went on through the jump
+
+    // The tempo drifts up 5% with no tempo message: the loop follows
+    period = 476190;                                      // 126 BPM
+    int64_t worst = 0;
+    for (int k = 0; k < 96; k++, t += period) {
+        send_beat(&pll, &phone, t);
+        int64_t error = grid_error_us(&pll, t + period);
+        if (k >= 40) {
+            worst = abs64(error) > worst ? abs64(error) : worst;
+        }
+    }
+    printf("reanchor: worst %lld us after the tempo drift\n", (long long)worst);
+    CHECK(worst < 20000);
+    CHECK_NEAR(tempo_pll_bpm_x100(&pll), 12600, 20);
+
+    // New song: the app sends 90 BPM, and the beats that follow are a
+    // third of a beat away from where the grid carried on
+    period = 666667;
+    tempo_pll_set_bpm(&pll, 9000, t);
+    t += period / 3;
+    for (int k = 0; k < 8; k++, t += period) {
+        send_beat(&pll, &phone, t);
+    }
+    worst = 0;
+    for (int k = 0; k < 64; k++, t += period) {
+        send_beat(&pll, &phone, t);
+        int64_t error = grid_error_us(&pll, t + period);
+        worst = abs64(error) > worst ? abs64(error) : worst;
+    }
+    printf("reanchor: worst %lld us after the new song\n", (long long)worst);
+    CHECK(worst < 20000);
+    CHECK_NEAR(tempo_pll_bpm_x100(&pll), 9000, 20);
+}
+
+// A tempo message keeps the phase; a sender clock that jumps restarts the
+// mapping without moving the grid; a slow sender clock does not pile up
+// delay
+static void test_clock_faults(void) {
+    tempo_pll_t pll;
+    const int64_t period = 500000;
+    int64_t t = 3000000;
+    sender_t s = phone;
+
+    rng_state = 5;
+    tempo_pll_reset(&pll);
+    for (int k = 0; k < 40; k++, t += period) {
+        send_beat(&pll, &s, t);
+    }
+    int64_t before = grid_error_us(&pll, t);
+
+    tempo_pll_set_bpm(&pll, 12000, t - period / 3);
+    CHECK_NEAR(grid_error_us(&pll, t), before, 1000);
+
+    s.clock_offset_us += 3600000000LL;                    // Phone clock set an hour on
+    for (int k = 0; k < 8; k++, t += period) {
+        send_beat(&pll, &s, t);
+    }
+    CHECK(abs64(grid_error_us(&pll, t)) < 25000);
+
+    // 20 minutes with the phone 150 ppm slow
+    s.clock_ppm = -150;
+    s.clock_offset_us -= t * s.clock_ppm / 1000000;       // No step at the switch
+    int64_t worst = 0;
+    for (int k = 0; k < 2400; k++, t += period) {
+        send_beat(&pll, &s, t);
+        if (k >= 40) {
+            int64_t error = grid_error_us(&pll, t + period);
+            worst = abs64(error) > worst ? abs64(error) : worst;
+        }
+    }
+    printf("slow sender: worst %lld us\n", (long long)worst);
+    CHECK(worst < 25000);
+    CHECK_NEAR(tempo_pll_bpm_x100(&pll), 12000, 20);
+
+    tempo_pll_set_bpm(&pll, 0, t);
+    CHECK(!tempo_pll_position(&pll, t, &(uint32_t){0}, &(uint32_t){0}));
+}
+
+int main(void) {
+    RUN_TEST(test_tap_tempo);
+    RUN_TEST(test_jitter);
+    RUN_TEST(test_outliers);
+    RUN_TEST(test_reanchor);
+    RUN_TEST(test_clock_faults);
+    return host_test_result();
+}